@@ -9,19 +9,41 @@ SOURCES += \
     src/Grid.cpp \
     src/main.cpp \
     src/Robot.cpp \
+    src/Localization.cpp \
+    src/PoseGraph.cpp \
+    src/ScanMatcher.cpp \
+    src/SubmapSlam.cpp \
     src/Utils.cpp \
-    src/Planning.cpp
+    src/PathPlanner.cpp \
+    src/Planning.cpp \
+    src/SegmentGrid.cpp \
+    src/Simulator.cpp \
+    src/Trace.cpp \
+    src/Metrics.cpp
 
 OTHER_FILES += \
-    CONTROLE.txt
+    CONTROLE.txt \
+    Config/sick-lms200.cfg \
+    Config/lms-270deg-0.5.cfg \
+    Config/lms-270deg-0.25.cfg
 
 HEADERS += \
     src/Grid.h \
     src/GlutClass.h \
     src/PioneerBase.h \
     src/Robot.h \
+    src/Localization.h \
+    src/PoseGraph.h \
+    src/ScanMatcher.h \
+    src/SensorModels.h \
+    src/SubmapSlam.h \
     src/Utils.h \
-    src/Planning.h
+    src/PathPlanner.h \
+    src/Planning.h \
+    src/SegmentGrid.h \
+    src/Simulator.h \
+    src/Trace.h \
+    src/Metrics.h
 
 
 INCLUDEPATH+=/usr/local/Aria/include
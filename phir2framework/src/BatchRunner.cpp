@@ -0,0 +1,370 @@
+#include <pthread.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+
+#include "Robot.h"
+#include "Planning.h"
+
+// Batch runner for parameter sweeps: every row of a CSV file is an independent headless
+// robot+planner instance, with its own Grid, Planning and in-process simulator.
+//
+// The header row names the columns. Run options:
+//   name, map, duration (simulated seconds), motion (keyboard number, 5 = POTFIELD_0),
+//   seed, gridWidth (cells), planEvery (robot cycles per planner run), targetCoverage,
+//   laserNoise, sonarNoise, odometryNoise, localizationMap (a map saved by the map builder, to
+//   localize against with the particle filter)
+// Any other column is a mapping/planning/control parameter (see setParameter).
+
+class BatchRun
+{
+    public:
+        std::vector<std::pair<std::string,std::string> > columns;
+
+        bool ok;
+        std::string error;
+
+        int cycles;
+        float simTime, wallTime;
+        float exploredArea, coverage, timeToExplore;
+        float sensingTime, matchingTime, mappingTime, controlTime, planningTime; // mean per cycle, in seconds
+        float poseError, headingError; // m, deg: final pose estimate against the simulator's true pose
+};
+
+static bool setParameter(Robot* r, const std::string& name, float value)
+{
+    RobotParameters& p = r->params;
+
+    if(name == "himmIncrement")               p.himmIncrement = value;
+    else if(name == "himmDecrement")          p.himmDecrement = value;
+    else if(name == "himmLambdaR")            p.himmLambdaR = value;
+    else if(name == "himmLambdaPhi")          p.himmLambdaPhi = value;
+    else if(name == "logOddsLambdaR")         p.logOddsLambdaR = value;
+    else if(name == "logOddsLambdaPhi")       p.logOddsLambdaPhi = value;
+    else if(name == "sonarLambdaR")           p.sonarLambdaR = value;
+    else if(name == "sonarLambdaPhi")         p.sonarLambdaPhi = value;
+    else if(name == "potFieldLinVel")         p.potFieldLinVel = value;
+    else if(name == "potFieldAngGain")        p.potFieldAngGain = value;
+    else if(name == "fusedMapping")           p.fusedMapping = (value != 0);
+    else if(name == "useHIMM")                p.useHIMM = (value != 0);
+    else if(name == "useLogOdds")             p.useLogOdds = (value != 0);
+    else if(name == "useSonar")               p.useSonar = (value != 0);
+    else if(name == "gaussianLaserModel")     p.gaussianLaserModel = (value != 0);
+    else if(name == "gaussianLaserSigma")     p.gaussianLaserSigma = value;
+    else if(name == "sonarConeStamps")        p.sonarConeStamps = (value != 0);
+    else if(name == "scanMatching")           p.scanMatching = (value != 0);
+    else if(name == "matchLinearWindow")      p.matchLinearWindow = value;
+    else if(name == "matchAngularWindow")     p.matchAngularWindow = value;
+    else if(name == "matchAngularStep")       p.matchAngularStep = value;
+    else if(name == "matchLevels")            p.matchLevels = value;
+    else if(name == "matchMinScore")          p.matchMinScore = value;
+    else if(name == "matchTranslationCost")   p.matchTranslationCost = value;
+    else if(name == "matchRotationCost")      p.matchRotationCost = value;
+    else if(name == "mclMinParticles")        p.mclMinParticles = value;
+    else if(name == "mclMaxParticles")        p.mclMaxParticles = value;
+    else if(name == "mclKLDError")            p.mclKLDError = value;
+    else if(name == "mclSigmaHit")            p.mclSigmaHit = value;
+    else if(name == "mclBeamStep")            p.mclBeamStep = value;
+    else if(name == "mclTranslationNoise")    p.mclTranslationNoise = value;
+    else if(name == "mclRotationNoise")       p.mclRotationNoise = value;
+    else if(name == "mclGlobalInit")          p.mclGlobalInit = (value != 0);
+    else if(name == "mclThreads")             p.mclThreads = value;
+    else if(name == "submapSlam")             p.submapSlam = (value != 0);
+    else if(name == "slamScansPerSubmap")     p.slamScansPerSubmap = value;
+    else if(name == "slamMaxRange")           p.slamMaxRange = value;
+    else if(name == "slamLoopClosureDistance") p.slamLoopClosureDistance = value;
+    else if(name == "slamLoopClosureMinScore") p.slamLoopClosureMinScore = value;
+    else if(name == "preference")             r->plan->preference = value;
+    else if(name == "numPotentialIterations") r->plan->numPotentialIterations = value;
+    else if(name == "fastMarchingObstacleCost")  r->plan->fastMarchingObstacleCost = value;
+    else if(name == "fastMarchingObstacleRange") r->plan->fastMarchingObstacleRange = value;
+    else if(name == "fastMarchingDangerCost")    r->plan->fastMarchingDangerCost = value;
+    else if(name == "fastMarchingToTarget")      r->plan->fastMarchingToTarget = (value != 0);
+    else if(name == "minFrontierSize")           r->plan->minFrontierSize = value;
+    else if(name == "frontierSizeWeight")        r->plan->frontierSizeWeight = value;
+    else if(name == "frontierHysteresis")        r->plan->frontierHysteresis = value;
+    else if(name == "incrementalClassification") r->plan->incrementalClassification = (value != 0);
+    else if(name == "pathAlgorithm")             r->plan->pathPlanner.algorithm = (PathPlanner::Algorithm)(int)value;
+    else if(name == "pathNearWallsCost")         r->plan->pathPlanner.nearWallsCost = value;
+    else if(name == "pathDangerCost")            r->plan->pathPlanner.dangerCost = value;
+    else if(name == "pathTimeBudget")            r->plan->pathPlanner.timeBudget = value;
+    else if(name == "pathLookahead")             p.pathLookahead = value;
+    else
+        return false;
+
+    return true;
+}
+
+static std::string getColumn(BatchRun& run, const std::string& name, const std::string& def)
+{
+    for(unsigned int i=0; i<run.columns.size(); i++)
+        if(run.columns[i].first == name)
+            return run.columns[i].second;
+    return def;
+}
+
+static void runInstance(BatchRun& run)
+{
+    run.ok = false;
+    run.cycles = 0;
+    run.simTime = run.wallTime = 0.0;
+    run.exploredArea = run.coverage = 0.0;
+    run.timeToExplore = -1.0;
+    run.sensingTime = run.matchingTime = run.mappingTime = run.controlTime = run.planningTime = 0.0;
+    run.poseError = run.headingError = 0.0;
+
+    std::string mapname = getColumn(run, "map", "");
+    float duration = atof(getColumn(run, "duration", "300").c_str());
+    int motionKey = atoi(getColumn(run, "motion", "5").c_str());
+    int planEvery = std::max(1, atoi(getColumn(run, "planEvery", "1").c_str()));
+    float targetCoverage = atof(getColumn(run, "targetCoverage", "0.9").c_str());
+
+    LineMap map;
+    if(!map.load(mapname)){
+        run.error = "could not load map";
+        return;
+    }
+
+    // the grid only has to hold the map, seen from the robot's starting point
+    Robot* r;
+    int scale = 10;
+    float radius = 0.0;
+    float cornersX[2] = {map.minX, map.maxX};
+    float cornersY[2] = {map.minY, map.maxY};
+    for(int i=0; i<2; i++)
+        for(int j=0; j<2; j++)
+            radius = std::max(radius, (float)sqrt(pow(cornersX[i]-map.home.x,2) + pow(cornersY[j]-map.home.y,2)));
+    int gridWidth = atoi(getColumn(run, "gridWidth", "0").c_str());
+    if(gridWidth <= 0)
+        gridWidth = 2*((int)(radius*scale) + 100);
+    gridWidth = (gridWidth + LOD_TILE_SIZE-1)/LOD_TILE_SIZE*LOD_TILE_SIZE;
+
+    r = new Robot(gridWidth);
+    r->grid->mutex = new pthread_mutex_t;
+    pthread_mutex_init(r->grid->mutex, NULL);
+    r->setVerbose(false);
+    // the runs already take all the threads
+    r->params.mclThreads = 1;
+
+    const char* runOptions[] = {"name", "map", "duration", "motion", "seed", "gridWidth", "planEvery",
+                                "targetCoverage", "laserNoise", "sonarNoise", "odometryNoise", "localizationMap"};
+    for(unsigned int i=0; i<run.columns.size(); i++){
+        bool isOption = false;
+        for(unsigned int k=0; k<sizeof(runOptions)/sizeof(runOptions[0]); k++)
+            isOption |= (run.columns[i].first == runOptions[k]);
+        if(!isOption && !setParameter(r, run.columns[i].first, atof(run.columns[i].second.c_str()))){
+            run.error = "unknown parameter " + run.columns[i].first;
+            pthread_mutex_destroy(r->grid->mutex);
+            delete r->grid->mutex;
+            delete r->plan;
+            delete r;
+            return;
+        }
+    }
+
+    std::string localizationMap = getColumn(run, "localizationMap", "");
+    if(!localizationMap.empty() && !r->setLocalizationMap(localizationMap)){
+        run.error = "could not load localization map " + localizationMap;
+        pthread_mutex_destroy(r->grid->mutex);
+        delete r->grid->mutex;
+        delete r->plan;
+        delete r;
+        return;
+    }
+
+    r->setSimulationMap(mapname);
+    r->initialize(LOCAL_SIMULATION, NONE, "");
+
+    MotionMode modes[10] = {MANUAL_SIMPLE, MANUAL_SIMPLE, MANUAL_VEL, WANDER, WALLFOLLOW, POTFIELD_0, POTFIELD_1, POTFIELD_2, POTFIELD_3, FOLLOW_PATH};
+    r->motionMode_ = (motionKey >= 1 && motionKey <= 9) ? modes[motionKey] : POTFIELD_0;
+
+    Simulator* sim = r->getSimulator();
+    sim->setSeed(atoi(getColumn(run, "seed", "0").c_str()));
+    sim->laserNoise = atof(getColumn(run, "laserNoise", "0.01").c_str());
+    sim->sonarNoise = atof(getColumn(run, "sonarNoise", "0.05").c_str());
+    sim->odometryNoise = atof(getColumn(run, "odometryNoise", "0").c_str());
+
+    float cellArea = 1.0/(scale*scale);
+    float mapArea = (map.maxX-map.minX)*(map.maxY-map.minY);
+    int numPlans = 0;
+
+    Timer timer;
+    while(r->isRunning() && sim->getTime() < duration){
+        r->run();
+        run.sensingTime += r->sensingTime;
+        run.matchingTime += r->matchingTime;
+        run.mappingTime += r->mappingTime;
+        run.controlTime += r->controlTime;
+
+        if(run.cycles % planEvery == 0){
+            r->plan->run();
+            run.planningTime += r->plan->planningTime;
+            numPlans++;
+        }
+        run.cycles++;
+
+        pthread_mutex_lock(r->grid->mutex);
+        int explored = r->grid->countCells(FREE) + r->grid->countCells(OCCUPIED);
+        pthread_mutex_unlock(r->grid->mutex);
+
+        run.exploredArea = explored*cellArea;
+        run.coverage = std::min(1.0f, run.exploredArea/mapArea);
+        if(run.timeToExplore < 0.0 && run.coverage >= targetCoverage)
+            run.timeToExplore = sim->getTime();
+    }
+    run.wallTime = timer.getTotalTime();
+    run.simTime = sim->getTime();
+
+    // the robot's frame starts at the map's home, with the home's heading
+    Pose truePose = sim->getTruePose();
+    float c = cos(DEG2RAD(map.home.theta)), s = sin(DEG2RAD(map.home.theta));
+    float dx = truePose.x - map.home.x, dy = truePose.y - map.home.y;
+    Pose estimate = r->getCurrentPose();
+    run.poseError = sqrt(pow(c*dx + s*dy - estimate.x, 2) + pow(-s*dx + c*dy - estimate.y, 2));
+    run.headingError = fabs(normalizeAngleDEG(truePose.theta - map.home.theta - estimate.theta));
+
+    if(run.cycles > 0){
+        run.sensingTime /= run.cycles;
+        run.matchingTime /= run.cycles;
+        run.mappingTime /= run.cycles;
+        run.controlTime /= run.cycles;
+    }
+    if(numPlans > 0)
+        run.planningTime /= numPlans;
+
+    pthread_mutex_destroy(r->grid->mutex);
+    delete r->grid->mutex;
+    delete r->plan;
+    delete r;
+
+    run.ok = true;
+}
+
+static std::vector<std::string> splitCSV(const std::string& line)
+{
+    std::vector<std::string> fields;
+    std::stringstream ss(line);
+    std::string f;
+    while(getline(ss, f, ','))
+        fields.push_back(f);
+    return fields;
+}
+
+static bool readRuns(std::string filename, std::vector<BatchRun>& runs)
+{
+    std::ifstream file(filename.c_str());
+    if(!file.is_open())
+        return false;
+
+    std::string line;
+    std::vector<std::string> header;
+    while(getline(file, line)){
+        if(!line.empty() && line[line.size()-1] == '\r')
+            line.erase(line.size()-1);
+        if(line.empty() || line[0] == '#')
+            continue;
+
+        std::vector<std::string> fields = splitCSV(line);
+        if(header.empty()){
+            header = fields;
+            continue;
+        }
+
+        BatchRun run;
+        for(unsigned int i=0; i<fields.size() && i<header.size(); i++)
+            run.columns.push_back(std::make_pair(header[i], fields[i]));
+        runs.push_back(run);
+    }
+
+    return !header.empty();
+}
+
+static void writeReports(std::string prefix, std::vector<BatchRun>& runs)
+{
+    // union of the input columns, in order of appearance
+    std::vector<std::string> names;
+    for(unsigned int r=0; r<runs.size(); r++)
+        for(unsigned int i=0; i<runs[r].columns.size(); i++)
+            if(std::find(names.begin(), names.end(), runs[r].columns[i].first) == names.end())
+                names.push_back(runs[r].columns[i].first);
+
+    const char* metrics = "ok,cycles,simTime,wallTime,exploredArea,coverage,timeToExplore,poseError,headingError,"
+                          "sensingMs,matchingMs,mappingMs,controlMs,planningMs";
+
+    std::ofstream csv((prefix + ".csv").c_str());
+    for(unsigned int i=0; i<names.size(); i++)
+        csv << names[i] << ',';
+    csv << metrics << std::endl;
+
+    std::ofstream json((prefix + ".json").c_str());
+    json << "[" << std::endl;
+
+    for(unsigned int r=0; r<runs.size(); r++){
+        BatchRun& run = runs[r];
+
+        for(unsigned int i=0; i<names.size(); i++)
+            csv << getColumn(run, names[i], "") << ',';
+        csv << run.ok << ',' << run.cycles << ',' << run.simTime << ',' << run.wallTime << ','
+            << run.exploredArea << ',' << run.coverage << ',' << run.timeToExplore << ','
+            << run.poseError << ',' << run.headingError << ','
+            << 1000*run.sensingTime << ',' << 1000*run.matchingTime << ',' << 1000*run.mappingTime << ','
+            << 1000*run.controlTime << ',' << 1000*run.planningTime << std::endl;
+
+        json << "  {\"parameters\": {";
+        for(unsigned int i=0; i<run.columns.size(); i++)
+            json << (i ? ", " : "") << '"' << run.columns[i].first << "\": \"" << run.columns[i].second << '"';
+        json << "}," << std::endl;
+        json << "   \"ok\": " << (run.ok ? "true" : "false") << ", \"error\": \"" << run.error << "\"," << std::endl;
+        json << "   \"cycles\": " << run.cycles << ", \"simTime\": " << run.simTime
+             << ", \"wallTime\": " << run.wallTime << "," << std::endl;
+        json << "   \"exploredArea\": " << run.exploredArea << ", \"coverage\": " << run.coverage
+             << ", \"timeToExplore\": " << run.timeToExplore << "," << std::endl;
+        json << "   \"poseError\": " << run.poseError << ", \"headingError\": " << run.headingError << "," << std::endl;
+        json << "   \"stagesMs\": {\"sensing\": " << 1000*run.sensingTime << ", \"matching\": " << 1000*run.matchingTime
+             << ", \"mapping\": " << 1000*run.mappingTime
+             << ", \"control\": " << 1000*run.controlTime << ", \"planning\": " << 1000*run.planningTime << "}}"
+             << (r+1 < runs.size() ? "," : "") << std::endl;
+    }
+    json << "]" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 2){
+        std::cout << "Usage: " << argv[0] << " <runs.csv> [-j threads] [-o report prefix]" << std::endl;
+        return 1;
+    }
+
+    int numThreads = getNumberOfCores();
+    std::string prefix = "batch-report";
+    for(int i=2; i+1<argc; i+=2){
+        if(!strncmp(argv[i], "-j", 2))
+            numThreads = atoi(argv[i+1]);
+        else if(!strncmp(argv[i], "-o", 2))
+            prefix = argv[i+1];
+    }
+
+    std::vector<BatchRun> runs;
+    if(!readRuns(argv[1], runs)){
+        std::cerr << "Error: could not read " << argv[1] << std::endl;
+        return 1;
+    }
+
+    std::cout << "Running " << runs.size() << " instances on " << numThreads << " threads" << std::endl;
+
+    Timer timer;
+    parallelFor(runs.size(), numThreads, [&](int i){
+        runInstance(runs[i]);
+        std::cout << "Run " << getColumn(runs[i], "name", "") << " (" << i+1 << "/" << runs.size() << "): "
+                  << (runs[i].ok ? "done" : runs[i].error) << std::endl;
+    });
+
+    writeReports(prefix, runs);
+    std::cout << "Finished in " << timer.getTotalTime() << " s, reports in "
+              << prefix << ".csv and " << prefix << ".json" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,551 @@
+#include <pthread.h>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string.h>
+#include <stdlib.h>
+#include <random>
+#include <algorithm>
+
+#include "Robot.h"
+#include "Planning.h"
+
+// Microbenchmarks of the mapping, planning, laser range query and level-of-detail kernels, without ARIA or GLUT.
+//
+// Scan fixtures come from the in-process simulator (random poses on a map, fixed seed)
+// or from a recorded log; planning fixtures are synthetic explored areas of increasing size
+// inside grids of increasing size. Every kernel runs until it adds up to a minimum time,
+// and results are written as <prefix>.csv and <prefix>.json.
+
+// Exposes the protected kernels of Robot and Planning
+class BenchRobot : public Robot
+{
+    public:
+        BenchRobot(int gridWidth) : Robot(gridWidth) {}
+
+        void setScan(const Pose& p, const std::vector<float>& sonars, const std::vector<float>& lasers)
+        {
+            base.setOdometry(p);
+            base.setSonarReadings(sonars);
+            base.setLaserReadings(lasers);
+            currentPose_ = p;
+        }
+
+        int getLaserWindow() { return 2*(int)(base.getMaxLaserRange()*grid->getMapScale()) + 1; }
+        int getSonarWindow() { return 2*(int)(base.getMaxSonarRange()*grid->getMapScale()) + 1; }
+
+        using Robot::mappingWithHIMMUsingLaser;
+        using Robot::mappingWithLogOddsUsingLaser;
+        using Robot::mappingUsingSonar;
+        using Robot::mappingUsingSonarStamps;
+        using Robot::mappingFused;
+};
+
+class BenchPlanning : public Planning
+{
+    public:
+        void setLimits(int minX, int minY, int maxX, int maxY)
+        {
+            gridLimits.minX = minX; gridLimits.maxX = maxX;
+            gridLimits.minY = minY; gridLimits.maxY = maxY;
+            robotPosition.x = (minX+maxX)/2;
+            robotPosition.y = (minY+maxY)/2;
+        }
+
+        // times the search itself, not the kept result
+        void rebuildActiveCells()
+        {
+            activeCellsStale_ = true;
+            updateActiveCells();
+        }
+
+        using Planning::resetCellsTypes;
+        using Planning::updateCellsTypes;
+        using Planning::initializePotentials;
+        using Planning::iteratePotentials;
+        using Planning::updateGradient;
+        using Planning::detectFrontiers;
+        using Planning::computeFastMarching;
+};
+
+class Scan
+{
+    public:
+        Pose pose;
+        std::vector<float> sonars, lasers;
+};
+
+class BenchResult
+{
+    public:
+        std::string kernel, fixture;
+        int gridWidth, exploredWidth; // in cells
+        long cellsPerCall;
+        int calls;
+        double secondsPerCall;
+};
+
+static double minTime = 0.5;
+
+// Calls kernel(i) until minTime has passed, returns the mean time per call
+static double timeKernel(std::function<void(int)> kernel, int& calls)
+{
+    kernel(0); // warm up caches and page in the grid
+
+    Timer timer;
+    calls = 0;
+    do{
+        kernel(calls++);
+    }while(timer.getTotalTime() < minTime);
+
+    return timer.getTotalTime()/calls;
+}
+
+static void makeSyntheticScans(std::string mapname, int numScans, unsigned int seed, std::vector<Scan>& scans)
+{
+    Simulator sim;
+    if(!sim.loadMap(mapname))
+        return;
+    sim.setSeed(seed);
+
+    const LaserDescription& laser = LaserDescription::getConfigured();
+    sim.numLasers = laser.getNumBeams();
+    sim.firstLaserAngle = laser.getFirstAngle();
+    sim.laserAngleIncrement = laser.getAngleIncrement();
+
+    LineMap* map = sim.getMap();
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> ux(map->minX, map->maxX), uy(map->minY, map->maxY), uth(-180.0, 180.0);
+
+    for(int tries=0; (int)scans.size() < numScans && tries < 100*numScans; tries++){
+        Pose p(ux(rng), uy(rng), uth(rng));
+        if(map->getDistanceToNearestLine(p.x, p.y, 1.0) < sim.robotRadius)
+            continue;
+
+        Scan s;
+        sim.setTruePose(p);
+        sim.readLasers(s.lasers);
+        sim.readSonars(s.sonars);
+        s.pose = p;
+        scans.push_back(s);
+    }
+}
+
+static void readRecordedScans(std::string filename, std::vector<Scan>& scans)
+{
+    std::ifstream test(filename.c_str());
+    if(!test.is_open()){
+        std::cerr << "Error: could not open " << filename << std::endl;
+        return;
+    }
+    test.close();
+
+    // the benchmark robots use the configured scanner
+    LogFile log(PLAYBACK, filename);
+    int numBeams = LaserDescription::getConfigured().getNumBeams();
+    if(log.hasLaserDescription() && log.getLaserDescription().getNumBeams() != numBeams){
+        std::cerr << "Error: " << filename << " was recorded with another laser, set PHIR2_LASER_CONFIG to match" << std::endl;
+        return;
+    }
+
+    while(!log.hasEnded()){
+        Scan s;
+        s.pose = log.readPose("Odometry");
+        s.sonars = log.readSensors("Sonar");
+        s.lasers = log.readSensors("Laser");
+        if(s.sonars.size() < 8 || (int)s.lasers.size() < numBeams)
+            break;
+        scans.push_back(s);
+    }
+}
+
+// Explored square of side 'width' around the origin: rooms of 4 m with doors,
+// some unexplored patches, and unexplored space outside
+static void fillSyntheticMap(Grid* g, int width, unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    int half = width/2;
+    int room = 4*g->getMapScale();
+
+    for(int x=-half; x<=half; x++)
+        for(int y=-half; y<=half; y++){
+            Cell* c = g->getCell(x,y);
+            int rx = ((x%room)+room)%room, ry = ((y%room)+room)%room;
+            bool wall = (rx == 0 && ry > room/4) || (ry == 0 && rx > room/4);
+            c->himm = wall ? 15 : 0;
+            c->logodds = wall ? 3.0 : -3.0;
+            c->occupancy = wall ? 0.95 : 0.05;
+        }
+
+    std::uniform_int_distribution<int> pos(-half, half), size(2, 20);
+    for(int k=0; k<width/10; k++){
+        int x0 = pos(rng), y0 = pos(rng), w = size(rng), h = size(rng);
+        for(int x=x0; x<std::min(x0+w, half); x++)
+            for(int y=y0; y<std::min(y0+h, half); y++){
+                Cell* c = g->getCell(x,y);
+                c->himm = 7;
+                c->logodds = 0.0;
+                c->occupancy = 0.5;
+            }
+    }
+}
+
+static void addResult(std::vector<BenchResult>& results, std::string kernel, std::string fixture,
+                      int gridWidth, int exploredWidth, long cellsPerCall, int calls, double secondsPerCall)
+{
+    BenchResult r;
+    r.kernel = kernel;
+    r.fixture = fixture;
+    r.gridWidth = gridWidth;
+    r.exploredWidth = exploredWidth;
+    r.cellsPerCall = cellsPerCall;
+    r.calls = calls;
+    r.secondsPerCall = secondsPerCall;
+    results.push_back(r);
+
+    std::cout << std::left << std::setw(24) << kernel << std::setw(11) << fixture
+              << std::right << std::setw(6) << gridWidth << std::setw(6) << exploredWidth
+              << std::fixed << std::setprecision(2)
+              << std::setw(10) << 1e9*secondsPerCall/cellsPerCall << " ns/cell"
+              << std::setw(10) << cellsPerCall/secondsPerCall/1e6 << " Mcells/s"
+              << std::setw(11) << 1.0/secondsPerCall << " calls/s" << std::endl;
+}
+
+static void benchMapping(int gridWidth, std::string fixture, const std::vector<Scan>& scans, std::vector<BenchResult>& results)
+{
+    BenchRobot* r = new BenchRobot(gridWidth);
+    int calls;
+    double t;
+
+    // every scan is taken at the origin, the kernels' cost does not depend on the position
+    std::function<void(int)> setScan = [&](int i){
+        const Scan& s = scans[i%scans.size()];
+        r->setScan(Pose(0.0, 0.0, s.pose.theta), s.sonars, s.lasers);
+    };
+
+    long laserCells = (long)r->getLaserWindow()*r->getLaserWindow();
+    long sonarCells = (long)r->getSonarWindow()*r->getSonarWindow();
+
+    t = timeKernel([&](int i){ setScan(i); r->mappingWithLogOddsUsingLaser(); }, calls);
+    addResult(results, "mappingLogOddsLaser", fixture, gridWidth, 0, laserCells, calls, t);
+
+    t = timeKernel([&](int i){ setScan(i); r->mappingWithHIMMUsingLaser(); }, calls);
+    addResult(results, "mappingHIMMLaser", fixture, gridWidth, 0, laserCells, calls, t);
+
+    t = timeKernel([&](int i){ setScan(i); r->mappingUsingSonar(); }, calls);
+    addResult(results, "mappingSonar", fixture, gridWidth, 0, sonarCells, calls, t);
+
+    t = timeKernel([&](int i){ setScan(i); r->mappingUsingSonarStamps(); }, calls);
+    addResult(results, "mappingSonarStamps", fixture, gridWidth, 0, sonarCells, calls, t);
+
+    // whole mapping stage, the fused sweep against the three methods one after the other
+    t = timeKernel([&](int i){
+        setScan(i);
+        r->mappingWithHIMMUsingLaser();
+        r->mappingWithLogOddsUsingLaser();
+        r->mappingUsingSonar();
+    }, calls);
+    addResult(results, "mappingThreePasses", fixture, gridWidth, 0, sonarCells, calls, t);
+
+    t = timeKernel([&](int i){ setScan(i); r->mappingFused(); }, calls);
+    addResult(results, "mappingFused", fixture, gridWidth, 0, sonarCells, calls, t);
+
+    r->params.gaussianLaserModel = true;
+    t = timeKernel([&](int i){ setScan(i); r->mappingFused(); }, calls);
+    addResult(results, "mappingGaussian", fixture, gridWidth, 0, sonarCells, calls, t);
+    r->params.gaussianLaserModel = false;
+
+    delete r->plan;
+    delete r;
+}
+
+// PioneerBase::getMinLaserValueInRange as first written, a loop over the sector and the kernel
+static float loopMinLaserValueInRange(const std::vector<float>& lasers, int idFirst, int idLast, int kernelSize)
+{
+    int numLasers = lasers.size();
+    float min = 1000000;
+    for(int i=idFirst; i<=idLast; i++){
+        float val=0;
+        int c=0;
+        for(int j=i-kernelSize;j<=i+kernelSize;j++)
+            if(j>=0 && j<numLasers){
+                val+=lasers[j];
+                c++;
+            }
+        val /= c;
+
+        if(val<min)
+            min = val;
+    }
+
+    return min;
+}
+
+// Sector queries of a reactive controller on every scan (8 sectors, raw and 2-beam kernel),
+// with the old loops and with LaserScanFilter, whose tables are built by the first query.
+// Both must return the same minima up to rounding of the means.
+static void benchLaserQueries(std::string fixture, const std::vector<Scan>& scans, std::vector<BenchResult>& results)
+{
+    int numBeams = scans[0].lasers.size();
+    int sector = std::max(1, numBeams/8);
+    int kernels[2] = {0, 2};
+    int calls;
+    double t;
+    volatile float sink = 0;
+
+    LaserScanFilter filter;
+    double maxDiff = 0.0;
+    for(unsigned int i=0; i<scans.size(); i++){
+        filter.update(scans[i].lasers);
+        for(int k=0; k<2; k++)
+            for(int first=0; first<numBeams; first+=sector){
+                int last = std::min(first+sector-1, numBeams-1);
+                maxDiff = std::max(maxDiff, (double)fabs(loopMinLaserValueInRange(scans[i].lasers, first, last, kernels[k]) -
+                                                         filter.getSmoothedMin(first, last, kernels[k])));
+            }
+    }
+    if(maxDiff > 1e-4)
+        std::cerr << "Warning: laser range queries differ from the loops by " << maxDiff << " m" << std::endl;
+
+    t = timeKernel([&](int i){
+        const std::vector<float>& l = scans[i%scans.size()].lasers;
+        for(int k=0; k<2; k++)
+            for(int first=0; first<numBeams; first+=sector)
+                sink = sink + loopMinLaserValueInRange(l, first, std::min(first+sector-1, numBeams-1), kernels[k]);
+    }, calls);
+    addResult(results, "laserQueriesLoop", fixture, 0, 0, 2*numBeams, calls, t);
+
+    t = timeKernel([&](int i){
+        filter.update(scans[i%scans.size()].lasers);
+        for(int k=0; k<2; k++)
+            for(int first=0; first<numBeams; first+=sector)
+                sink = sink + filter.getSmoothedMin(first, std::min(first+sector-1, numBeams-1), kernels[k]);
+    }, calls);
+    addResult(results, "laserQueriesFilter", fixture, 0, 0, 2*numBeams, calls, t);
+}
+
+static void benchPlanning(int gridWidth, int exploredWidth, unsigned int seed, std::vector<BenchResult>& results)
+{
+    Grid* g = new Grid(gridWidth);
+    fillSyntheticMap(g, exploredWidth, seed);
+
+    BenchPlanning* p = new BenchPlanning();
+    p->setGrid(g);
+    int half = exploredWidth/2;
+    p->setLimits(-half, -half, half, half);
+
+    long cells = (long)(2*half+1)*(2*half+1);
+    int calls;
+    double t;
+
+    t = timeKernel([&](int){ p->resetCellsTypes(); }, calls);
+    addResult(results, "resetCellsTypes", "synthetic", gridWidth, exploredWidth, cells, calls, t);
+
+    t = timeKernel([&](int){ p->updateCellsTypes(); }, calls);
+    addResult(results, "updateCellsTypes", "synthetic", gridWidth, exploredWidth, cells, calls, t);
+
+    t = timeKernel([&](int){ p->rebuildActiveCells(); }, calls);
+    addResult(results, "updateActiveCells", "synthetic", gridWidth, exploredWidth, cells, calls, t);
+
+    t = timeKernel([&](int){ p->initializePotentials(); }, calls);
+    addResult(results, "initializePotentials", "synthetic", gridWidth, exploredWidth, cells, calls, t);
+
+    t = timeKernel([&](int){ p->iteratePotentials(); }, calls);
+    addResult(results, "iteratePotentials", "synthetic", gridWidth, exploredWidth, cells, calls, t);
+
+    t = timeKernel([&](int){ p->updateGradient(); }, calls);
+    addResult(results, "updateGradient", "synthetic", gridWidth, exploredWidth, cells, calls, t);
+
+    // bare sweeps of the explored box reading one field per cell: the cost of the memory order alone
+    bbox box = {-half, half, -half, half};
+    volatile long sink = 0;
+    t = timeKernel([&](int){
+        long sum = 0;
+        for(int x=box.minX; x<=box.maxX; x++)
+            for(int y=box.minY; y<=box.maxY; y++)
+                sum += g->getCell(x,y)->himm;
+        sink = sum;
+    }, calls);
+    addResult(results, "sweepColumns", "synthetic", gridWidth, exploredWidth, cells, calls, t);
+
+    t = timeKernel([&](int){
+        long sum = 0;
+        g->forEachRow(box, [&](Cell* c, int, int minX, int maxX){
+            for(int x=minX; x<=maxX; x++, c++)
+                sum += c->himm;
+        });
+        sink = sum;
+    }, calls);
+    addResult(results, "sweepRows", "synthetic", gridWidth, exploredWidth, cells, calls, t);
+
+    t = timeKernel([&](int){
+        long sum = 0;
+        g->forEachTileRow(box, [&](Cell* c, int, int minX, int maxX){
+            for(int x=minX; x<=maxX; x++, c++)
+                sum += c->himm;
+        });
+        sink = sum;
+    }, calls);
+    addResult(results, "sweepTiles", "synthetic", gridWidth, exploredWidth, cells, calls, t);
+    (void)sink;
+
+    // from scratch each call, without the segments kept from the previous one
+    t = timeKernel([&](int){ p->frontiers.clear(); p->targetFrontier = -1; p->detectFrontiers(); }, calls);
+    addResult(results, "detectFrontiers", "synthetic", gridWidth, exploredWidth, cells, calls, t);
+
+    t = timeKernel([&](int){ p->computeFastMarching(); }, calls);
+    addResult(results, "computeFastMarching", "synthetic", gridWidth, exploredWidth, cells, calls, t);
+
+    bbox limits = {-half, half, -half, half};
+    t = timeKernel([&](int){ p->pathPlanner.updateCosts(g, limits); }, calls);
+    addResult(results, "updatePathCosts", "synthetic", gridWidth, exploredWidth, cells, calls, t);
+
+    // between the centers of the farthest rooms, through the doors
+    int room = 4*g->getMapScale();
+    int center = (half/room)*room - room/2;
+    point2d start = {-center, -center}, goal = {center, center};
+    std::vector<point2d> path;
+    p->pathPlanner.timeBudget = 0.0;
+    p->pathPlanner.algorithm = PathPlanner::ASTAR;
+    t = timeKernel([&](int){ p->pathPlanner.findPath(start, goal, path); }, calls);
+    addResult(results, "findPathAStar", "synthetic", gridWidth, exploredWidth, cells, calls, t);
+
+    p->pathPlanner.algorithm = PathPlanner::JUMP_POINT_SEARCH;
+    t = timeKernel([&](int){ p->pathPlanner.findPath(start, goal, path); }, calls);
+    addResult(results, "findPathJPS", "synthetic", gridWidth, exploredWidth, cells, calls, t);
+
+    // one cell halfway along the path turns OCCUPIED, or FREE again, before each query
+    point2d flip = path[path.size()/2];
+    bbox flipped = {flip.x, flip.x, flip.y, flip.y};
+    std::function<void(int)> toggle = [&](int){
+        Cell* c = g->getCell(flip.x, flip.y);
+        c->occType = (c->occType == FREE) ? OCCUPIED : FREE;
+        p->pathPlanner.updateCosts(g, limits, flipped);
+    };
+    p->pathPlanner.algorithm = PathPlanner::ASTAR;
+    t = timeKernel([&](int i){ toggle(i); p->pathPlanner.findPath(start, goal, path); }, calls);
+    addResult(results, "replanPathAStar", "synthetic", gridWidth, exploredWidth, cells, calls, t);
+
+    p->pathPlanner.algorithm = PathPlanner::D_STAR_LITE;
+    t = timeKernel([&](int i){ toggle(i); p->pathPlanner.findPath(start, goal, path); }, calls);
+    addResult(results, "replanPathDStarLite", "synthetic", gridWidth, exploredWidth, cells, calls, t);
+
+    // with the UNEXPLORED cells passable the tree grows out to the border of the layer
+    p->pathPlanner.unexploredCost = 0;
+    p->pathPlanner.updateCosts(g, limits);
+    t = timeKernel([&](int i){ toggle(i); p->pathPlanner.findPath(start, goal, path); }, calls);
+    addResult(results, "replanPathDStarLiteOpen", "synthetic", gridWidth, exploredWidth, cells, calls, t);
+    p->pathPlanner.unexploredCost = -1;
+    p->pathPlanner.updateCosts(g, limits);
+
+    // the tiles are built by the first query, then only the flipped one is refreshed
+    p->pathPlanner.algorithm = PathPlanner::HIERARCHICAL;
+    t = timeKernel([&](int){ p->pathPlanner.findPath(start, goal, path); }, calls);
+    addResult(results, "findPathHierarchical", "synthetic", gridWidth, exploredWidth, cells, calls, t);
+
+    t = timeKernel([&](int i){ toggle(i); p->pathPlanner.findPath(start, goal, path); }, calls);
+    addResult(results, "replanPathHierarchical", "synthetic", gridWidth, exploredWidth, cells, calls, t);
+
+    // rendering: Grid::draw needs a GL context, so only the LOD rebuild that feeds it is measured
+    t = timeKernel([&](int){ g->markDirty(-half, -half, half, half); g->updatePyramid(); }, calls);
+    addResult(results, "updatePyramid", "synthetic", gridWidth, exploredWidth, cells, calls, t);
+
+    delete p;
+    delete g;
+}
+
+static void writeResults(std::string prefix, const std::vector<BenchResult>& results)
+{
+    std::ofstream csv((prefix + ".csv").c_str());
+    csv << "kernel,fixture,gridWidth,exploredWidth,cellsPerCall,calls,nsPerCell,cellsPerSecond,callsPerSecond" << std::endl;
+
+    std::ofstream json((prefix + ".json").c_str());
+    json << "[" << std::endl;
+
+    for(unsigned int i=0; i<results.size(); i++){
+        const BenchResult& r = results[i];
+        double nsPerCell = 1e9*r.secondsPerCall/r.cellsPerCall;
+        double cellsPerSecond = r.cellsPerCall/r.secondsPerCall;
+        double callsPerSecond = 1.0/r.secondsPerCall;
+
+        csv << r.kernel << ',' << r.fixture << ',' << r.gridWidth << ',' << r.exploredWidth << ','
+            << r.cellsPerCall << ',' << r.calls << ',' << nsPerCell << ',' << cellsPerSecond << ','
+            << callsPerSecond << std::endl;
+
+        json << "  {\"kernel\": \"" << r.kernel << "\", \"fixture\": \"" << r.fixture
+             << "\", \"gridWidth\": " << r.gridWidth << ", \"exploredWidth\": " << r.exploredWidth
+             << ", \"cellsPerCall\": " << r.cellsPerCall << ", \"calls\": " << r.calls
+             << ", \"nsPerCell\": " << nsPerCell << ", \"cellsPerSecond\": " << cellsPerSecond
+             << ", \"callsPerSecond\": " << callsPerSecond << "}"
+             << (i+1 < results.size() ? "," : "") << std::endl;
+    }
+    json << "]" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string mapname = "../phir2framework/Maps/1 - DenseMap.map";
+    std::string logname = "";
+    std::string prefix = "bench-results";
+    unsigned int seed = 42;
+    bool quick = false;
+
+    for(int i=1; i<argc; i++){
+        if(!strncmp(argv[i], "-m", 2) && i+1<argc)
+            mapname = argv[++i];
+        else if(!strncmp(argv[i], "-l", 2) && i+1<argc)
+            logname = argv[++i];
+        else if(!strncmp(argv[i], "-o", 2) && i+1<argc)
+            prefix = argv[++i];
+        else if(!strncmp(argv[i], "-s", 2) && i+1<argc)
+            seed = atoi(argv[++i]);
+        else if(!strncmp(argv[i], "-t", 2) && i+1<argc)
+            minTime = atof(argv[++i]);
+        else if(!strncmp(argv[i], "-q", 2))
+            quick = true;
+        else{
+            std::cout << "Usage: " << argv[0] << " [-m map] [-l recorded log] [-o results prefix]"
+                      << " [-s seed] [-t seconds per kernel] [-q]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<int> gridWidths, exploredWidths;
+    if(quick){
+        gridWidths.push_back(512);
+        exploredWidths.push_back(100);
+    }else{
+        int g[3] = {512, 1024, 2000};
+        int e[4] = {100, 200, 400, 800};
+        gridWidths.assign(g, g+3);
+        exploredWidths.assign(e, e+4);
+    }
+
+    std::vector<Scan> synthetic, recorded;
+    makeSyntheticScans(mapname, 64, seed, synthetic);
+    if(!logname.empty())
+        readRecordedScans(logname, recorded);
+
+    std::vector<BenchResult> results;
+    if(!synthetic.empty())
+        benchLaserQueries("synthetic", synthetic, results);
+    if(!recorded.empty())
+        benchLaserQueries("recorded", recorded, results);
+
+    for(unsigned int g=0; g<gridWidths.size(); g++){
+        if(!synthetic.empty())
+            benchMapping(gridWidths[g], "synthetic", synthetic, results);
+        if(!recorded.empty())
+            benchMapping(gridWidths[g], "recorded", recorded, results);
+
+        // the planner reads 8 cells around the explored area
+        for(unsigned int e=0; e<exploredWidths.size(); e++)
+            if(exploredWidths[e] + 20 < gridWidths[g])
+                benchPlanning(gridWidths[g], exploredWidths[e], seed, results);
+    }
+
+    writeResults(prefix, results);
+    std::cout << "Results in " << prefix << ".csv and " << prefix << ".json" << std::endl;
+
+    return 0;
+}
@@ -7,6 +7,7 @@
 #include <unistd.h>
 
 #include "GlutClass.h"
+#include "Trace.h"
 
 /////////////////////////////////////////////
 ///// CONSTRUCTOR & CLASS INSTANTIATION /////
@@ -64,6 +65,7 @@ void GlutClass::initialize()
     glutReshapeFunc(reshape);
     glutKeyboardFunc(keyboard);
     glutSpecialFunc(specialKeys);     
+    glutMouseFunc(mouse);
 }
 
 void GlutClass::process()
@@ -87,6 +89,8 @@ void GlutClass::setRobot(Robot *r)
 
 void GlutClass::render()
 {
+    TRACE_ZONE("GlutClass::render");
+
     if(robot_->isRunning() == false){
         exit(0);
     }
@@ -103,7 +107,7 @@ void GlutClass::render()
     float yRobot = robotPose.y*scale;
     float angRobot = robotPose.theta;
 
-    float xCenter, yCenter;
+    float xCenter = 0, yCenter = 0;
     if(lockCameraOnRobot){
         xCenter=xRobot;
         yCenter=yRobot;
@@ -112,8 +116,11 @@ void GlutClass::render()
     // Update window region
     glMatrixMode (GL_PROJECTION);
     glLoadIdentity ();
-    glOrtho ((int)(xCenter) + x_aux - halfWindowSize, (int)(xCenter) + x_aux + halfWindowSize-1,
-             (int)(yCenter) - y_aux - halfWindowSize, (int)(yCenter) - y_aux + halfWindowSize-1,-1, 50);
+    viewLeft_ = (int)(xCenter) + x_aux - halfWindowSize;
+    viewRight_ = (int)(xCenter) + x_aux + halfWindowSize-1;
+    viewBottom_ = (int)(yCenter) - y_aux - halfWindowSize;
+    viewTop_ = (int)(yCenter) - y_aux + halfWindowSize-1;
+    glOrtho (viewLeft_, viewRight_, viewBottom_, viewTop_, -1, 50);
     glMatrixMode (GL_MODELVIEW);
     glClearColor(1.0, 1.0, 1.0, 0);
     glClear (GL_COLOR_BUFFER_BIT);
@@ -148,15 +155,18 @@ void GlutClass::render()
     }
 
     // Draw grid
-    pthread_mutex_lock(grid_->mutex);
-    grid_->draw(xi, yi, xf, yf);
-    pthread_mutex_unlock(grid_->mutex);
+    Trace::lockMutex(grid_->mutex, "wait grid mutex", "hold grid mutex");
+    grid_->draw(xi, yi, xf, yf, glutWindowSize);
+    Trace::unlockMutex(grid_->mutex);
 
     // Draw robot path
     if(drawRobotPath){
         robot_->drawPath();
     }
 
+    // Draw planned path and waypoint
+    robot_->plan->drawPath();
+
     // Draw robot
     robot_->draw(xRobot,yRobot,angRobot);
 
@@ -340,6 +350,14 @@ void GlutClass::keyboard(unsigned char key, int x, int y)
             instance->robot_->motionMode_ = POTFIELD_2;
             std::cout << "MotionMode: 7 - POTFIELD_2" << std::endl;
             break;
+        case '8':
+            instance->robot_->motionMode_ = POTFIELD_3;
+            std::cout << "MotionMode: 8 - POTFIELD_3 (FAST MARCHING)" << std::endl;
+            break;
+        case '9':
+            instance->robot_->motionMode_ = FOLLOW_PATH;
+            std::cout << "MotionMode: 9 - FOLLOW_PATH" << std::endl;
+            break;
         case 'l': //Lock camera
             if(instance->lockCameraOnRobot == true){
                 instance->lockCameraOnRobot = false;
@@ -448,3 +466,23 @@ void GlutClass::specialKeys(int key, int x, int y)
         }
 }
 
+
+void GlutClass::mouse(int button, int state, int x, int y)
+{
+    // left click: waypoint for the path planner, right click: back to the frontiers
+    if(state != GLUT_DOWN)
+        return;
+
+    if(button == GLUT_LEFT_BUTTON){
+        float w = glutGet(GLUT_WINDOW_WIDTH), h = glutGet(GLUT_WINDOW_HEIGHT);
+        int cellX = floor(instance->viewLeft_ + (x+0.5)/w*(instance->viewRight_ - instance->viewLeft_));
+        int cellY = floor(instance->viewTop_ - (y+0.5)/h*(instance->viewTop_ - instance->viewBottom_));
+        instance->robot_->plan->setWaypoint(cellX, cellY);
+
+        float scale = instance->grid_->getMapScale();
+        std::cout << "Waypoint: (" << cellX/scale << ", " << cellY/scale << ")" << std::endl;
+    }else if(button == GLUT_RIGHT_BUTTON){
+        instance->robot_->plan->clearWaypoint();
+        std::cout << "Waypoint cleared" << std::endl;
+    }
+}
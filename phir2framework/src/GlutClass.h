@@ -37,6 +37,9 @@ class GlutClass
         int halfWindowSizeX_, halfWindowSizeY_;
         bool lockCameraOnRobot;
 
+        // region shown by the last frame, in cells (for the mouse)
+        float viewLeft_, viewRight_, viewBottom_, viewTop_;
+
         int id_;
 
 	    void render();
@@ -45,6 +48,7 @@ class GlutClass
         static void reshape(int w, int h);
         static void keyboard(unsigned char key, int x, int y);
         static void specialKeys(int key, int x, int y);
+        static void mouse(int button, int state, int x, int y);
 };
 
 #endif /* __GLUT_H__ */
@@ -1,27 +1,33 @@
 #include <cstdio>
+#ifndef HEADLESS
 #include <GL/glut.h>
+#endif
 #include <iostream>
 #include <sstream>
 #include <iomanip>
 #include <float.h> // DBL_MAX
+#include <algorithm>
 
 #include "Grid.h"
 #include "math.h"
 
-Grid::Grid ()
+Grid::Grid (int width)
 {
     mapScale_ = 10;
-    mapWidth_ = mapHeight_ = 2000;
+    mapWidth_ = mapHeight_ = width;
     numCellsInRow_=mapWidth_;
     halfNumCellsInRow_=mapWidth_/2;
+    rowStride_=numCellsInRow_+2*GRID_PADDING;
 
-    cells_ = new Cell[mapWidth_*mapHeight_];
+    // the padding cells are initialized as the ones of the map, UNEXPLORED
+    paddedCells_ = new Cell[rowStride_*(mapHeight_+2*GRID_PADDING)];
+    cells_ = paddedCells_ + GRID_PADDING*rowStride_ + GRID_PADDING;
 
-    for (unsigned int j = 0; j < numCellsInRow_; ++j)
+    for (int j = -GRID_PADDING; j < numCellsInRow_+GRID_PADDING; ++j)
     {
-        for (unsigned int i = 0; i < numCellsInRow_; ++i)
+        for (int i = -GRID_PADDING; i < numCellsInRow_+GRID_PADDING; ++i)
         {
-            unsigned int c = j*numCellsInRow_ + i;
+            int c = j*rowStride_ + i;
             cells_[c].x = -halfNumCellsInRow_ + 1 + i;
             cells_[c].y =  halfNumCellsInRow_ - j;
 
@@ -34,6 +40,7 @@ Grid::Grid ()
             cells_[c].pot[0]  = 0.0;
             cells_[c].pot[1]  = 0.0;
             cells_[c].pot[2]  = 1.0;
+            cells_[c].pot[3]  = 1.0;
             for(unsigned int k=0; k<NUM_POTENTIALS; k++){
                 cells_[c].dirX[k] = 0.0;
                 cells_[c].dirY[k] = 0.0;
@@ -45,7 +52,22 @@ Grid::Grid ()
         }
     }
 
-    numViewModes=6;
+    // level-of-detail pyramid
+    lod_[0] = NULL;
+    lodWidth_[0] = mapWidth_;
+    for(int l=1; l<NUM_LOD_LEVELS; l++){
+        lodWidth_[l] = (lodWidth_[l-1]+1)/2;
+        lod_[l] = new LODCell[lodWidth_[l]*lodWidth_[l]];
+    }
+    numTilesInRow_ = (mapWidth_+LOD_TILE_SIZE-1)/LOD_TILE_SIZE;
+    dirtyTiles_.resize(numTilesInRow_*numTilesInRow_, false);
+    for(int t=0; t<numTilesInRow_*numTilesInRow_; t++){
+        dirtyTiles_[t] = true;
+        dirtyList_.push_back(t);
+    }
+    updatePyramid();
+
+    numViewModes=7;
     viewMode=2;
     firstPotViewMode=3;
 
@@ -53,11 +75,23 @@ Grid::Grid ()
     showArrows=false;
 }
 
+Grid::~Grid()
+{
+    delete [] paddedCells_;
+    for(int l=1; l<NUM_LOD_LEVELS; l++)
+        delete [] lod_[l];
+}
+
 Cell* Grid::getCell (int x, int y)
 {
     int i=x+halfNumCellsInRow_-1;
     int j=halfNumCellsInRow_-y;
-    return &(cells_[j*numCellsInRow_ + i]);
+    return &(cells_[j*rowStride_ + i]);
+}
+
+int Grid::getRowStride()
+{
+    return rowStride_;
 }
 
 int Grid::getMapScale()
@@ -75,13 +109,220 @@ int Grid::getMapHeight()
     return mapHeight_;
 }
 
-void Grid::draw(int xi, int yi, int xf, int yf)
+long Grid::getMemoryUsage()
+{
+    long bytes = (long)rowStride_*(mapHeight_+2*GRID_PADDING)*sizeof(Cell);
+    for(int l=1; l<NUM_LOD_LEVELS; l++)
+        bytes += (long)lodWidth_[l]*lodWidth_[l]*sizeof(LODCell);
+    return bytes;
+}
+
+///////////////////////////////////
+///// LEVEL-OF-DETAIL PYRAMID /////
+///////////////////////////////////
+
+// Coarse level l has one LODCell per 2^l x 2^l block of cells. Every block is contained
+// in a single LOD_TILE_SIZE x LOD_TILE_SIZE tile, so a modified tile is recomputed alone.
+
+void Grid::markDirty(int x, int y)
+{
+    int i=x+halfNumCellsInRow_-1;
+    int j=halfNumCellsInRow_-y;
+    if(i<0 || j<0 || i>=numCellsInRow_ || j>=numCellsInRow_)
+        return;
+
+    int t = (j/LOD_TILE_SIZE)*numTilesInRow_ + i/LOD_TILE_SIZE;
+    if(!dirtyTiles_[t]){
+        dirtyTiles_[t] = true;
+        dirtyList_.push_back(t);
+    }
+}
+
+void Grid::markDirty(int minX, int minY, int maxX, int maxY)
+{
+    int imin = std::max(minX+halfNumCellsInRow_-1, 0) / LOD_TILE_SIZE;
+    int imax = std::min(maxX+halfNumCellsInRow_-1, numCellsInRow_-1) / LOD_TILE_SIZE;
+    int jmin = std::max(halfNumCellsInRow_-maxY, 0) / LOD_TILE_SIZE;
+    int jmax = std::min(halfNumCellsInRow_-minY, numCellsInRow_-1) / LOD_TILE_SIZE;
+
+    for(int tj=jmin; tj<=jmax; tj++){
+        for(int ti=imin; ti<=imax; ti++){
+            int t = tj*numTilesInRow_ + ti;
+            if(!dirtyTiles_[t]){
+                dirtyTiles_[t] = true;
+                dirtyList_.push_back(t);
+            }
+        }
+    }
+}
+
+void Grid::updatePyramid()
+{
+    for(unsigned int k=0; k<dirtyList_.size(); k++){
+        updateTile(dirtyList_[k]);
+        dirtyTiles_[dirtyList_[k]] = false;
+    }
+    dirtyList_.clear();
+}
+
+void Grid::updateTile(int tile)
+{
+    int ti = tile % numTilesInRow_;
+    int tj = tile / numTilesInRow_;
+
+    for(int l=1; l<NUM_LOD_LEVELS; l++){
+        int n = LOD_TILE_SIZE >> l; // coarse cells per tile side at level l
+        int w = lodWidth_[l];
+        int wf = lodWidth_[l-1];
+
+        for(int cj=tj*n; cj<(tj+1)*n && cj<w; cj++){
+            for(int ci=ti*n; ci<(ti+1)*n && ci<w; ci++){
+                LODCell& c = lod_[l][cj*w + ci];
+                c.maxOccupancy = 0.0;
+                c.maxHimm = 0;
+                c.count[OCCUPIED] = c.count[UNEXPLORED] = c.count[FREE] = 0;
+                double sumLogOdds = 0.0;
+
+                for(int j=2*cj; j<=2*cj+1 && j<wf; j++){
+                    for(int i=2*ci; i<=2*ci+1 && i<wf; i++){
+                        if(l==1){
+                            Cell& f = cells_[j*rowStride_ + i];
+                            c.maxOccupancy = std::max(c.maxOccupancy, (float)f.occupancy);
+                            c.maxHimm = std::max(c.maxHimm, f.himm);
+                            c.count[f.occType]++;
+                            sumLogOdds += f.logodds;
+                        }else{
+                            LODCell& f = lod_[l-1][j*wf + i];
+                            c.maxOccupancy = std::max(c.maxOccupancy, f.maxOccupancy);
+                            c.maxHimm = std::max(c.maxHimm, f.maxHimm);
+                            int n = f.count[OCCUPIED] + f.count[UNEXPLORED] + f.count[FREE];
+                            c.count[OCCUPIED] += f.count[OCCUPIED];
+                            c.count[UNEXPLORED] += f.count[UNEXPLORED];
+                            c.count[FREE] += f.count[FREE];
+                            sumLogOdds += f.meanLogOdds*n;
+                        }
+                    }
+                }
+
+                c.meanLogOdds = sumLogOdds / (c.count[OCCUPIED] + c.count[UNEXPLORED] + c.count[FREE]);
+
+                c.majorityType = OCCUPIED;
+                if(c.count[FREE] > c.count[c.majorityType])
+                    c.majorityType = FREE;
+                if(c.count[UNEXPLORED] > c.count[c.majorityType])
+                    c.majorityType = UNEXPLORED;
+            }
+        }
+    }
+}
+
+int Grid::getNumLODLevels()
+{
+    return NUM_LOD_LEVELS;
+}
+
+LODCell* Grid::getLODCell(int level, int x, int y)
+{
+    int i=x+halfNumCellsInRow_-1;
+    int j=halfNumCellsInRow_-y;
+    return &(lod_[level][(j>>level)*lodWidth_[level] + (i>>level)]);
+}
+
+// Checks the 2^level x 2^level block that contains cell (x,y)
+// e.g. level 5 answers "is any cell in this 3.2 m block occupied"
+bool Grid::isBlockOccupied(int level, int x, int y)
+{
+    if(level==0)
+        return getCell(x,y)->occType == OCCUPIED;
+    return getLODCell(level,x,y)->count[OCCUPIED] > 0;
+}
+
+// Number of cells of the given type, read from the coarsest level
+int Grid::countCells(CellOccType type)
+{
+    updatePyramid();
+
+    int l = NUM_LOD_LEVELS-1;
+    int n = 0;
+    for(int c=0; c<lodWidth_[l]*lodWidth_[l]; c++)
+        n += lod_[l][c].count[type];
+    return n;
+}
+
+bool Grid::isAnyCellOccupied(int minX, int minY, int maxX, int maxY)
+{
+    int imin = std::max(minX+halfNumCellsInRow_-1, 0);
+    int imax = std::min(maxX+halfNumCellsInRow_-1, numCellsInRow_-1);
+    int jmin = std::max(halfNumCellsInRow_-maxY, 0);
+    int jmax = std::min(halfNumCellsInRow_-minY, numCellsInRow_-1);
+
+    int l = NUM_LOD_LEVELS-1;
+    for(int cj=jmin>>l; cj<=jmax>>l; cj++)
+        for(int ci=imin>>l; ci<=imax>>l; ci++)
+            if(isAnyCellOccupied(l, ci, cj, imin, jmin, imax, jmax))
+                return true;
+    return false;
+}
+
+bool Grid::isAnyCellOccupied(int level, int ci, int cj, int imin, int jmin, int imax, int jmax)
+{
+    if(level==0)
+        return cells_[cj*rowStride_ + ci].occType == OCCUPIED;
+
+    if(lod_[level][cj*lodWidth_[level] + ci].count[OCCUPIED] == 0)
+        return false;
+
+    // block entirely inside the query region
+    int s = 1 << level;
+    if(ci*s >= imin && (ci+1)*s-1 <= imax && cj*s >= jmin && (cj+1)*s-1 <= jmax)
+        return true;
+
+    // otherwise refine the children that overlap the region
+    int w = lodWidth_[level-1];
+    for(int j=2*cj; j<=2*cj+1 && j<w; j++){
+        if(((j+1)<<(level-1))-1 < jmin || (j<<(level-1)) > jmax)
+            continue;
+        for(int i=2*ci; i<=2*ci+1 && i<w; i++){
+            if(((i+1)<<(level-1))-1 < imin || (i<<(level-1)) > imax)
+                continue;
+            if(isAnyCellOccupied(level-1, i, j, imin, jmin, imax, jmax))
+                return true;
+        }
+    }
+    return false;
+}
+
+#ifndef HEADLESS
+////////////////////////
+///// DRAW METHODS /////
+////////////////////////
+
+void Grid::draw(int xi, int yi, int xf, int yf, int windowWidth)
 {
     glLoadIdentity();
 
+    updatePyramid();
+
+    // pick the coarsest level whose cells still cover at least one pixel
+    int level = 0;
+    if(windowWidth > 0){
+        int cellsPerPixel = (xf-xi+1)/windowWidth;
+        while(level < NUM_LOD_LEVELS-1 && (2<<level) <= cellsPerPixel)
+            level++;
+    }
+
+    if(level > 0){
+        for(int ci=xi>>level; ci<=xf>>level; ++ci){
+            for(int cj=yi>>level; cj<=yf>>level; ++cj){
+                drawLODCell(level, ci, cj);
+            }
+        }
+        return;
+    }
+
     for(int i=xi; i<=xf; ++i){
         for(int j=yi; j<=yf; ++j){
-            drawCell(i+j*numCellsInRow_);
+            drawCell(i+j*rowStride_);
         }
     }
 
@@ -89,7 +330,7 @@ void Grid::draw(int xi, int yi, int xf, int yf)
         glPointSize(2);
         for(int i=xi; i<=xf; ++i){
             for(int j=yi; j<=yf; ++j){
-                drawVector(i+j*numCellsInRow_);
+                drawVector(i+j*rowStride_);
             }
         }
     }
@@ -97,7 +338,7 @@ void Grid::draw(int xi, int yi, int xf, int yf)
     if(showValues){
         for(int i=xi; i<=xf; i++){
             for(int j=yi; j<=yf; j++){
-                drawText(i+j*numCellsInRow_);
+                drawText(i+j*rowStride_);
             }
         }
     }
@@ -140,9 +381,9 @@ void Grid::drawCell(unsigned int n)
         }else if(cells_[n].occType == OCCUPIED){
             glColor3f(0.3,0.0,0.0);
         }
-    }else if(viewMode>=3 && viewMode<6){ //firstPotViewMode=3 NUM_POTENTIAL=3
+    }else if(viewMode>=firstPotViewMode && viewMode<firstPotViewMode+NUM_POTENTIALS){
         // DRAW POTENTIAL FIELDS
-        aux=cells_[n].pot[viewMode-3];
+        aux=cells_[n].pot[viewMode-firstPotViewMode];
         glColor3f(aux,aux,aux);
     }
 
@@ -156,6 +397,44 @@ void Grid::drawCell(unsigned int n)
     glEnd();
 }
 
+void Grid::drawLODCell(int level, int ci, int cj)
+{
+    LODCell& c = lod_[level][cj*lodWidth_[level] + ci];
+    float aux;
+
+    if(viewMode==0){
+        aux=(1.0-c.maxOccupancy);
+        glColor3f(aux,aux,aux);
+    }else if(viewMode==1){
+        aux=(16.0-c.maxHimm)/16.0;
+        glColor3f(aux,aux,aux);
+    }else if(viewMode==2){
+        if(c.majorityType == FREE)
+            glColor3f(1.0,1.0,0.7);
+        else if(c.majorityType == UNEXPLORED)
+            glColor3f(0.6,0.6,0.6);
+        else
+            glColor3f(0.3,0.0,0.0);
+    }else if(viewMode>=firstPotViewMode && viewMode<firstPotViewMode+NUM_POTENTIALS){
+        // potentials are not aggregated, sample the first cell of the block
+        aux=cells_[(cj<<level)*rowStride_ + (ci<<level)].pot[viewMode-firstPotViewMode];
+        glColor3f(aux,aux,aux);
+    }
+
+    int s = 1 << level;
+    int x = (ci<<level) - halfNumCellsInRow_ + 1;
+    int y = halfNumCellsInRow_ - (cj<<level) + 1;
+
+    glBegin( GL_QUADS );
+    {
+        glVertex2f(x+s, y  );
+        glVertex2f(x+s, y-s);
+        glVertex2f(x  , y-s);
+        glVertex2f(x  , y  );
+    }
+    glEnd();
+}
+
 void Grid::drawVector(unsigned int n)
 {
     if(cells_[n].occType == FREE && viewMode>=firstPotViewMode && viewMode<firstPotViewMode+NUM_POTENTIALS){
@@ -167,7 +446,7 @@ void Grid::drawVector(unsigned int n)
         glBegin( GL_LINES );
         {
             glVertex2f(cells_[n].x+0.5, cells_[n].y+0.5);
-            glVertex2f(cells_[n].x+0.5+cells_[n].dirX[viewMode-firstPotViewMode], cells_[n].y+0.5+cells_[n].dirY[viewMode-3]);
+            glVertex2f(cells_[n].x+0.5+cells_[n].dirX[viewMode-firstPotViewMode], cells_[n].y+0.5+cells_[n].dirY[viewMode-firstPotViewMode]);
         }
         glEnd();
         glBegin( GL_POINTS );
@@ -193,3 +472,4 @@ void Grid::drawText(unsigned int n)
         glutBitmapCharacter(GLUT_BITMAP_HELVETICA_10, text[i]);
     }
 }
+#endif
@@ -2,13 +2,37 @@
 #define __GRID_H__
 
 #include <pthread.h>
+#include <algorithm>
+#include <vector>
 
 enum CellOccType {OCCUPIED, UNEXPLORED, FREE};
 enum CellPlanType {REGULAR, DANGER, NEAR_WALLS, FRONTIER, FRONTIER_NEAR_WALL};
 
 #define UNDEF -10000000
 
-#define NUM_POTENTIALS 3
+typedef struct
+{
+    int x,y;
+} point2d;
+
+typedef struct
+{
+    int minX, maxX, minY, maxY;
+} bbox;
+
+// Run of consecutive cells of a row, from minX to maxX
+typedef struct
+{
+    int y, minX, maxX;
+} CellSpan;
+
+#define NUM_POTENTIALS 4
+#define FAST_MARCHING_POTENTIAL 3 // pot[3]: navigation function of Planning::computeFastMarching()
+
+#define LOD_TILE_SIZE 32  // cells per side of a dirty tile (3.2 m at 10 cells/m)
+#define NUM_LOD_LEVELS 6  // level 0 = cells, level 5 = one value per tile
+
+#define GRID_PADDING 8    // UNEXPLORED cells around the map, as far as the widest stencil reads
 
 class Cell
 {
@@ -26,17 +50,54 @@ class Cell
         CellPlanType planType;
 };
 
+class LODCell
+{
+    public:
+        float maxOccupancy;
+        float meanLogOdds;
+        int maxHimm;
+        unsigned short count[3]; // number of fine cells of each CellOccType
+        CellOccType majorityType;
+};
+
 class Grid
 {
     public:
-        Grid();
+        Grid(int width=2000);
+        ~Grid();
         Cell* getCell(int x, int y);
 
+        // Row-major access: the cells of a row are consecutive, from left to right, and the rows
+        // go from the top (largest y) down, getRowStride() cells apart. The neighbours of a cell c
+        // are c-1 and c+1 along x, c-stride (y+1) and c+stride (y-1) along y, and they stay inside
+        // the grid up to GRID_PADDING cells past the edges of the map.
+        int getRowStride();
+
+        // f(Cell* first, int y, int minX, int maxX) for each row of the box, top row first
+        template<class F> void forEachRow(const bbox& b, F f);
+
+        // Same, block by block of LOD_TILE_SIZE x LOD_TILE_SIZE cells (blocks and their rows in
+        // the same order), so that the rows a wide stencil reads around a block stay in cache
+        template<class F> void forEachTileRow(const bbox& b, F f);
+
         int getMapScale();
         int getMapWidth();
         int getMapHeight();
-
-        void draw(int xi, int yi, int xf, int yf);
+        long getMemoryUsage(); // bytes
+
+#ifndef HEADLESS
+        void draw(int xi, int yi, int xf, int yf, int windowWidth=0);
+#endif
+
+        // Level-of-detail pyramid (caller must hold the mutex)
+        void markDirty(int x, int y);
+        void markDirty(int minX, int minY, int maxX, int maxY);
+        void updatePyramid();
+        int getNumLODLevels();
+        LODCell* getLODCell(int level, int x, int y);
+        bool isBlockOccupied(int level, int x, int y);
+        bool isAnyCellOccupied(int minX, int minY, int maxX, int maxY);
+        int countCells(CellOccType type);
 
         int numViewModes;
         int viewMode;
@@ -51,12 +112,45 @@ class Grid
         int mapScale_; // Number of cells per meter
         int mapWidth_, mapHeight_; // in cells
         int numCellsInRow_, halfNumCellsInRow_;
+        int rowStride_; // numCellsInRow_ and the padding on both sides
+
+        Cell* paddedCells_;
+        Cell* cells_;   // top left cell of the map, inside the padding
 
-        Cell* cells_;
+        // LOD pyramid, levels 1..NUM_LOD_LEVELS-1 (level 0 is cells_)
+        LODCell* lod_[NUM_LOD_LEVELS];
+        int lodWidth_[NUM_LOD_LEVELS];
+        int numTilesInRow_;
+        std::vector<bool> dirtyTiles_;
+        std::vector<int> dirtyList_;
 
+        void updateTile(int tile);
+        bool isAnyCellOccupied(int level, int ci, int cj, int imin, int jmin, int imax, int jmax);
+
+#ifndef HEADLESS
         void drawCell(unsigned int i);
+        void drawLODCell(int level, int ci, int cj);
         void drawVector(unsigned int i);
         void drawText(unsigned int n);
+#endif
 };
 
+template<class F>
+void Grid::forEachRow(const bbox& b, F f)
+{
+    for(int y=b.maxY; y>=b.minY; y--)
+        f(getCell(b.minX, y), y, b.minX, b.maxX);
+}
+
+template<class F>
+void Grid::forEachTileRow(const bbox& b, F f)
+{
+    for(int tileY=b.maxY; tileY>=b.minY; tileY-=LOD_TILE_SIZE)
+        for(int tileX=b.minX; tileX<=b.maxX; tileX+=LOD_TILE_SIZE){
+            int maxX = std::min(tileX + LOD_TILE_SIZE-1, b.maxX);
+            for(int y=tileY; y>tileY-LOD_TILE_SIZE && y>=b.minY; y--)
+                f(getCell(tileX, y), y, tileX, maxX);
+        }
+}
+
 #endif // __GRID_H__
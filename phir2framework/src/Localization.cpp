@@ -0,0 +1,429 @@
+#include "Localization.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define Z_HIT 0.9          // weight of the Gaussian around the obstacles
+#define Z_RAND 0.1         // weight of the unexpected readings
+// obstacles of the field: the log-odds cone leaves gaps on walls seen at grazing angles, that
+// HIMM fills
+#define OCCUPIED_LOGODDS 1.0 // p ~ 0.73
+#define OCCUPIED_HIMM 12
+
+/////////////////////
+///// SAVED MAP /////
+/////////////////////
+
+SavedMap::SavedMap()
+{
+    width = height = 0;
+    scale = 10;
+    left = top = 0;
+}
+
+bool SavedMap::load(std::string filename)
+{
+    std::ifstream raw(filename.c_str(), std::ios::binary);
+    if(!raw.is_open())
+        return false;
+
+    // text header, as written by the map builder, then the float32 layers
+    std::string line, key;
+    getline(raw, line);
+    if(line.compare(0, 9, "PHIRMAP 1") != 0)
+        return false;
+
+    width = height = 0;
+    while(getline(raw, line)){
+        std::stringstream ss(line);
+        ss >> key;
+        if(key == "size")
+            ss >> width >> height;
+        else if(key == "scale")
+            ss >> scale;
+        else if(key == "topleft")
+            ss >> left >> top;
+        else if(key == "layers")
+            break;
+    }
+    if(width <= 0 || height <= 0)
+        return false;
+
+    logodds.resize(width*height);
+    occupancySonar.resize(width*height);
+    himm.resize(width*height);
+    raw.read((char*) &logodds[0], logodds.size()*sizeof(float));
+    raw.read((char*) &occupancySonar[0], occupancySonar.size()*sizeof(float));
+    raw.read((char*) &himm[0], himm.size()*sizeof(float));
+    return !raw.fail();
+}
+
+////////////////////////////
+///// LIKELIHOOD FIELD /////
+////////////////////////////
+
+LikelihoodField::LikelihoodField()
+{
+    width_ = height_ = 0;
+    scale_ = 10;
+    minX_ = minY_ = 0;
+    sigmaHit_ = 0.0;
+}
+
+// Squared distance to the nearest zero of f (0 or INF), along one row or column
+// (Felzenszwalb and Huttenlocher, lower envelope of parabolas)
+static void distanceTransform1D(const float* f, int n, float* d, std::vector<int>& v, std::vector<float>& z)
+{
+    v.resize(n);
+    z.resize(n+1);
+    int k = 0;
+    v[0] = 0;
+    z[0] = -HUGE_VALF;
+    z[1] = HUGE_VALF;
+    for(int q=1; q<n; q++){
+        float s = ((f[q] + q*q) - (f[v[k]] + v[k]*v[k])) / (2*q - 2*v[k]);
+        while(s <= z[k]){
+            k--;
+            s = ((f[q] + q*q) - (f[v[k]] + v[k]*v[k])) / (2*q - 2*v[k]);
+        }
+        k++;
+        v[k] = q;
+        z[k] = s;
+        z[k+1] = HUGE_VALF;
+    }
+    k = 0;
+    for(int q=0; q<n; q++){
+        while(z[k+1] < q)
+            k++;
+        d[q] = (q-v[k])*(q-v[k]) + f[v[k]];
+    }
+}
+
+void LikelihoodField::build(const SavedMap& map, float sigmaHit)
+{
+    width_ = map.width + 2;
+    height_ = map.height + 2;
+    scale_ = map.scale;
+    minX_ = map.left;
+    minY_ = map.top - map.height + 1;
+    sigmaHit_ = sigmaHit;
+
+    // squared distances, in cells, to the nearest obstacle: columns first, then rows
+    const float INF = 1e20;
+    std::vector<float> dist(width_*height_, INF);
+    freeCells_.clear();
+    for(int r=0; r<map.height; r++)
+        for(int i=0; i<map.width; i++){
+            float l = map.logodds[r*map.width + i];
+            int p = (map.height - r)*width_ + i+1;
+            if(l > OCCUPIED_LOGODDS || map.himm[r*map.width + i] >= OCCUPIED_HIMM)
+                dist[p] = 0.0;
+            else if(l < 0.0)
+                freeCells_.push_back(p);
+        }
+
+    std::vector<int> v;
+    std::vector<float> z, f(std::max(width_, height_)), d(std::max(width_, height_));
+    for(int i=0; i<width_; i++){
+        for(int j=0; j<height_; j++)
+            f[j] = dist[j*width_ + i];
+        distanceTransform1D(&f[0], height_, &d[0], v, z);
+        for(int j=0; j<height_; j++)
+            dist[j*width_ + i] = d[j];
+    }
+    for(int j=0; j<height_; j++){
+        distanceTransform1D(&dist[j*width_], width_, &d[0], v, z);
+        std::copy(d.begin(), d.begin()+width_, dist.begin() + j*width_);
+    }
+
+    float k = 1.0/(2.0*sigmaHit*sigmaHit*scale_*scale_);
+    logLikelihood_.resize(width_*height_);
+    for(int p=0; p<width_*height_; p++)
+        logLikelihood_[p] = log(Z_HIT*exp(-dist[p]*k) + Z_RAND);
+
+    float miss = log(Z_RAND);
+    for(int i=0; i<width_; i++)
+        logLikelihood_[i] = logLikelihood_[(height_-1)*width_ + i] = miss;
+    for(int j=0; j<height_; j++)
+        logLikelihood_[j*width_] = logLikelihood_[j*width_ + width_-1] = miss;
+}
+
+void LikelihoodField::getFreeCell(int k, float& x, float& y) const
+{
+    int p = freeCells_[k];
+    x = (float)(minX_ + p%width_ - 1)/scale_;
+    y = (float)(minY_ + p/width_ - 1)/scale_;
+}
+
+float LikelihoodField::getScanLogLikelihood(const float* hitsX, const float* hitsY, int numHits, float x, float y, float theta) const
+{
+    // hits are placed like the mapping methods do, from the robot's cell: column of a hit =
+    // (int)(x*scale) + round(hit x*scale) - minX_ + 1, the truncation of a positive offset
+    float c = cos(theta)*scale_, s = sin(theta)*scale_;
+    float offsetX = (int)(x*scale_) + 1.5 - minX_;
+    float offsetY = (int)(y*scale_) + 1.5 - minY_;
+    float maxI = width_-1, maxJ = height_-1;
+    const float* l = &logLikelihood_[0];
+
+    float sum = 0.0;
+    int k = 0;
+#ifdef __SSE2__
+    // the cell indices of four hits at a time; the (float) index is exact below 2^24 cells
+    __m128 vc = _mm_set1_ps(c), vs = _mm_set1_ps(s);
+    __m128 vOffsetX = _mm_set1_ps(offsetX), vOffsetY = _mm_set1_ps(offsetY);
+    __m128 vMaxI = _mm_set1_ps(maxI), vMaxJ = _mm_set1_ps(maxJ), vWidth = _mm_set1_ps(width_);
+    __m128 zero = _mm_setzero_ps();
+    int idx[4] __attribute__((aligned(16)));
+    for(; k+4<=numHits; k+=4){
+        __m128 hx = _mm_loadu_ps(hitsX+k), hy = _mm_loadu_ps(hitsY+k);
+        __m128 fi = _mm_add_ps(vOffsetX, _mm_sub_ps(_mm_mul_ps(vc, hx), _mm_mul_ps(vs, hy)));
+        __m128 fj = _mm_add_ps(vOffsetY, _mm_add_ps(_mm_mul_ps(vs, hx), _mm_mul_ps(vc, hy)));
+        fi = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(fi, zero), vMaxI)));
+        fj = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(fj, zero), vMaxJ)));
+        _mm_store_si128((__m128i*) idx, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(fj, vWidth), fi)));
+        sum += (l[idx[0]] + l[idx[1]]) + (l[idx[2]] + l[idx[3]]);
+    }
+#endif
+    for(; k<numHits; k++){
+        float fi = offsetX + c*hitsX[k] - s*hitsY[k];
+        float fj = offsetY + s*hitsX[k] + c*hitsY[k];
+        int i = std::min(std::max(fi, 0.0f), maxI);
+        int j = std::min(std::max(fj, 0.0f), maxJ);
+        sum += l[j*width_ + i];
+    }
+    return sum;
+}
+
+///////////////////////////
+///// PARTICLE FILTER /////
+///////////////////////////
+
+ParticleFilter::ParticleFilter()
+{
+    minParticles = 100;
+    maxParticles = 5000;
+    kldError = 0.05;
+    sigmaHit = 0.2;
+    beamStep = 2;
+    translationNoise = 0.1;
+    rotationNoise = 0.1;
+    resampleThreshold = 0.5;
+    numThreads = getNumberOfCores();
+
+    rng_.seed(0);
+}
+
+bool ParticleFilter::loadMap(std::string filename)
+{
+    if(!map_.load(filename))
+        return false;
+    field_.build(map_, sigmaHit);
+    x_.clear(); y_.clear(); theta_.clear(); weight_.clear();
+    return true;
+}
+
+float ParticleFilter::gaussian(float stdDev)
+{
+    if(stdDev <= 0.0)
+        return 0.0;
+    std::normal_distribution<float> dist(0.0, stdDev);
+    return dist(rng_);
+}
+
+void ParticleFilter::initialize(const Pose& p, float linearSpread, float angularSpread)
+{
+    int n = std::max(minParticles, maxParticles/2);
+    x_.resize(n); y_.resize(n); theta_.resize(n);
+    weight_.assign(n, 1.0/n);
+    for(int i=0; i<n; i++){
+        x_[i] = p.x + gaussian(linearSpread);
+        y_[i] = p.y + gaussian(linearSpread);
+        theta_[i] = normalizeAngleRAD(DEG2RAD((p.theta + gaussian(angularSpread))));
+    }
+}
+
+void ParticleFilter::initializeGlobal()
+{
+    int numFree = field_.getNumFreeCells();
+    if(numFree == 0)
+        return;
+
+    int n = maxParticles;
+    x_.resize(n); y_.resize(n); theta_.resize(n);
+    weight_.assign(n, 1.0/n);
+    std::uniform_int_distribution<int> cell(0, numFree-1);
+    std::uniform_real_distribution<float> offset(-0.5, 0.5), angle(-M_PI, M_PI);
+    for(int i=0; i<n; i++){
+        field_.getFreeCell(cell(rng_), x_[i], y_[i]);
+        x_[i] += offset(rng_)/map_.scale;
+        y_[i] += offset(rng_)/map_.scale;
+        theta_[i] = angle(rng_);
+    }
+}
+
+// Odometry motion model (Thrun et al., Probabilistic Robotics): a rotation towards the
+// displacement, the displacement and a final rotation, each with a noise that grows with the
+// rotations and the displacement
+void ParticleFilter::predict(const Pose& previousOdometry, const Pose& odometry)
+{
+    float dx = odometry.x - previousOdometry.x;
+    float dy = odometry.y - previousOdometry.y;
+    float trans = sqrt(dx*dx + dy*dy);
+    float rot = normalizeAngleRAD(DEG2RAD((odometry.theta - previousOdometry.theta)));
+    if(trans < 1e-4 && fabs(rot) < 1e-4)
+        return;
+
+    // turning in place, the direction of a tiny displacement is meaningless
+    float rot1 = 0.0;
+    if(trans > 0.01){
+        rot1 = normalizeAngleRAD(atan2(dy, dx) - DEG2RAD(previousOdometry.theta));
+        // driving backwards
+        if(fabs(rot1) > M_PI/2){
+            rot1 = normalizeAngleRAD(rot1 + M_PI);
+            trans = -trans;
+        }
+    }
+    float rot2 = normalizeAngleRAD(rot - rot1);
+
+    // the odometry also turns while driving and slips while turning (rad per m, m per rad)
+    float sigmaRot1 = rotationNoise*fabs(rot1) + translationNoise*fabs(trans);
+    float sigmaTrans = translationNoise*fabs(trans) + rotationNoise*(fabs(rot1) + fabs(rot2));
+    float sigmaRot2 = rotationNoise*fabs(rot2) + translationNoise*fabs(trans);
+    for(unsigned int i=0; i<x_.size(); i++){
+        float r1 = rot1 + gaussian(sigmaRot1);
+        float t = trans + gaussian(sigmaTrans);
+        float r2 = rot2 + gaussian(sigmaRot2);
+        x_[i] += t*cos(theta_[i] + r1);
+        y_[i] += t*sin(theta_[i] + r1);
+        theta_[i] = normalizeAngleRAD(theta_[i] + r1 + r2);
+    }
+}
+
+void ParticleFilter::correct(const LaserPointCloud& points)
+{
+    if(x_.empty())
+        return;
+
+    // field of the current sigma, the same hits for every particle
+    if(sigmaHit != field_.getSigmaHit())
+        field_.build(map_, sigmaHit);
+
+    hitsX_.clear();
+    hitsY_.clear();
+    int step = std::max(1, beamStep);
+    for(int k=0; k<points.size(); k+=step)
+        if(points.hit[k]){
+            hitsX_.push_back(points.x[k]);
+            hitsY_.push_back(points.y[k]);
+        }
+    if(hitsX_.empty())
+        return;
+
+    // blocks of particles in parallel, each thread gets a few of them
+    int n = x_.size();
+    std::vector<float> logLikelihood(n);
+    int blockSize = 64;
+    int numBlocks = (n + blockSize-1)/blockSize;
+    parallelFor(numBlocks, std::min(numThreads, numBlocks), [&](int b){
+        int last = std::min(n, (b+1)*blockSize);
+        for(int i=b*blockSize; i<last; i++)
+            logLikelihood[i] = field_.getScanLogLikelihood(&hitsX_[0], &hitsY_[0], hitsX_.size(), x_[i], y_[i], theta_[i]);
+    });
+
+    float maxLogLikelihood = *std::max_element(logLikelihood.begin(), logLikelihood.end());
+    double total = 0.0;
+    for(int i=0; i<n; i++){
+        weight_[i] *= exp(logLikelihood[i] - maxLogLikelihood);
+        total += weight_[i];
+    }
+    for(int i=0; i<n; i++)
+        weight_[i] = (total > 0.0) ? weight_[i]/total : 1.0/n;
+
+    if(getEffectiveSampleSize() < resampleThreshold*n)
+        resample();
+}
+
+float ParticleFilter::getEffectiveSampleSize() const
+{
+    double sum = 0.0;
+    for(unsigned int i=0; i<weight_.size(); i++)
+        sum += weight_[i]*weight_[i];
+    return (sum > 0.0) ? 1.0/sum : 0.0;
+}
+
+// Fox, "Adapting the sample size in particle filters through KLD-sampling"
+int ParticleFilter::getKLDBound(int numBins) const
+{
+    if(numBins <= 1)
+        return minParticles;
+
+    const float z = 2.326; // upper 0.99 quantile of the standard normal
+    float a = 2.0/(9.0*(numBins-1));
+    float b = 1.0 - a + sqrt(a)*z;
+    int n = ceil((numBins-1)/(2.0*kldError)*b*b*b);
+    return std::max(minParticles, std::min(maxParticles, n));
+}
+
+void ParticleFilter::resample()
+{
+    int n = x_.size();
+
+    // bins occupied by the particles that carry any weight
+    std::vector<long long> bins;
+    bins.reserve(n);
+    float minWeight = 0.01/n;
+    for(int i=0; i<n; i++){
+        if(weight_[i] < minWeight)
+            continue;
+        long long bx = floor(x_[i]/0.5), by = floor(y_[i]/0.5);
+        long long bt = floor(RAD2DEG(theta_[i])/10.0);
+        bins.push_back(((bx & 0xFFFFF) << 40) | ((by & 0xFFFFF) << 20) | (bt & 0xFFFFF));
+    }
+    std::sort(bins.begin(), bins.end());
+    int numBins = std::unique(bins.begin(), bins.end()) - bins.begin();
+    int m = getKLDBound(numBins);
+
+    // low-variance sampler: one random offset, m equally spaced pointers over the weights
+    std::vector<float> x(m), y(m), theta(m);
+    std::uniform_real_distribution<float> offset(0.0, 1.0/m);
+    double u = offset(rng_);
+    double c = weight_[0];
+    int i = 0;
+    for(int k=0; k<m; k++){
+        while(u > c && i < n-1){
+            i++;
+            c += weight_[i];
+        }
+        x[k] = x_[i];
+        y[k] = y_[i];
+        theta[k] = theta_[i];
+        u += 1.0/m;
+    }
+
+    x_.swap(x);
+    y_.swap(y);
+    theta_.swap(theta);
+    weight_.assign(m, 1.0/m);
+}
+
+// Weighted mean, with the circular mean of the headings
+Pose ParticleFilter::getEstimate() const
+{
+    Pose p;
+    double x = 0.0, y = 0.0, c = 0.0, s = 0.0;
+    for(unsigned int i=0; i<x_.size(); i++){
+        x += weight_[i]*x_[i];
+        y += weight_[i]*y_[i];
+        c += weight_[i]*cos(theta_[i]);
+        s += weight_[i]*sin(theta_[i]);
+    }
+    p.x = x;
+    p.y = y;
+    p.theta = RAD2DEG(atan2(s, c));
+    return p;
+}
@@ -0,0 +1,102 @@
+#ifndef LOCALIZATION_H
+#define LOCALIZATION_H
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Utils.h"
+
+// Layers of a map saved by the map builder (<name>.raw), row by row from the top-left cell
+class SavedMap
+{
+    public:
+        SavedMap();
+
+        bool load(std::string filename);
+
+        int width, height, scale;
+        int left, top; // grid coordinates of the top-left cell
+        std::vector<float> logodds, occupancySonar, himm;
+};
+
+// Log-likelihood of a laser hit at each cell of a saved map: a Gaussian of the distance to
+// the nearest occupied cell (exact Euclidean distance transform) mixed with a uniform term
+// for unexpected readings. The field has a one-cell border holding the uniform term alone,
+// hits outside the map are clamped onto it.
+class LikelihoodField
+{
+    public:
+        LikelihoodField();
+
+        void build(const SavedMap& map, float sigmaHit);
+
+        // Sum over the hits (robot frame, m) seen from (x, y, theta in rad); four hits at a time with SSE2
+        float getScanLogLikelihood(const float* hitsX, const float* hitsY, int numHits, float x, float y, float theta) const;
+
+        // Known free cells, to spread the particles over for a global initialization
+        int getNumFreeCells() const { return freeCells_.size(); }
+        void getFreeCell(int k, float& x, float& y) const;
+
+        float getSigmaHit() const { return sigmaHit_; }
+
+    private:
+        int width_, height_, scale_;
+        int minX_, minY_; // grid coordinates of the first map cell, inside the border
+        float sigmaHit_;
+        std::vector<float> logLikelihood_; // row by row from the bottom border
+        std::vector<int> freeCells_;
+};
+
+// Monte Carlo localization against a saved map. Particles are moved with the odometry motion
+// model, weighted by the likelihood field (in parallel over the particles) and resampled with
+// the low-variance sampler when the effective sample size drops. The number of particles is
+// adapted on every resampling (KLD-sampling): enough particles that, with probability 0.99,
+// the KL divergence between the sampled and the true posterior stays below kldError, for the
+// number of histogram bins (0.5 m x 0.5 m x 10 deg) the weighted particles occupy.
+class ParticleFilter
+{
+    public:
+        ParticleFilter();
+
+        bool loadMap(std::string filename);
+        const SavedMap& getMap() const { return map_; }
+
+        // Particles around a pose (spreads are standard deviations, m and deg) or all over the free cells
+        void initialize(const Pose& p, float linearSpread, float angularSpread);
+        void initializeGlobal();
+        bool isInitialized() const { return !x_.empty(); }
+
+        void predict(const Pose& previousOdometry, const Pose& odometry);
+        void correct(const LaserPointCloud& points);
+
+        Pose getEstimate() const;
+        int getNumParticles() const { return x_.size(); }
+        float getEffectiveSampleSize() const;
+
+        // Filter parameters
+        int minParticles, maxParticles;
+        float kldError;
+        float sigmaHit;          // m, of the likelihood field
+        int beamStep;            // every beamStep-th hit is scored
+        float translationNoise;  // std. deviation, as a fraction of the displacement
+        float rotationNoise;     // std. deviation, as a fraction of the rotation
+        float resampleThreshold; // effective sample size, as a fraction of the particles, to resample
+        int numThreads;
+
+    private:
+        void resample();
+        int getKLDBound(int numBins) const;
+
+        SavedMap map_;
+        LikelihoodField field_;
+
+        // particles, theta in rad; weights sum to 1
+        std::vector<float> x_, y_, theta_, weight_;
+        std::vector<float> hitsX_, hitsY_;
+
+        std::mt19937 rng_;
+        float gaussian(float stdDev);
+};
+
+#endif // LOCALIZATION_H
@@ -0,0 +1,277 @@
+#include <pthread.h>
+#include <iostream>
+#include <fstream>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#ifdef USE_FREEIMAGE
+#include <FreeImage.h>
+#endif
+
+#include "Robot.h"
+
+// Offline map builder: replays recorded sensor logs (the files written in RECORDING mode)
+// through the Robot mapping methods (HIMM, log-odds and sonar), without ARIA or GLUT.
+//
+// Logs are independent and are mapped in parallel. A long log can also be split in
+// segments that are mapped in parallel and then merged: log-odds (laser and sonar) add up,
+// and HIMM adds the net change of each segment. Each log produces
+//   <name>-logodds.pgm, <name>-himm.pgm, <name>-sonar.pgm  (plus .png with USE_FREEIMAGE)
+//   <name>.raw  (text header + float32 layers: logodds, occupancySonar, himm)
+
+class LogRecord
+{
+    public:
+        Pose odometry;
+        std::vector<float> sonars, lasers;
+};
+
+class MapJob
+{
+    public:
+        int log;
+        int firstRecord, lastRecord;
+        Robot* robot;
+};
+
+static bool readLog(std::string filename, std::vector<LogRecord>& records, LaserDescription& laser)
+{
+    std::ifstream test(filename.c_str());
+    if(!test.is_open())
+        return false;
+    test.close();
+
+    // older logs do not describe the laser, they were recorded with the configured one
+    LogFile log(PLAYBACK, filename);
+    laser = log.hasLaserDescription() ? log.getLaserDescription() : LaserDescription::getConfigured();
+
+    while(!log.hasEnded()){
+        LogRecord rec;
+        rec.odometry = log.readPose("Odometry");
+        rec.sonars = log.readSensors("Sonar");
+        rec.lasers = log.readSensors("Laser");
+
+        // PioneerBase maps 8 sonars and every laser beam, a shorter record is a truncated log
+        if(rec.sonars.size() < 8 || (int)rec.lasers.size() < laser.getNumBeams())
+            break;
+        records.push_back(rec);
+    }
+    return !records.empty();
+}
+
+static int getGridWidth(const std::vector<LogRecord>& records, const LaserDescription& laser, int scale)
+{
+    // the grid has to hold every pose plus the sensors' range (at least the sonars' 5 m), with some margin
+    double maxCoord = 0.0;
+    for(unsigned int i=0; i<records.size(); i++)
+        maxCoord = std::max(maxCoord, std::max(fabs(records[i].odometry.x), fabs(records[i].odometry.y)));
+
+    int margin = (int)(std::max(laser.getMaxRange(), 5.0f) + 5.0)*scale;
+    int width = 2*((int)(maxCoord*scale) + margin);
+    return (width + LOD_TILE_SIZE-1)/LOD_TILE_SIZE*LOD_TILE_SIZE;
+}
+
+static void mergeGrids(Grid* dest, Grid* src)
+{
+    int half = dest->getMapWidth()/2;
+    int width = dest->getMapWidth();
+
+    parallelFor(width, getNumberOfCores(), [&](int j){
+        int y = half - j;
+        for(int x=-half+1; x<=half; x++){
+            Cell* d = dest->getCell(x,y);
+            Cell* s = src->getCell(x,y);
+
+            d->logodds += s->logodds;
+            d->occupancy = 1.0 - 1.0/(1.0+exp(d->logodds));
+
+            double l = log(d->occupancySonar/(1.0-d->occupancySonar)) + log(s->occupancySonar/(1.0-s->occupancySonar));
+            d->occupancySonar = std::max(0.01, std::min(0.99, 1.0 - 1.0/(1.0+exp(l))));
+
+            d->himm = std::max(0, std::min(15, d->himm + s->himm - 7));
+        }
+    });
+}
+
+// Bounding box of the cells touched by any sensor, in grid coordinates
+static bool getMappedArea(Grid* g, int& minX, int& minY, int& maxX, int& maxY)
+{
+    int half = g->getMapWidth()/2;
+    minX = minY = half;
+    maxX = maxY = -half;
+    for(int y=-half+1; y<=half; y++)
+        for(int x=-half+1; x<=half; x++){
+            Cell* c = g->getCell(x,y);
+            if(c->logodds != 0.0 || c->occupancySonar != 0.5 || c->himm != 7){
+                minX = std::min(minX, x); maxX = std::max(maxX, x);
+                minY = std::min(minY, y); maxY = std::max(maxY, y);
+            }
+        }
+    return minX <= maxX;
+}
+
+static void writeImage(std::string filename, const std::vector<unsigned char>& pixels, int width, int height)
+{
+    std::ofstream pgm((filename + ".pgm").c_str(), std::ios::binary);
+    pgm << "P5\n" << width << ' ' << height << "\n255\n";
+    pgm.write((const char*) &pixels[0], pixels.size());
+
+#ifdef USE_FREEIMAGE
+    FIBITMAP* image = FreeImage_Allocate(width, height, 8);
+    RGBQUAD* palette = FreeImage_GetPalette(image);
+    for(int i=0; i<256; i++)
+        palette[i].rgbRed = palette[i].rgbGreen = palette[i].rgbBlue = i;
+    // FreeImage stores the bottom row first
+    for(int j=0; j<height; j++)
+        memcpy(FreeImage_GetScanLine(image, height-1-j), &pixels[j*width], width);
+    FreeImage_Save(FIF_PNG, image, (filename + ".png").c_str(), 0);
+    FreeImage_Unload(image);
+#endif
+}
+
+static void writeMap(std::string prefix, Grid* g)
+{
+    int minX, minY, maxX, maxY;
+    if(!getMappedArea(g, minX, minY, maxX, maxY)){
+        std::cerr << "Warning: nothing was mapped for " << prefix << std::endl;
+        return;
+    }
+
+    // images and layers start at the top-left cell (minX,maxY), row by row
+    int width = maxX-minX+1;
+    int height = maxY-minY+1;
+    std::vector<float> logodds(width*height), sonar(width*height), himm(width*height);
+    std::vector<unsigned char> pLogodds(width*height), pSonar(width*height), pHimm(width*height);
+    for(int j=0; j<height; j++)
+        for(int i=0; i<width; i++){
+            Cell* c = g->getCell(minX+i, maxY-j);
+            int p = j*width + i;
+            logodds[p] = c->logodds;
+            sonar[p] = c->occupancySonar;
+            himm[p] = c->himm;
+
+            // free cells are white, occupied cells are black
+            pLogodds[p] = 255*(1.0-c->occupancy);
+            pSonar[p] = 255*(1.0-c->occupancySonar);
+            pHimm[p] = 255*(15-c->himm)/15;
+        }
+
+    writeImage(prefix + "-logodds", pLogodds, width, height);
+    writeImage(prefix + "-sonar", pSonar, width, height);
+    writeImage(prefix + "-himm", pHimm, width, height);
+
+    std::ofstream raw((prefix + ".raw").c_str(), std::ios::binary);
+    raw << "PHIRMAP 1\n"
+        << "size " << width << ' ' << height << "\n"
+        << "scale " << g->getMapScale() << "\n"
+        << "topleft " << minX << ' ' << maxY << "\n"
+        << "layers logodds occupancySonar himm\n";
+    raw.write((const char*) &logodds[0], logodds.size()*sizeof(float));
+    raw.write((const char*) &sonar[0], sonar.size()*sizeof(float));
+    raw.write((const char*) &himm[0], himm.size()*sizeof(float));
+}
+
+static std::string getBaseName(std::string filename)
+{
+    size_t slash = filename.find_last_of('/');
+    if(slash != std::string::npos)
+        filename = filename.substr(slash+1);
+    size_t dot = filename.find_last_of('.');
+    if(dot != std::string::npos && dot > 0)
+        filename = filename.substr(0, dot);
+    return filename;
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 2){
+        std::cout << "Usage: " << argv[0] << " <log> [<log> ...] [-j threads] [-s segments per log] [-o output dir]" << std::endl;
+        return 1;
+    }
+
+    int numThreads = getNumberOfCores();
+    int numSegments = 1;
+    std::string outDir = ".";
+    std::vector<std::string> logNames;
+    for(int i=1; i<argc; i++){
+        if(!strncmp(argv[i], "-j", 2) && i+1<argc)
+            numThreads = atoi(argv[++i]);
+        else if(!strncmp(argv[i], "-s", 2) && i+1<argc)
+            numSegments = std::max(1, atoi(argv[++i]));
+        else if(!strncmp(argv[i], "-o", 2) && i+1<argc)
+            outDir = argv[++i];
+        else
+            logNames.push_back(argv[i]);
+    }
+
+    std::vector< std::vector<LogRecord> > logs(logNames.size());
+    std::vector<LaserDescription> lasers(logNames.size());
+    std::vector<int> gridWidths(logNames.size());
+    parallelFor(logNames.size(), numThreads, [&](int l){
+        if(readLog(logNames[l], logs[l], lasers[l]))
+            gridWidths[l] = getGridWidth(logs[l], lasers[l], 10);
+        else
+            std::cerr << "Error: could not read " << logNames[l] << std::endl;
+    });
+
+    // one job per segment of each log
+    std::vector<MapJob> jobs;
+    for(unsigned int l=0; l<logs.size(); l++){
+        int n = logs[l].size();
+        int segments = std::min(numSegments, n);
+        for(int s=0; s<segments; s++){
+            MapJob job;
+            job.log = l;
+            job.firstRecord = (long)n*s/segments;
+            job.lastRecord = (long)n*(s+1)/segments;
+            job.robot = NULL;
+            jobs.push_back(job);
+        }
+    }
+
+    std::cout << "Mapping " << logNames.size() << " logs (" << jobs.size() << " segments) on "
+              << numThreads << " threads" << std::endl;
+
+    Timer timer;
+    parallelFor(jobs.size(), numThreads, [&](int k){
+        MapJob& job = jobs[k];
+        Robot* r = new Robot(gridWidths[job.log]);
+        r->setLaserDescription(lasers[job.log]);
+        r->grid->mutex = new pthread_mutex_t;
+        pthread_mutex_init(r->grid->mutex, NULL);
+
+        const std::vector<LogRecord>& records = logs[job.log];
+        for(int i=job.firstRecord; i<job.lastRecord; i++)
+            r->mapReadings(records[i].odometry, records[i].sonars, records[i].lasers);
+
+        job.robot = r;
+    });
+    float mappingTime = timer.getLapTime();
+
+    // merge the segments of each log into the first one, in order, then write the maps
+    for(unsigned int k=0; k<jobs.size(); k++){
+        if(k > 0 && jobs[k].log == jobs[k-1].log)
+            continue;
+
+        Robot* first = jobs[k].robot;
+        unsigned int s = k+1;
+        for(; s<jobs.size() && jobs[s].log == jobs[k].log; s++)
+            mergeGrids(first->grid, jobs[s].robot->grid);
+
+        std::string prefix = outDir + "/" + getBaseName(logNames[jobs[k].log]);
+        writeMap(prefix, first->grid);
+        std::cout << "Log " << logNames[jobs[k].log] << ": " << logs[jobs[k].log].size()
+                  << " records, " << s-k << " segments, maps in " << prefix << "-*" << std::endl;
+    }
+
+    for(unsigned int k=0; k<jobs.size(); k++){
+        pthread_mutex_destroy(jobs[k].robot->grid->mutex);
+        delete jobs[k].robot->grid->mutex;
+        delete jobs[k].robot->plan;
+        delete jobs[k].robot;
+    }
+
+    std::cout << "Mapping took " << mappingTime << " s, total " << timer.getTotalTime() << " s" << std::endl;
+
+    return 0;
+}
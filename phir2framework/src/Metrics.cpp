@@ -0,0 +1,282 @@
+#include "Metrics.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cmath>
+#include <errno.h>
+#include <algorithm>
+
+////////////////////////////////////////////
+///// METHODS OF CLASS METRICHISTOGRAM /////
+////////////////////////////////////////////
+
+MetricHistogram::MetricHistogram() : count_(0), sumNs_(0)
+{
+    for(int b=0; b<HISTOGRAM_BUCKETS; b++)
+        buckets_[b].store(0);
+}
+
+void MetricHistogram::record(double seconds)
+{
+    long long ns = seconds*1e9;
+    if(ns < 1)
+        ns = 1;
+
+    // octave = position of the highest bit, sub-bucket = the next two bits
+    int octave = 63 - __builtin_clzll(ns);
+    int sub = (octave >= 2) ? (ns >> (octave-2)) & 3 : 0;
+    int b = std::min(octave*HISTOGRAM_SUBBUCKETS + sub, HISTOGRAM_BUCKETS-1);
+
+    buckets_[b].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sumNs_.fetch_add(ns, std::memory_order_relaxed);
+}
+
+long long MetricHistogram::getCount()
+{
+    return count_.load(std::memory_order_relaxed);
+}
+
+double MetricHistogram::getSum()
+{
+    return sumNs_.load(std::memory_order_relaxed)/1e9;
+}
+
+long long MetricHistogram::getBucketCount(int b)
+{
+    return buckets_[b].load(std::memory_order_relaxed);
+}
+
+double MetricHistogram::getBucketUpperBound(int b)
+{
+    int octave = b/HISTOGRAM_SUBBUCKETS;
+    int sub = b%HISTOGRAM_SUBBUCKETS;
+    if(octave < 2)
+        return (1LL << (octave+1))/1e9;
+    return ((long long)(HISTOGRAM_SUBBUCKETS+sub+1) << (octave-2))/1e9;
+}
+
+double MetricHistogram::getQuantile(double q)
+{
+    long long total = getCount();
+    if(total == 0)
+        return 0.0;
+
+    long long target = std::ceil(q*total);
+    long long n = 0;
+    for(int b=0; b<HISTOGRAM_BUCKETS; b++){
+        n += getBucketCount(b);
+        if(n >= target)
+            return getBucketUpperBound(b);
+    }
+    return getBucketUpperBound(HISTOGRAM_BUCKETS-1);
+}
+
+////////////////////////////////////
+///// METHODS OF CLASS METRICS /////
+////////////////////////////////////
+
+enum MetricType {COUNTER, GAUGE, HISTOGRAM};
+
+class MetricEntry
+{
+    public:
+        std::string name, help, labels;
+        MetricType type;
+        MetricCounter* counter;
+        MetricGauge* gauge;
+        MetricHistogram* histogram;
+};
+
+bool Metrics::enabled_ = false;
+
+static std::vector<MetricEntry*> registry;
+static pthread_mutex_t registryMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static MetricEntry* getEntry(std::string name, std::string help, std::string labels, MetricType type)
+{
+    pthread_mutex_lock(&registryMutex);
+    for(unsigned int i=0; i<registry.size(); i++)
+        if(registry[i]->name == name && registry[i]->labels == labels){
+            pthread_mutex_unlock(&registryMutex);
+            return registry[i];
+        }
+
+    MetricEntry* e = new MetricEntry();
+    e->name = name;
+    e->help = help;
+    e->labels = labels;
+    e->type = type;
+    e->counter = (type == COUNTER) ? new MetricCounter() : NULL;
+    e->gauge = (type == GAUGE) ? new MetricGauge() : NULL;
+    e->histogram = (type == HISTOGRAM) ? new MetricHistogram() : NULL;
+    registry.push_back(e);
+
+    pthread_mutex_unlock(&registryMutex);
+    return e;
+}
+
+MetricCounter* Metrics::counter(std::string name, std::string help, std::string labels)
+{
+    return getEntry(name, help, labels, COUNTER)->counter;
+}
+
+MetricGauge* Metrics::gauge(std::string name, std::string help, std::string labels)
+{
+    return getEntry(name, help, labels, GAUGE)->gauge;
+}
+
+MetricHistogram* Metrics::histogram(std::string name, std::string help, std::string labels)
+{
+    return getEntry(name, help, labels, HISTOGRAM)->histogram;
+}
+
+static std::string joinLabels(std::string labels, std::string extra)
+{
+    if(labels.empty() && extra.empty())
+        return "";
+    if(labels.empty() || extra.empty())
+        return "{" + labels + extra + "}";
+    return "{" + labels + "," + extra + "}";
+}
+
+std::string Metrics::render()
+{
+    // resident memory of the whole process, from /proc
+    long pages = 0, residentPages = 0;
+    std::ifstream statm("/proc/self/statm");
+    if(statm >> pages >> residentPages)
+        gauge("phir2_process_resident_bytes", "Resident memory of the process")->set((double)residentPages*sysconf(_SC_PAGESIZE));
+
+    std::stringstream ss;
+    ss.precision(12);
+    std::vector<std::string> described;
+
+    pthread_mutex_lock(&registryMutex);
+    for(unsigned int i=0; i<registry.size(); i++){
+        MetricEntry* e = registry[i];
+
+        bool isDescribed = false;
+        for(unsigned int d=0; d<described.size(); d++)
+            isDescribed |= (described[d] == e->name);
+        if(!isDescribed){
+            const char* types[3] = {"counter", "gauge", "histogram"};
+            ss << "# HELP " << e->name << ' ' << e->help << "\n";
+            ss << "# TYPE " << e->name << ' ' << types[e->type] << "\n";
+            described.push_back(e->name);
+        }
+
+        if(e->type == COUNTER){
+            ss << e->name << joinLabels(e->labels, "") << ' ' << e->counter->get() << "\n";
+        }else if(e->type == GAUGE){
+            ss << e->name << joinLabels(e->labels, "") << ' ' << e->gauge->get() << "\n";
+        }else{
+            MetricHistogram* h = e->histogram;
+
+            // cumulative buckets, from the first to the last non-empty one
+            int first = HISTOGRAM_BUCKETS, last = -1;
+            for(int b=0; b<HISTOGRAM_BUCKETS; b++)
+                if(h->getBucketCount(b) > 0){
+                    first = std::min(first, b);
+                    last = b;
+                }
+            long long n = 0;
+            for(int b=0; b<=last; b++){
+                n += h->getBucketCount(b);
+                if(b < first || (b < 2*HISTOGRAM_SUBBUCKETS && b%HISTOGRAM_SUBBUCKETS != 0))
+                    continue;
+                std::stringstream le;
+                le << "le=\"" << MetricHistogram::getBucketUpperBound(b) << "\"";
+                ss << e->name << "_bucket" << joinLabels(e->labels, le.str()) << ' ' << n << "\n";
+            }
+            ss << e->name << "_bucket" << joinLabels(e->labels, "le=\"+Inf\"") << ' ' << h->getCount() << "\n";
+            ss << e->name << "_sum" << joinLabels(e->labels, "") << ' ' << h->getSum() << "\n";
+            ss << e->name << "_count" << joinLabels(e->labels, "") << ' ' << h->getCount() << "\n";
+        }
+    }
+    pthread_mutex_unlock(&registryMutex);
+
+    return ss.str();
+}
+
+static void* serverThread(void* ref)
+{
+    int server = *(int*) ref;
+    delete (int*) ref;
+
+    while(true){
+        int client = accept(server, NULL, NULL);
+        if(client < 0)
+            continue;
+
+        // any request gets the metrics, the request itself is not parsed
+        char request[1024];
+        if(recv(client, request, sizeof(request), 0) <= 0){
+            close(client);
+            continue;
+        }
+
+        std::string body = Metrics::render();
+        std::stringstream response;
+        response << "HTTP/1.0 200 OK\r\n"
+                 << "Content-Type: text/plain; version=0.0.4\r\n"
+                 << "Content-Length: " << body.size() << "\r\n"
+                 << "Connection: close\r\n\r\n" << body;
+        std::string r = response.str();
+        send(client, r.c_str(), r.size(), MSG_NOSIGNAL);
+        close(client);
+    }
+    return NULL;
+}
+
+bool Metrics::startServer(int port)
+{
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+    if(server < 0)
+        return false;
+
+    int yes = 1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    // local connections only
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if(bind(server, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(server, 4) < 0){
+        std::cerr << "Error: could not start the metrics server on port " << port << ": " << strerror(errno) << std::endl;
+        close(server);
+        return false;
+    }
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, serverThread, new int(server));
+    pthread_detach(thread);
+
+    enabled_ = true;
+    std::cout << "Serving metrics on http://localhost:" << port << "/metrics" << std::endl;
+    return true;
+}
+
+void Metrics::initialize()
+{
+    const char* port = getenv("PHIR2_METRICS_PORT");
+    if(port != NULL && atoi(port) > 0)
+        startServer(atoi(port));
+}
+
+bool Metrics::isEnabled()
+{
+    return enabled_;
+}
@@ -0,0 +1,77 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <string>
+
+// Runtime metrics served in the Prometheus text format over HTTP on localhost.
+// The server only starts when the PHIR2_METRICS_PORT environment variable is set,
+// e.g. PHIR2_METRICS_PORT=9100 and then "curl localhost:9100/metrics".
+//
+// Metrics are registered once (keep the returned pointer, e.g. in a static local)
+// and updated with relaxed atomics, so the robot/planning/glut threads never lock.
+
+class MetricCounter
+{
+    public:
+        MetricCounter() : value_(0) {}
+        void add(long long n=1) { value_.fetch_add(n, std::memory_order_relaxed); }
+        long long get() { return value_.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<long long> value_;
+};
+
+class MetricGauge
+{
+    public:
+        MetricGauge() : value_(0.0) {}
+        void set(double v) { value_.store(v, std::memory_order_relaxed); }
+        double get() { return value_.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<double> value_;
+};
+
+// Log-linear buckets as in HDR histograms: 4 sub-buckets per power of two of nanoseconds,
+// from 1 ns to about 18 minutes, so every recorded latency keeps 2 significant bits
+#define HISTOGRAM_OCTAVES 40
+#define HISTOGRAM_SUBBUCKETS 4
+#define HISTOGRAM_BUCKETS (HISTOGRAM_OCTAVES*HISTOGRAM_SUBBUCKETS)
+
+class MetricHistogram
+{
+    public:
+        MetricHistogram();
+        void record(double seconds);
+
+        long long getCount();
+        double getSum(); // seconds
+        long long getBucketCount(int b);
+        static double getBucketUpperBound(int b); // seconds
+        double getQuantile(double q); // seconds, upper bound of the bucket
+
+    private:
+        std::atomic<long long> buckets_[HISTOGRAM_BUCKETS];
+        std::atomic<long long> count_, sumNs_;
+};
+
+class Metrics
+{
+    public:
+        static void initialize(); // reads PHIR2_METRICS_PORT and starts the server
+        static bool isEnabled();
+        static bool startServer(int port);
+
+        // the same name and labels always return the same metric
+        static MetricCounter* counter(std::string name, std::string help, std::string labels="");
+        static MetricGauge* gauge(std::string name, std::string help, std::string labels="");
+        static MetricHistogram* histogram(std::string name, std::string help, std::string labels="");
+
+        static std::string render();
+
+    private:
+        static bool enabled_;
+};
+
+#endif // METRICS_H
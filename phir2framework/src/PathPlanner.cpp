@@ -0,0 +1,1047 @@
+#include "PathPlanner.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <functional>
+
+// step lengths in tenths of a cell, so that the costs stay integers
+static const unsigned int STRAIGHT_STEP = 10;
+static const unsigned int DIAGONAL_STEP = 14;
+static const unsigned int INFINITE_COST = 0xffffffff;
+
+// cells of the cost layer around the limits, plus a quarter of their size, so that it keeps its
+// layout while they grow
+static const int LAYER_MARGIN = 32;
+
+// cells per side of the tiles of HIERARCHICAL, and longest opening of a side with a single node
+static const int PATH_TILE_SIZE = 16;
+static const int MAX_SINGLE_OPENING = 5;
+
+static const int DIRECTIONS[8][2] = {{1,0}, {-1,0}, {0,1}, {0,-1}, {1,1}, {1,-1}, {-1,1}, {-1,-1}};
+static const int OPPOSITE[8] = {1, 0, 3, 2, 7, 6, 5, 4};
+
+//////////////////////
+///// RADIX HEAP /////
+//////////////////////
+
+RadixHeap::RadixHeap()
+{
+    last_ = 0;
+    size_ = 0;
+}
+
+void RadixHeap::clear()
+{
+    for(int i=0; i<33; i++)
+        buckets_[i].clear();
+    last_ = 0;
+    size_ = 0;
+}
+
+bool RadixHeap::empty()
+{
+    return size_ == 0;
+}
+
+static int getBucket(unsigned int key, unsigned int last)
+{
+    return key == last ? 0 : 32 - __builtin_clz(key ^ last);
+}
+
+void RadixHeap::push(unsigned int key, int value)
+{
+    buckets_[getBucket(key, last_)].push_back(std::make_pair(key, value));
+    size_++;
+}
+
+int RadixHeap::pop()
+{
+    if(buckets_[0].empty()){
+        int i = 1;
+        while(buckets_[i].empty())
+            i++;
+
+        // the smallest key of the first non-empty bucket becomes the reference, and the rest of
+        // the bucket now differs from it in lower bits only
+        std::vector< std::pair<unsigned int,int> >& b = buckets_[i];
+        last_ = b[0].first;
+        for(unsigned int k=1; k<b.size(); k++)
+            last_ = std::min(last_, b[k].first);
+        for(unsigned int k=0; k<b.size(); k++)
+            buckets_[getBucket(b[k].first, last_)].push_back(b[k]);
+        b.clear();
+    }
+
+    int value = buckets_[0].back().second;
+    buckets_[0].pop_back();
+    size_--;
+    return value;
+}
+
+////////////////////////
+///// PATH PLANNER /////
+////////////////////////
+
+PathPlanner::PathPlanner()
+{
+    algorithm = ASTAR;
+    nearWallsCost = 2;
+    dangerCost = 20;
+    unexploredCost = -1;
+    timeBudget = 0.05;
+
+    originX_ = originY_ = 0;
+    width_ = height_ = 0;
+    layerCosts_[0] = layerCosts_[1] = layerCosts_[2] = 0;
+    generation_ = 0;
+    dStarGeneration_ = 0;
+    dStarStart_ = dStarGoal_ = -1;
+    keyOffset_ = 0;
+    tilesX_ = tilesY_ = 0;
+    tilesValid_ = false;
+    goal_ = goalX_ = goalY_ = -1;
+    expansions_ = 0;
+    time_ = 0.0;
+}
+
+void PathPlanner::updateCosts(Grid* grid, const bbox& limits)
+{
+    updateCosts(grid, limits, limits);
+}
+
+void PathPlanner::updateCosts(Grid* grid, const bbox& limits, const bbox& changed)
+{
+    bool sameCosts = (layerCosts_[0] == nearWallsCost && layerCosts_[1] == dangerCost && layerCosts_[2] == unexploredCost);
+    bool inside = (limits.minX > originX_ && limits.maxX < originX_ + width_ - 1 &&
+                   limits.minY > originY_ && limits.maxY < originY_ + height_ - 1);
+    if(sameCosts && inside){
+        setCosts(grid, std::max(changed.minX, originX_+1), std::min(changed.maxX, originX_+width_-2),
+                       std::max(changed.minY, originY_+1), std::min(changed.maxY, originY_+height_-2),
+                 dStarGeneration_ == generation_);
+        return;
+    }
+
+    // the cells inside the border stay in the grid, from 1-half to half in both axes
+    int half = grid->getMapWidth()/2;
+    int marginX = LAYER_MARGIN + std::max(0, limits.maxX - limits.minX)/4;
+    int marginY = LAYER_MARGIN + std::max(0, limits.maxY - limits.minY)/4;
+    int minX = std::max(1-half, limits.minX - marginX), maxX = std::min(half, limits.maxX + marginX);
+    int minY = std::max(1-half, limits.minY - marginY), maxY = std::min(half, limits.maxY + marginY);
+    originX_ = minX - 1;
+    originY_ = minY - 1;
+    width_ = std::max(0, maxX - minX + 3);
+    height_ = std::max(0, maxY - minY + 3);
+    int n = width_*height_;
+    cost_.assign(n, 0);
+    uniform_.assign(n, 0);
+    for(int d=0; d<4; d++)
+        straightJumps_[d].assign(n, 0);
+    layerCosts_[0] = nearWallsCost;
+    layerCosts_[1] = dangerCost;
+    layerCosts_[2] = unexploredCost;
+
+    // the search memory only grows: the stamps of the old layout are all from past queries, and
+    // the D* Lite tree starts again
+    if((int)g_.size() < n){
+        g_.resize(n);
+        rhs_.resize(n);
+        stamp_.resize(n, 0);
+        closed_.resize(n, 0);
+        parent_.resize(n);
+    }
+    dStarGoal_ = -1;
+    changedCells_.clear();
+    tilesValid_ = false;
+
+    setCosts(grid, originX_+1, originX_+width_-2, originY_+1, originY_+height_-2, false);
+}
+
+// Costs of the cells in [minX,maxX]x[minY,maxY], inside the border of the layer, and the jumps
+// that depend on them; the cells whose cost changes are kept for the D* Lite tree if asked to
+void PathPlanner::setCosts(Grid* grid, int minX, int maxX, int minY, int maxY, bool keepChanges)
+{
+    if(minX > maxX || minY > maxY)
+        return;
+
+    for(int y=minY; y<=maxY; y++)
+        for(int x=minX; x<=maxX; x++){
+            Cell* c = grid->getCell(x,y);
+            int extra = 0;
+            if(c->occType == OCCUPIED)
+                extra = -1;
+            else if(c->occType == UNEXPLORED)
+                extra = unexploredCost;
+            else if(c->planType == DANGER)
+                extra = dangerCost;
+            else if(c->planType == NEAR_WALLS)
+                extra = nearWallsCost;
+
+            unsigned char cost = (extra >= 0) ? std::min(255, 1 + extra) : 0;
+            int p = getIndex(x,y);
+            if(cost != cost_[p]){
+                cost_[p] = cost;
+                if(keepChanges)
+                    changedCells_.push_back(p);
+                if(tilesValid_)
+                    markTile(p);
+            }
+        }
+
+    // past a point repairing the tree costs more than growing it again
+    if(changedCells_.size() > cost_.size()/8){
+        dStarGoal_ = -1;
+        changedCells_.clear();
+    }
+
+    setJumps(minX - originX_, maxX - originX_, minY - originY_, maxY - originY_);
+}
+
+// Uniform flags and straight jumps after a change of the costs in [minX,maxX]x[minY,maxY] (in cells
+// of the layer). A cell is uniform depending on its neighbours, and a jump on the cells ahead of it
+// and at its sides, so whole rows and columns around the change are filled again.
+void PathPlanner::setJumps(int minX, int maxX, int minY, int maxY)
+{
+    minX = std::max(1, minX-1);
+    maxX = std::min(width_-2, maxX+1);
+    minY = std::max(1, minY-1);
+    maxY = std::min(height_-2, maxY+1);
+
+    const int neighbours[8] = {-1, 1, -width_-1, -width_, -width_+1, width_-1, width_, width_+1};
+    for(int y=minY; y<=maxY; y++)
+        for(int p=y*width_+minX; p<=y*width_+maxX; p++){
+            unsigned char c = cost_[p];
+            bool uniform = (c != 0);
+            for(int k=0; k<8 && uniform; k++)
+                uniform = (cost_[p+neighbours[k]] == c || cost_[p+neighbours[k]] == 0);
+            uniform_[p] = uniform;
+        }
+
+    // a jump goes on from a cell that is not a jump point exactly as the jump from it, so each
+    // table is filled backwards along its direction
+    for(int y=minY; y<=maxY; y++){
+        int row = y*width_;
+        for(int x=width_-2; x>=1; x--)
+            setStraightJump(row+x, row+x+1, 0);
+        for(int x=1; x<=width_-2; x++)
+            setStraightJump(row+x, row+x-1, 1);
+    }
+    for(int y=height_-2; y>=1; y--)
+        for(int x=minX; x<=maxX; x++)
+            setStraightJump(y*width_+x, (y+1)*width_+x, 2);
+    for(int y=1; y<=height_-2; y++)
+        for(int x=minX; x<=maxX; x++)
+            setStraightJump(y*width_+x, (y-1)*width_+x, 3);
+}
+
+PathPlanner::Status PathPlanner::findPath(const point2d& start, const point2d& goal, std::vector<point2d>& path)
+{
+    Timer timer;
+    path.clear();
+    expansions_ = 0;
+    time_ = 0.0;
+
+    if(!isInside(start) || !isInside(goal))
+        return NO_PATH;
+
+    int s = getIndex(start.x, start.y);
+    goal_ = getIndex(goal.x, goal.y);
+    goalX_ = goal.x - originX_;
+    goalY_ = goal.y - originY_;
+
+    if(algorithm == D_STAR_LITE){
+        Status status = findPathDStarLite(s, timer, path);
+        time_ = timer.getTotalTime();
+        return status;
+    }
+
+    // the tiles only see the costs of the layer; A* stands in until all of them are built
+    bool hierarchical = false;
+    if(algorithm == HIERARCHICAL && refreshTiles(timer, timeBudget/2)){
+        hierarchical = (abs(getTile(s)%tilesX_ - getTile(goal_)%tilesX_) > 1 ||
+                        abs(getTile(s)/tilesX_ - getTile(goal_)/tilesX_) > 1);
+    }
+
+    // the robot may stand on a blocked cell, and frontier goals are UNEXPLORED
+    unsigned char startCost = cost_[s], goalCost = cost_[goal_];
+    if(cost_[s] == 0)
+        cost_[s] = 1;
+    if(cost_[goal_] == 0)
+        cost_[goal_] = 1;
+
+    if(hierarchical){
+        Status status = findPathHierarchical(s, timer, path);
+        cost_[s] = startCost;
+        cost_[goal_] = goalCost;
+        time_ = timer.getTotalTime();
+        return status;
+    }
+
+    nextGeneration();
+
+    open_.clear();
+    g_[s] = 0;
+    stamp_[s] = generation_;
+    parent_[s] = s;
+    open_.push(getHeuristic(s), s);
+
+    Status status = NO_PATH;
+    int closest = s;
+    unsigned int closestDistance = getHeuristic(s);
+
+    while(!open_.empty()){
+        int p = open_.pop();
+        if(closed_[p] == generation_) // an older, costlier entry
+            continue;
+        closed_[p] = generation_;
+
+        if(p == goal_){
+            status = FOUND;
+            closest = p;
+            break;
+        }
+        if(getHeuristic(p) < closestDistance){
+            closestDistance = getHeuristic(p);
+            closest = p;
+        }
+
+        if(algorithm == JUMP_POINT_SEARCH)
+            expandJumpPoints(p);
+        else
+            expandAStar(p);
+
+        expansions_++;
+        if(timeBudget > 0.0 && expansions_%64 == 0 && timer.getTotalTime() > timeBudget){
+            status = TIMED_OUT;
+            break;
+        }
+    }
+
+    cost_[s] = startCost;
+    cost_[goal_] = goalCost;
+
+    if(status != NO_PATH)
+        buildPath(closest, path);
+
+    time_ = timer.getTotalTime();
+    return status;
+}
+
+void PathPlanner::nextGeneration()
+{
+    if(++generation_ == 0){
+        std::fill(stamp_.begin(), stamp_.end(), 0);
+        std::fill(closed_.begin(), closed_.end(), 0);
+        generation_ = 1;
+        dStarGoal_ = -1;
+    }
+}
+
+int PathPlanner::getCost(int x, int y)
+{
+    point2d p = {x, y};
+    if(!isInside(p))
+        return 0;
+    return cost_[getIndex(x,y)];
+}
+
+int PathPlanner::getLastExpansions()
+{
+    return expansions_;
+}
+
+float PathPlanner::getLastTime()
+{
+    return time_;
+}
+
+bool PathPlanner::isInside(const point2d& p)
+{
+    return p.x > originX_ && p.x < originX_ + width_ - 1 && p.y > originY_ && p.y < originY_ + height_ - 1;
+}
+
+int PathPlanner::getIndex(int x, int y)
+{
+    return (y - originY_)*width_ + x - originX_;
+}
+
+// octile distance from p to the cell (x,y) of the layer
+unsigned int PathPlanner::getDistance(int p, int x, int y)
+{
+    int dx = abs(p%width_ - x);
+    int dy = abs(p/width_ - y);
+    return STRAIGHT_STEP*std::max(dx,dy) + (DIAGONAL_STEP - STRAIGHT_STEP)*std::min(dx,dy);
+}
+
+// octile distance, with the smallest cost multiplier (1): consistent, so the popped keys never decrease
+unsigned int PathPlanner::getHeuristic(int p)
+{
+    return getDistance(p, goalX_, goalY_);
+}
+
+// Side (sx,sy) of a cell p reached by a straight move (dx,dy): the cells of that side can only be
+// reached through p when the one behind p on that side is blocked
+bool PathPlanner::isForced(int p, int dx, int dy, int sx, int sy)
+{
+    return cost_[p - dx - dy*width_ + sx + sy*width_] == 0 && cost_[p + sx + sy*width_] != 0;
+}
+
+// Whether a jump point p reached by a move (dx,dy) has to be left in direction (ex,ey)
+bool PathPlanner::isNatural(int p, int dx, int dy, int ex, int ey)
+{
+    if(ex == dx && ey == dy)
+        return true;
+    if(dx != 0 && dy != 0)
+        return (ex == dx && ey == 0) || (ex == 0 && ey == dy);
+
+    for(int side=-1; side<=1; side+=2){
+        int sx = (dx == 0) ? side : 0, sy = (dy == 0) ? side : 0;
+        if((ex == sx && ey == sy) || (ex == dx+sx && ey == dy+sy))
+            return isForced(p, dx, dy, sx, sy);
+    }
+    return false;
+}
+
+void PathPlanner::setStraightJump(int p, int next, int d)
+{
+    int dx = DIRECTIONS[d][0], dy = DIRECTIONS[d][1];
+    std::vector<int>& jumps = straightJumps_[d];
+
+    if(cost_[next] == 0)
+        jumps[p] = -1-next;
+    else if(!uniform_[next] || isForced(next, dx, dy, dy, dx) || isForced(next, dx, dy, -dy, -dx))
+        jumps[p] = next;
+    else
+        jumps[p] = jumps[next];
+}
+
+// Straight jump from p in direction d (0..3 as in DIRECTIONS), -1 if the way is blocked before
+// a jump point. The tables ignore the goal, so it is looked for in the cells crossed.
+int PathPlanner::jumpStraight(int p, int d)
+{
+    int end = straightJumps_[d][p];
+    bool blocked = (end < 0);
+    if(blocked)
+        end = -1-end;
+
+    int step = DIRECTIONS[d][0] + DIRECTIONS[d][1]*width_;
+    bool ahead = (step > 0) ? (goal_ > p && goal_ <= end) : (goal_ < p && goal_ >= end);
+    if(ahead && (goal_ - p)%step == 0)
+        return goal_;
+
+    return blocked ? -1 : end;
+}
+
+// First jump point from p in direction (dx,dy), -1 if the way is blocked before one. Every cell
+// crossed before it is uniform, so the whole jump costs the same per step.
+int PathPlanner::jump(int p, int dx, int dy)
+{
+    if(dx == 0 || dy == 0)
+        return jumpStraight(p, dx > 0 ? 0 : dx < 0 ? 1 : dy > 0 ? 2 : 3);
+
+    int dirX = (dx > 0) ? 0 : 1, dirY = (dy > 0) ? 2 : 3;
+    while(true){
+        int q = p + dx + dy*width_;
+        if(cost_[q] == 0 || cost_[p+dx] == 0 || cost_[p+dy*width_] == 0)
+            return -1;
+
+        if(q == goal_ || !uniform_[q])
+            return q;
+        if(jumpStraight(q, dirX) >= 0 || jumpStraight(q, dirY) >= 0)
+            return q;
+        p = q;
+    }
+}
+
+void PathPlanner::relax(int p, int q, unsigned int g)
+{
+    if(closed_[q] == generation_ || (stamp_[q] == generation_ && g >= g_[q]))
+        return;
+
+    stamp_[q] = generation_;
+    g_[q] = g;
+    parent_[q] = p;
+    open_.push(g + getHeuristic(q), q);
+}
+
+void PathPlanner::expandAStar(int p)
+{
+    for(int d=0; d<8; d++){
+        int dx = DIRECTIONS[d][0], dy = DIRECTIONS[d][1];
+        int q = p + dx + dy*width_;
+        if(cost_[q] == 0)
+            continue;
+
+        unsigned int step = STRAIGHT_STEP;
+        if(dx != 0 && dy != 0){
+            if(cost_[p+dx] == 0 || cost_[p+dy*width_] == 0)
+                continue;
+            step = DIAGONAL_STEP;
+        }
+        relax(p, q, g_[p] + step*cost_[q]);
+    }
+}
+
+void PathPlanner::expandJumpPoints(int p)
+{
+    int x = p%width_, y = p/width_;
+
+    // direction of the jump that reached p, none for the start
+    int px = parent_[p]%width_, py = parent_[p]/width_;
+    int dx = (x > px) - (x < px), dy = (y > py) - (y < py);
+    bool pruned = (dx != 0 || dy != 0) && uniform_[p];
+
+    for(int d=0; d<8; d++){
+        int ex = DIRECTIONS[d][0], ey = DIRECTIONS[d][1];
+        if(pruned && !isNatural(p, dx, dy, ex, ey))
+            continue;
+
+        int q = jump(p, ex, ey);
+        if(q < 0)
+            continue;
+
+        int steps = std::max(abs(q%width_ - x), abs(q/width_ - y));
+        unsigned int step = (ex != 0 && ey != 0) ? DIAGONAL_STEP : STRAIGHT_STEP;
+        relax(p, q, g_[p] + steps*step*cost_[p + ex + ey*width_]);
+    }
+}
+
+// Follows the parents back from p, filling in the cells crossed by each jump
+void PathPlanner::buildPath(int p, std::vector<point2d>& path)
+{
+    int x = p%width_, y = p/width_;
+    point2d c = {x + originX_, y + originY_};
+    path.push_back(c);
+
+    while(parent_[p] != p){
+        int q = parent_[p];
+        int qx = q%width_, qy = q/width_;
+        int sx = (qx > x) - (qx < x), sy = (qy > y) - (qy < y);
+        while(x != qx || y != qy){
+            x += sx;
+            y += sy;
+            c.x = x + originX_;
+            c.y = y + originY_;
+            path.push_back(c);
+        }
+        p = q;
+    }
+    std::reverse(path.begin(), path.end());
+}
+
+///////////////////
+///// D* LITE /////
+///////////////////
+
+static unsigned int addCosts(unsigned int a, unsigned int b)
+{
+    return (a >= INFINITE_COST - b) ? INFINITE_COST : a + b;
+}
+
+PathPlanner::Status PathPlanner::findPathDStarLite(int start, Timer& timer, std::vector<point2d>& path)
+{
+    if(dStarGeneration_ != generation_ || goal_ != dStarGoal_){
+        dStarStart_ = start;
+        restartDStarLite();
+    }else{
+        // the keys of the queue were computed from the old cell of the robot, at most the distance
+        // moved away from the new one: it is added to the new keys instead of updating the queue
+        int last = dStarStart_;
+        keyOffset_ = addCosts(keyOffset_, getDistance(start, last%width_, last/width_));
+        dStarStart_ = start;
+
+        // the robot's cell is passable even if blocked, as in the other searches
+        if(cost_[last] == 0)
+            updateNeighbourhood(last);
+        if(cost_[start] == 0)
+            updateNeighbourhood(start);
+        for(unsigned int i=0; i<changedCells_.size(); i++)
+            updateNeighbourhood(changedCells_[i]);
+    }
+    changedCells_.clear();
+
+    if(!computeShortestPath(timer))
+        return TIMED_OUT;
+    if(g_[start] == INFINITE_COST)
+        return NO_PATH;
+
+    // down the costs to the goal
+    int p = start;
+    point2d c = {p%width_ + originX_, p/width_ + originY_};
+    path.push_back(c);
+    while(p != goal_ && path.size() < cost_.size()){
+        int next = -1;
+        unsigned int best = INFINITE_COST;
+        for(int d=0; d<8; d++){
+            int q = p + DIRECTIONS[d][0] + DIRECTIONS[d][1]*width_;
+            unsigned int g = addCosts(getStepCost(p, d), g_[q]);
+            if(g < best){
+                best = g;
+                next = q;
+            }
+        }
+        if(next < 0)
+            break;
+        p = next;
+        c.x = p%width_ + originX_;
+        c.y = p/width_ + originY_;
+        path.push_back(c);
+    }
+    if(p != goal_){
+        path.clear();
+        return NO_PATH;
+    }
+    return FOUND;
+}
+
+void PathPlanner::restartDStarLite()
+{
+    nextGeneration();
+    dStarGeneration_ = generation_;
+    dStarGoal_ = goal_;
+    keyOffset_ = 0;
+
+    int n = width_*height_;
+    std::fill(g_.begin(), g_.begin()+n, INFINITE_COST);
+    std::fill(rhs_.begin(), rhs_.begin()+n, INFINITE_COST);
+    queue_.clear();
+
+    rhs_[goal_] = 0;
+    queue_.push_back(std::make_pair(getKey(goal_), goal_));
+}
+
+// Cost of the move from p in direction d (as in DIRECTIONS), INFINITE_COST if it is not allowed.
+// The robot's cell and the goal are passable.
+unsigned int PathPlanner::getStepCost(int p, int d)
+{
+    int dx = DIRECTIONS[d][0], dy = DIRECTIONS[d][1];
+    int q = p + dx + dy*width_;
+    if(cost_[q] == 0 && q != goal_ && q != dStarStart_)
+        return INFINITE_COST;
+
+    unsigned int step = STRAIGHT_STEP;
+    if(dx != 0 && dy != 0){
+        int a = p + dx, b = p + dy*width_;
+        if((cost_[a] == 0 && a != goal_ && a != dStarStart_) || (cost_[b] == 0 && b != goal_ && b != dStarStart_))
+            return INFINITE_COST;
+        step = DIAGONAL_STEP;
+    }
+    return step*std::max((unsigned char)1, cost_[q]);
+}
+
+// Cost to the goal first, then distance to the robot, in a single integer
+unsigned long long PathPlanner::getKey(int p)
+{
+    unsigned int g = std::min(g_[p], rhs_[p]);
+    unsigned int f = addCosts(addCosts(g, getDistance(p, dStarStart_%width_, dStarStart_/width_)), keyOffset_);
+    return ((unsigned long long)f << 32) | g;
+}
+
+void PathPlanner::updateVertex(int p)
+{
+    if(p != goal_){
+        unsigned int rhs = INFINITE_COST;
+        if(cost_[p] != 0 || p == dStarStart_)
+            for(int d=0; d<8; d++){
+                int q = p + DIRECTIONS[d][0] + DIRECTIONS[d][1]*width_;
+                rhs = std::min(rhs, addCosts(getStepCost(p, d), g_[q]));
+            }
+        rhs_[p] = rhs;
+    }
+    pushVertex(p);
+}
+
+// queues p if it is inconsistent
+void PathPlanner::pushVertex(int p)
+{
+    if(g_[p] != rhs_[p]){
+        queue_.push_back(std::make_pair(getKey(p), p));
+        std::push_heap(queue_.begin(), queue_.end(), std::greater< std::pair<unsigned long long,int> >());
+    }
+}
+
+// after a change of the cost of p, which weighs on the moves into p and past its corners
+void PathPlanner::updateNeighbourhood(int p)
+{
+    updateVertex(p);
+    for(int d=0; d<8; d++)
+        updateVertex(p + DIRECTIONS[d][0] + DIRECTIONS[d][1]*width_);
+}
+
+// Settles the costs to the goal until the robot's cell is consistent and no queued cell could
+// still lower it; false if the time budget runs out first. Cells are queued again instead of
+// moved in the queue: an entry with a key lower than the current one of its cell is requeued,
+// and one with a higher key is outdated, as a later entry holds the current key.
+bool PathPlanner::computeShortestPath(Timer& timer)
+{
+    std::greater< std::pair<unsigned long long,int> > later;
+
+    while(!queue_.empty() && (queue_.front().first < getKey(dStarStart_) || g_[dStarStart_] != rhs_[dStarStart_])){
+        std::pop_heap(queue_.begin(), queue_.end(), later);
+        std::pair<unsigned long long,int> e = queue_.back();
+        queue_.pop_back();
+
+        int p = e.second;
+        if(g_[p] == rhs_[p])
+            continue;
+        unsigned long long key = getKey(p);
+        if(e.first < key){
+            queue_.push_back(std::make_pair(key, p));
+            std::push_heap(queue_.begin(), queue_.end(), later);
+            continue;
+        }
+        if(e.first > key)
+            continue;
+
+        // only the neighbours whose lookahead goes through p can change, as in the optimized
+        // version of D* Lite: a lower cost is taken in one step, a higher one makes the
+        // neighbours that relied on it look at all of their moves again. As in updateVertex(),
+        // blocked cells and the border keep no cost, even when the UNEXPLORED cells let the
+        // tree reach it.
+        unsigned int g = g_[p];
+        if(g > rhs_[p]){
+            g_[p] = rhs_[p];
+            for(int d=0; d<8; d++){
+                int q = p + DIRECTIONS[d][0] + DIRECTIONS[d][1]*width_;
+                if(q == goal_ || (cost_[q] == 0 && q != dStarStart_))
+                    continue;
+                unsigned int rhs = addCosts(getStepCost(q, OPPOSITE[d]), g_[p]);
+                if(rhs < rhs_[q]){
+                    rhs_[q] = rhs;
+                    pushVertex(q);
+                }
+            }
+        }else{
+            g_[p] = INFINITE_COST;
+            updateVertex(p);
+            for(int d=0; d<8; d++){
+                int q = p + DIRECTIONS[d][0] + DIRECTIONS[d][1]*width_;
+                if(rhs_[q] == addCosts(getStepCost(q, OPPOSITE[d]), g) && rhs_[q] != INFINITE_COST)
+                    updateVertex(q);
+            }
+        }
+
+        expansions_++;
+        if(timeBudget > 0.0 && expansions_%64 == 0 && timer.getTotalTime() > timeBudget)
+            return false;
+    }
+    return true;
+}
+
+////////////////
+///// HPA* /////
+////////////////
+
+// As the other searches, a query that runs out of time returns the way to the node closest to the goal
+PathPlanner::Status PathPlanner::findPathHierarchical(int start, Timer& timer, std::vector<point2d>& path)
+{
+    int startTile = getTile(start), goalTile = getTile(goal_);
+    searchTile(goalTile, goal_, -1, true);
+    goalCosts_ = tileCosts_;
+    searchTile(startTile, start, -1, false);
+    startCosts_ = tileCosts_;
+
+    nextGeneration();
+    open_.clear();
+    g_[start] = 0;
+    stamp_[start] = generation_;
+    parent_[start] = start;
+    open_.push(getHeuristic(start), start);
+
+    Status status = NO_PATH;
+    int closest = start;
+    unsigned int closestDistance = getHeuristic(start);
+    while(!open_.empty()){
+        int p = open_.pop();
+        if(closed_[p] == generation_)
+            continue;
+        closed_[p] = generation_;
+        if(p == goal_){
+            status = FOUND;
+            closest = p;
+            break;
+        }
+        if(getHeuristic(p) < closestDistance){
+            closestDistance = getHeuristic(p);
+            closest = p;
+        }
+        expandAbstract(p, start, goalTile);
+
+        expansions_++;
+        if(timeBudget > 0.0 && expansions_%64 == 0 && timer.getTotalTime() > timeBudget){
+            status = TIMED_OUT;
+            break;
+        }
+    }
+    if(status == NO_PATH)
+        return NO_PATH;
+
+    std::vector<int> steps;
+    for(int p=closest; p!=start; p=parent_[p])
+        steps.push_back(p);
+    steps.push_back(start);
+    std::reverse(steps.begin(), steps.end());
+
+    point2d c = {start%width_ + originX_, start/width_ + originY_};
+    path.push_back(c);
+    for(unsigned int i=1; i<steps.size(); i++)
+        refineStep(steps[i-1], steps[i], path);
+    return status;
+}
+
+int PathPlanner::getTile(int p)
+{
+    return ((p/width_ - 1)/PATH_TILE_SIZE)*tilesX_ + (p%width_ - 1)/PATH_TILE_SIZE;
+}
+
+// index of the cell p in its tile, row by row
+int PathPlanner::getTileCell(int p)
+{
+    return ((p/width_ - 1)%PATH_TILE_SIZE)*PATH_TILE_SIZE + (p%width_ - 1)%PATH_TILE_SIZE;
+}
+
+// cells of the layer covered by the tile t (the last row and column of tiles may be narrower)
+void PathPlanner::getTileBounds(int t, int& minX, int& maxX, int& minY, int& maxY)
+{
+    minX = 1 + (t%tilesX_)*PATH_TILE_SIZE;
+    minY = 1 + (t/tilesX_)*PATH_TILE_SIZE;
+    maxX = std::min(minX + PATH_TILE_SIZE, width_ - 1) - 1;
+    maxY = std::min(minY + PATH_TILE_SIZE, height_ - 1) - 1;
+}
+
+void PathPlanner::markTile(int p)
+{
+    int t = getTile(p);
+    if(!tiles_[t].dirty){
+        tiles_[t].dirty = true;
+        dirtyTiles_.push_back(t);
+    }
+}
+
+// Rebuilds the tiles whose costs changed, then the openings of their neighbours, whose costs are
+// only searched again if their nodes moved. Every tile is rebuilt after a new layout, which takes
+// much longer than a query: the rebuild stops once the query has used 'budget' seconds, and goes
+// on at the next one. Returns whether every tile is up to date.
+bool PathPlanner::refreshTiles(Timer& timer, float budget)
+{
+    if(!tilesValid_){
+        tilesX_ = (width_ - 2 + PATH_TILE_SIZE - 1)/PATH_TILE_SIZE;
+        tilesY_ = (height_ - 2 + PATH_TILE_SIZE - 1)/PATH_TILE_SIZE;
+        tiles_.assign(tilesX_*tilesY_, PathTile());
+        dirtyTiles_.clear();
+        for(unsigned int t=0; t<tiles_.size(); t++){
+            tiles_[t].dirty = true;
+            dirtyTiles_.push_back(t);
+        }
+        tileCosts_.resize(PATH_TILE_SIZE*PATH_TILE_SIZE);
+        tileParents_.resize(PATH_TILE_SIZE*PATH_TILE_SIZE);
+        tileClosed_.resize(PATH_TILE_SIZE*PATH_TILE_SIZE);
+        tilesValid_ = true;
+    }
+
+    std::vector<int> neighbours;
+    unsigned int rebuilt = 0;
+    while(rebuilt < dirtyTiles_.size()){
+        int t = dirtyTiles_[rebuilt++];
+        setTileNodes(t);
+        setTileCosts(t);
+
+        int tx = t%tilesX_, ty = t/tilesX_;
+        if(tx > 0)         neighbours.push_back(t-1);
+        if(tx < tilesX_-1) neighbours.push_back(t+1);
+        if(ty > 0)         neighbours.push_back(t-tilesX_);
+        if(ty < tilesY_-1) neighbours.push_back(t+tilesX_);
+
+        if(budget > 0.0 && timer.getTotalTime() > budget)
+            break;
+    }
+
+    for(unsigned int i=0; i<neighbours.size(); i++){
+        PathTile& tile = tiles_[neighbours[i]];
+        if(tile.dirty)
+            continue;
+        std::vector<int> nodes(tile.nodes), exits(tile.exits);
+        setTileNodes(neighbours[i]);
+        if(tile.nodes != nodes || tile.exits != exits)
+            setTileCosts(neighbours[i]);
+    }
+
+    // the tiles left dirty are rebuilt by the next queries
+    for(unsigned int i=0; i<rebuilt; i++)
+        tiles_[dirtyTiles_[i]].dirty = false;
+    dirtyTiles_.erase(dirtyTiles_.begin(), dirtyTiles_.begin() + rebuilt);
+    return dirtyTiles_.empty();
+}
+
+void PathPlanner::setTileNodes(int t)
+{
+    PathTile& tile = tiles_[t];
+    tile.nodes.clear();
+    tile.exits.clear();
+
+    // across the outer sides of the outer tiles is the blocked border of the layer
+    int minX, maxX, minY, maxY;
+    getTileBounds(t, minX, maxX, minY, maxY);
+    addOpenings(tile, minY*width_ + minX, width_, -1, maxY-minY+1);
+    addOpenings(tile, minY*width_ + maxX, width_, 1, maxY-minY+1);
+    addOpenings(tile, minY*width_ + minX, 1, -width_, maxX-minX+1);
+    addOpenings(tile, maxY*width_ + minX, 1, width_, maxX-minX+1);
+}
+
+// Nodes of the side of a tile with 'length' cells from 'first', 'along' apart, whose neighbours
+// in the next tile are 'across' away: on each opening, the cheapest crossings, the one closest
+// to their middle if they span a short stretch, the first and last one otherwise. Both tiles
+// scan their common side in the same order and see the same crossing costs, so they pick the
+// same nodes.
+void PathPlanner::addOpenings(PathTile& tile, int first, int along, int across, int length)
+{
+    int begin = -1;
+    for(int i=0; i<=length; i++){
+        int p = first + i*along;
+        bool open = (i < length && cost_[p] != 0 && cost_[p+across] != 0);
+        if(open && begin < 0)
+            begin = i;
+        if(open || begin < 0)
+            continue;
+
+        int cheapest = INT_MAX, firstCheap = -1, lastCheap = -1;
+        for(int j=begin; j<i; j++){
+            int q = first + j*along;
+            int cost = cost_[q] + cost_[q+across];
+            if(cost < cheapest){
+                cheapest = cost;
+                firstCheap = j;
+            }
+            if(cost == cheapest)
+                lastCheap = j;
+        }
+
+        if(lastCheap - firstCheap + 1 <= MAX_SINGLE_OPENING){
+            int middle = firstCheap;
+            for(int j=firstCheap; j<=lastCheap; j++){
+                int q = first + j*along;
+                if(cost_[q] + cost_[q+across] == cheapest && abs(2*j - firstCheap - lastCheap) < abs(2*middle - firstCheap - lastCheap))
+                    middle = j;
+            }
+            tile.nodes.push_back(first + middle*along);
+            tile.exits.push_back(first + middle*along + across);
+        }else{
+            tile.nodes.push_back(first + firstCheap*along);
+            tile.exits.push_back(first + firstCheap*along + across);
+            tile.nodes.push_back(first + lastCheap*along);
+            tile.exits.push_back(first + lastCheap*along + across);
+        }
+        begin = -1;
+    }
+}
+
+void PathPlanner::setTileCosts(int t)
+{
+    PathTile& tile = tiles_[t];
+    int n = tile.nodes.size();
+    tile.costs.resize(n*n);
+    for(int i=0; i<n; i++){
+        searchTile(t, tile.nodes[i], -1, false);
+        for(int j=0; j<n; j++)
+            tile.costs[i*n+j] = tileCosts_[getTileCell(tile.nodes[j])];
+    }
+}
+
+// Costs inside the tile t from the cell 'source', or towards it if 'reverse', paying for the cell
+// entered as in the other searches. With a 'target' the search is an A* that stops there.
+void PathPlanner::searchTile(int t, int source, int target, bool reverse)
+{
+    int minX, maxX, minY, maxY;
+    getTileBounds(t, minX, maxX, minY, maxY);
+    std::fill(tileCosts_.begin(), tileCosts_.end(), INFINITE_COST);
+    std::fill(tileClosed_.begin(), tileClosed_.end(), 0);
+    int targetX = target%width_, targetY = target/width_;
+
+    tileOpen_.clear();
+    tileCosts_[getTileCell(source)] = 0;
+    tileParents_[getTileCell(source)] = source;
+    tileOpen_.push(0, source);
+
+    while(!tileOpen_.empty()){
+        int p = tileOpen_.pop();
+        int i = getTileCell(p);
+        if(tileClosed_[i])
+            continue;
+        tileClosed_[i] = 1;
+        if(p == target)
+            return;
+
+        int x = p%width_, y = p/width_;
+        for(int d=0; d<8; d++){
+            int dx = DIRECTIONS[d][0], dy = DIRECTIONS[d][1];
+            int q = p + dx + dy*width_;
+            if(x+dx < minX || x+dx > maxX || y+dy < minY || y+dy > maxY || cost_[q] == 0)
+                continue;
+
+            unsigned int step = STRAIGHT_STEP;
+            if(dx != 0 && dy != 0){
+                if(cost_[p+dx] == 0 || cost_[p+dy*width_] == 0)
+                    continue;
+                step = DIAGONAL_STEP;
+            }
+            unsigned int g = tileCosts_[i] + step*cost_[reverse ? p : q];
+            int j = getTileCell(q);
+            if(g < tileCosts_[j]){
+                tileCosts_[j] = g;
+                tileParents_[j] = p;
+                tileOpen_.push(target < 0 ? g : g + getDistance(q, targetX, targetY), q);
+            }
+        }
+    }
+}
+
+// Abstract moves from p: across the openings where p is a node, to the other nodes of its tile,
+// from the start to the nodes of its tile, and to the goal from the cells of the goal's tile
+void PathPlanner::expandAbstract(int p, int start, int goalTile)
+{
+    int t = getTile(p);
+    PathTile& tile = tiles_[t];
+    int n = tile.nodes.size();
+
+    if(p == start)
+        for(int j=0; j<n; j++){
+            unsigned int cost = startCosts_[getTileCell(tile.nodes[j])];
+            if(cost != INFINITE_COST)
+                relax(p, tile.nodes[j], g_[p] + cost);
+        }
+    if(t == goalTile && goalCosts_[getTileCell(p)] != INFINITE_COST)
+        relax(p, goal_, g_[p] + goalCosts_[getTileCell(p)]);
+
+    for(int i=0; i<n; i++){
+        if(tile.nodes[i] != p)
+            continue;
+        relax(p, tile.exits[i], g_[p] + STRAIGHT_STEP*cost_[tile.exits[i]]);
+        for(int j=0; j<n; j++)
+            if(tile.costs[i*n+j] != INFINITE_COST)
+                relax(p, tile.nodes[j], g_[p] + tile.costs[i*n+j]);
+    }
+}
+
+// Cells from a (excluded) to b of an abstract move: the cheapest way inside their tile, or the
+// single step across an opening
+void PathPlanner::refineStep(int a, int b, std::vector<point2d>& path)
+{
+    point2d c;
+    int t = getTile(a);
+    if(getTile(b) != t){
+        c.x = b%width_ + originX_;
+        c.y = b/width_ + originY_;
+        path.push_back(c);
+        return;
+    }
+
+    searchTile(t, a, b, false);
+    unsigned int first = path.size();
+    for(int p=b; p!=a; p=tileParents_[getTileCell(p)]){
+        c.x = p%width_ + originX_;
+        c.y = p/width_ + originY_;
+        path.push_back(c);
+    }
+    std::reverse(path.begin()+first, path.end());
+}
@@ -0,0 +1,186 @@
+#ifndef PATHPLANNER_H
+#define PATHPLANNER_H
+
+#include <utility>
+#include <vector>
+
+#include "Grid.h"
+
+class Timer;
+
+// Priority queue for searches whose popped keys never decrease (A* with a consistent heuristic).
+// Bucket i holds the keys whose highest bit differing from the last popped key is bit i-1:
+// a push is O(1), and a key only moves to lower buckets, at most 32 times over its life.
+// clear() keeps the capacity of the buckets, so once they have grown a search allocates nothing.
+class RadixHeap
+{
+    public:
+        RadixHeap();
+
+        void clear();
+        bool empty();
+        void push(unsigned int key, int value); // key >= the last popped one
+        int pop();                              // value of a smallest key
+
+    private:
+        std::vector< std::pair<unsigned int,int> > buckets_[33];
+        unsigned int last_;
+        int size_;
+};
+
+// Tile of the abstract graph of PathPlanner::HIERARCHICAL
+class PathTile
+{
+    public:
+        std::vector<int> nodes;          // cells of the tile at an opening into a neighbour tile
+        std::vector<int> exits;          // cell across the opening from each node
+        std::vector<unsigned int> costs; // from node i to node j without leaving the tile, at i*n+j
+        bool dirty;
+};
+
+// Point-to-point planner over the cell types classified by Planning: 8-connected shortest paths,
+// without cutting the corners of blocked cells, on a cost layer rebuilt by updateCosts(). Entering
+// a cell costs its step length times 1 + the extra cost of its type (REGULAR cells cost nothing
+// extra, OCCUPIED cells are blocked).
+//
+// The search memory (costs so far, parents, open/closed marks) covers the cost layer and is only
+// valid for the query whose generation number it is stamped with, so queries never clear it.
+//
+// JUMP_POINT_SEARCH prunes and jumps as the original JPS (without corner cutting) over the cells
+// whose passable neighbours all cost the same as them, and stops at every other cell: it finds the
+// same path cost as ASTAR. The straight jumps from every cell are precomputed with the costs
+// (as in JPS+), so a diagonal jump checks its two straight jumps in constant time per step.
+// Each edge of a cost band is a line of jump points, so JPS only pays off with few cost levels
+// (e.g. nearWallsCost 0 and dangerCost -1).
+//
+// D_STAR_LITE searches from the goal towards the robot and keeps its search tree between queries
+// to the same goal: the next query only repairs the part of the tree below the cells whose cost
+// changed since (the cells that turned OCCUPIED or FREE and the bands around them) and follows the
+// robot with the key offset of D* Lite, so its cost follows the size of the change. A new goal or
+// layout starts the tree again. A query that runs out of time returns no path, and the next one
+// carries on from where it stopped.
+//
+// HIERARCHICAL (HPA*) splits the layer in tiles of PATH_TILE_SIZE cells and caches for each tile
+// the cells where straight moves cross into the next tiles (the middle of a short opening of a
+// side, both ends of a longer one) and the costs between them inside the tile. A query between
+// cells more than a tile apart searches this graph, then fills in each of its steps inside the
+// tile, so its cost follows the number of tiles crossed rather than of cells; the paths are
+// a few percent longer than the shortest ones. Only the tiles whose costs changed, and the
+// neighbours whose openings changed with them, are refreshed. Closer queries use ASTAR, and so
+// do the queries made while the tiles of a new layout are still being built, half a time budget
+// per query.
+class PathPlanner
+{
+    public:
+        enum Algorithm {ASTAR, JUMP_POINT_SEARCH, D_STAR_LITE, HIERARCHICAL};
+        enum Status {FOUND, TIMED_OUT, NO_PATH};
+
+        PathPlanner();
+
+        // Cost layer covering 'limits' from the types of the cells (caller holds the grid mutex).
+        // The layer has a margin around them, and while the limits stay inside it only the cells
+        // in 'changed' are read again (their new costs are kept for D_STAR_LITE).
+        void updateCosts(Grid* grid, const bbox& limits);
+        void updateCosts(Grid* grid, const bbox& limits, const bbox& changed);
+
+        // Path of cells from start to goal, both included. The start cell is always passable, and so
+        // is an UNEXPLORED goal (a frontier cell). When the time budget runs out the path leads to
+        // the expanded cell closest to the goal.
+        Status findPath(const point2d& start, const point2d& goal, std::vector<point2d>& path);
+
+        int getCost(int x, int y); // multiplier of the step length, 0 for blocked cells
+        int getLastExpansions();   // cells expanded (D_STAR_LITE: updated) by the last query
+        float getLastTime();       // s
+
+        // Parameters (the costs take effect on the next updateCosts)
+        Algorithm algorithm;
+        int nearWallsCost;  // extra cost of entering a NEAR_WALLS cell, in step lengths
+        int dangerCost;     // of a DANGER cell, -1 to block them
+        int unexploredCost; // of an UNEXPLORED cell, -1 to block them
+        float timeBudget;   // s per query, 0 for none
+
+    private:
+        void setCosts(Grid* grid, int minX, int maxX, int minY, int maxY, bool keepChanges);
+        void setJumps(int minX, int maxX, int minY, int maxY);
+        void nextGeneration();
+        bool isInside(const point2d& p);
+        int getIndex(int x, int y);
+        unsigned int getDistance(int p, int x, int y);
+        unsigned int getHeuristic(int p);
+        bool isForced(int p, int dx, int dy, int sx, int sy);
+        bool isNatural(int p, int dx, int dy, int ex, int ey);
+        void setStraightJump(int p, int next, int d);
+        int jumpStraight(int p, int d);
+        int jump(int p, int dx, int dy);
+        void relax(int p, int q, unsigned int g);
+        void expandAStar(int p);
+        void expandJumpPoints(int p);
+        void buildPath(int p, std::vector<point2d>& path);
+
+        Status findPathDStarLite(int start, Timer& timer, std::vector<point2d>& path);
+        void restartDStarLite();
+        unsigned int getStepCost(int p, int d);
+        unsigned long long getKey(int p);
+        void updateVertex(int p);
+        void pushVertex(int p);
+        void updateNeighbourhood(int p);
+        bool computeShortestPath(Timer& timer);
+
+        Status findPathHierarchical(int start, Timer& timer, std::vector<point2d>& path);
+        int getTile(int p);
+        int getTileCell(int p);
+        void getTileBounds(int t, int& minX, int& maxX, int& minY, int& maxY);
+        void markTile(int p);
+        bool refreshTiles(Timer& timer, float budget);
+        void setTileNodes(int t);
+        void addOpenings(PathTile& tile, int first, int along, int across, int length);
+        void setTileCosts(int t);
+        void searchTile(int t, int source, int target, bool reverse);
+        void expandAbstract(int p, int start, int goalTile);
+        void refineStep(int a, int b, std::vector<point2d>& path);
+
+        // cost layer, row by row, with a border of blocked cells around the margin of 'limits'
+        std::vector<unsigned char> cost_;
+        int originX_, originY_, width_, height_;
+        int layerCosts_[3]; // nearWallsCost, dangerCost and unexploredCost of the layer
+
+        // cells whose passable neighbours all cost the same as them, and for each of the 4 straight
+        // directions the cell where a jump from each cell ends: a jump point, or -1-c if it runs
+        // into the blocked cell c
+        std::vector<unsigned char> uniform_;
+        std::vector<int> straightJumps_[4];
+
+        // search memory, valid where stamp_ (closed_) holds the generation of the query
+        std::vector<unsigned int> g_, stamp_, closed_;
+        std::vector<int> parent_;
+        unsigned int generation_;
+        RadixHeap open_;
+
+        // D* Lite: cost to the goal from each cell (in g_) and its one-step lookahead, the queue of
+        // inconsistent cells with lazy deletion, the robot's cell at the last query and the key
+        // offset accumulated since the tree was started, valid while generation_ is dStarGeneration_
+        std::vector<unsigned int> rhs_;
+        std::vector< std::pair<unsigned long long,int> > queue_;
+        std::vector<int> changedCells_;
+        unsigned int dStarGeneration_;
+        int dStarStart_, dStarGoal_;
+        unsigned int keyOffset_;
+
+        // HPA*: tiles, row by row, and the ones whose costs changed since the last refresh; costs
+        // and parents of the last search inside a tile (by cell of the tile), and the costs from
+        // the start and to the goal inside their tiles
+        std::vector<PathTile> tiles_;
+        std::vector<int> dirtyTiles_;
+        int tilesX_, tilesY_;
+        bool tilesValid_;
+        std::vector<unsigned int> tileCosts_, startCosts_, goalCosts_;
+        std::vector<int> tileParents_;
+        std::vector<unsigned char> tileClosed_;
+        RadixHeap tileOpen_;
+
+        int goal_, goalX_, goalY_;
+        int expansions_;
+        float time_;
+};
+
+#endif // PATHPLANNER_H
@@ -1,20 +1,30 @@
 #include "PioneerBase.h"
 
+#ifndef HEADLESS
 #include <GL/glut.h>
+#endif
 #include <limits.h>
+#include <algorithm>
 
 
 PioneerBase::PioneerBase()
 {
     // reset robot position in simulator
     resetSimPose_ = true;
+    sim_ = NULL;
+    logFile_ = NULL;
+    verbose_ = true;
+#ifndef HEADLESS
+    parser_ = NULL;
+    robotConnector_ = NULL;
+    laserConnector_ = NULL;
+#endif
 
     // sensors variables
+    pthread_mutex_init(&laserPointsMutex_, NULL);
     numSonars_ = 8;
     sonars_.resize(numSonars_, 0.0);
-    numLasers_ = 181;
-    lasers_.resize(numLasers_, 0.0);
-    maxLaserRange_ = 4.0; // 6.5;
+    setLaserDescription(LaserDescription::getConfigured());
     maxSonarRange_ = 5.0; // 5.0;
 
 
@@ -30,7 +40,29 @@ bool PioneerBase::initialize(ConnectionMode cmode, LogMode lmode, std::string fn
 {
     // initialize logfile
     logFile_ = new LogFile(lmode,fname);
+    if(lmode==RECORDING)
+        logFile_->writeLaserDescription(laser_);
+    else if(lmode==PLAYBACK && logFile_->hasLaserDescription())
+        setLaserDescription(logFile_->getLaserDescription());
+
+    // in-process simulator, replaces MobileSim and ARIA
+    if(cmode==LOCAL_SIMULATION){
+        sim_ = new Simulator();
+        sim_->numLasers = numLasers_;
+        sim_->firstLaserAngle = laser_.getFirstAngle();
+        sim_->laserAngleIncrement = laser_.getAngleIncrement();
+        sim_->numSonars = numSonars_;
+        if(!sim_->loadMap(simMapFile_)){
+            printf("Could not load simulation map '%s'... exiting\n", simMapFile_.c_str());
+            return false;
+        }
+        return true;
+    }
 
+#ifdef HEADLESS
+    printf("Headless build only supports the in-process simulator\n");
+    return false;
+#else
     int argc=0; char** argv;
 
     // initialize ARIA
@@ -100,8 +132,11 @@ bool PioneerBase::initialize(ConnectionMode cmode, LogMode lmode, std::string fn
         resetSimPose();
 
     return true;
+#endif
 }
 
+#ifndef HEADLESS
+
 bool PioneerBase::initARIAConnection(int argc, char** argv)
 {
     parser_= new ArArgumentParser(&argc, argv);
@@ -142,9 +177,17 @@ void PioneerBase::resetSimPose()
     pkt.finalizePacket();
     robot_.getDeviceConnection()->write(pkt.getBuf(), pkt.getLength());
 }
+#endif
 
 void PioneerBase::closeARIAConnection()
 {
+    if(sim_!=NULL){
+        delete sim_;
+        sim_ = NULL;
+        return;
+    }
+
+#ifndef HEADLESS
     robot_.stopRunning(true);
     robot_.disconnect();
     sick_.lockDevice();
@@ -157,8 +200,25 @@ void PioneerBase::closeARIAConnection()
         delete robotConnector_;
     if(laserConnector_!=NULL)
         delete laserConnector_;
+#endif
+}
+
+void PioneerBase::setSimulationMap(std::string mapname)
+{
+    simMapFile_ = mapname;
+}
+
+Simulator* PioneerBase::getSimulator()
+{
+    return sim_;
+}
+
+void PioneerBase::setVerbose(bool v)
+{
+    verbose_ = v;
 }
 
+#ifndef HEADLESS
 ///////////////////////////
 ///// DRAWING METHODS /////
 ///////////////////////////
@@ -240,45 +300,41 @@ void PioneerBase::drawSonars(bool drawCones)
 
 void PioneerBase::drawLasers(bool fill)
 {
-    std::vector<float> s = getLaserReadings();
-    float angle = DEG2RAD(-90.0);
+    // copies, the robot thread may replace the scan meanwhile
+    pthread_mutex_lock(&laserPointsMutex_);
+    std::vector<float> x = laserPoints_.x;
+    std::vector<float> y = laserPoints_.y;
+    pthread_mutex_unlock(&laserPointsMutex_);
 
-    int inc = 2;
-    float angleInc = DEG2RAD(inc);
-
-    glRotatef(-90,0.0,0.0,1.0);
+    // about 2 degrees between drawn beams, whatever the resolution of the scanner
+    int inc = std::max(1, (int)(2.0/fabs(laser_.getAngleIncrement())));
 
     if(fill){
         glColor4f(0.0,1.0,0.0,0.3);
-        for(int i=0;i+inc<s.size(); i+=inc)
+        for(int i=0;i+inc<x.size(); i+=inc)
         {
-
             glBegin( GL_POLYGON);
             {
-            glVertex2f(s[i]*sin(angle)*100, s[i]*cos(angle)*100);
-            glVertex2f(s[i+inc]*sin(angle+angleInc)*100, s[i+inc]*cos(angle+angleInc)*100);
+            glVertex2f(x[i]*100, y[i]*100);
+            glVertex2f(x[i+inc]*100, y[i+inc]*100);
             glVertex2f(0, 0);
             }
             glEnd();
-
-            angle += angleInc;
         }
     }else{
         glColor3f(0.0,0.7,0.0);
         glBegin( GL_LINES);
         {
-            for(int i=0;i<s.size(); i+=inc)
+            for(int i=0;i<x.size(); i+=inc)
             {
-                glVertex2f(s[i]*sin(angle)*100, s[i]*cos(angle)*100);
+                glVertex2f(x[i]*100, y[i]*100);
                 glVertex2f(0, 0);
-                angle += angleInc;
             }
         }
         glEnd();
     }
-
-    glRotatef(90,0.0,0.0,1.0);
 }
+#endif
 
 ////////////////////////////////////////////////////////////////
 ////// METHODS FOR READING ODOMETRY & SENSORS MEASUREMENTS /////
@@ -286,6 +342,16 @@ void PioneerBase::drawLasers(bool fill)
 
 bool PioneerBase::readOdometryAndSensors()
 {
+    if(sim_!=NULL){
+        sim_->step();
+        odometry_ = sim_->getOdometry();
+        sim_->readLasers(lasers_);
+        sim_->readSonars(sonars_);
+        updateLaserScan();
+        return true;
+    }
+
+#ifndef HEADLESS
     std::vector < ArSensorReading > *readings;
     std::vector < ArSensorReading > ::iterator it;
     ArPose p;
@@ -313,16 +379,20 @@ bool PioneerBase::readOdometryAndSensors()
 
     // sensors readings are given in mm, we convert to m
     int i = 0;
-    for (it = readings->begin(); it!=readings->end(); it++){
+    for (it = readings->begin(); it!=readings->end() && i<numLasers_; it++){
         lasers_[i++] = (float)(*it).getRange()/1000.0;
     }
 
     sick_.unlockDevice();
+    updateLaserScan();
 
     for(int i=0;i<numSonars_;i++)
         sonars_[i]=(float)(robot_.getSonarRange(i))/1000.0;
 
     return true;
+#else
+    return false;
+#endif
 }
 
 float PioneerBase::getMinSonarValueInRange(int idFirst, int idLast)
@@ -335,24 +405,29 @@ float PioneerBase::getMinSonarValueInRange(int idFirst, int idLast)
     return min;
 }
 
+// Smallest reading (mean of the beams within kernelSize of each one) from beam idFirst to idLast, in O(1)
 float PioneerBase::getMinLaserValueInRange(int idFirst, int idLast, int kernelSize)
 {
-    float min = 1000000;
-    for(int i=idFirst; i<=idLast; i++){
-        float val=0;
-        int c=0;
-        for(int j=i-kernelSize;j<=i+kernelSize;j++)
-            if(j>=0 && j<numLasers_){
-                val+=lasers_[j];
-                c++;
-            }
-        val /= c;
+    return laserFilter_.getSmoothedMin(idFirst, idLast, kernelSize);
+}
 
-        if(val<min)
-            min = val;
-    }
+float PioneerBase::getMeanLaserValueInRange(int idFirst, int idLast)
+{
+    return laserFilter_.getMean(idFirst, idLast);
+}
 
-    return min;
+void PioneerBase::setLaserDespeckle(bool d)
+{
+    laserFilter_.setDespeckle(d);
+}
+
+// Preprocessing shared by every user of a new scan
+void PioneerBase::updateLaserScan()
+{
+    laserFilter_.update(lasers_);
+    pthread_mutex_lock(&laserPointsMutex_);
+    laserPoints_.update(lasers_, laser_);
+    pthread_mutex_unlock(&laserPointsMutex_);
 }
 
 float PioneerBase::getMaxLaserRange()
@@ -365,6 +440,20 @@ int PioneerBase::getNumLasers()
     return numLasers_;
 }
 
+const LaserDescription& PioneerBase::getLaserDescription()
+{
+    return laser_;
+}
+
+void PioneerBase::setLaserDescription(const LaserDescription& d)
+{
+    laser_ = d;
+    numLasers_ = laser_.getNumBeams();
+    lasers_.assign(numLasers_, 0.0);
+    maxLaserRange_ = laser_.getMaxRange();
+    updateLaserScan();
+}
+
 float PioneerBase::getMaxSonarRange()
 {
     return maxSonarRange_;
@@ -385,6 +474,13 @@ const std::vector<float> &PioneerBase::getLaserReadings()
     return lasers_;
 }
 
+// Points of the current scan, the world frame at the current odometry
+const LaserPointCloud& PioneerBase::getLaserPoints()
+{
+    laserPoints_.setPose(odometry_);
+    return laserPoints_;
+}
+
 const std::vector<float> &PioneerBase::getSonarReadings()
 {
     return sonars_;
@@ -403,6 +499,7 @@ void PioneerBase::setSonarReadings(const std::vector<float> &s)
 void PioneerBase::setLaserReadings(const std::vector<float> &l)
 {
     lasers_ = l;
+    updateLaserScan();
 }
 
 int PioneerBase::getNearestSonarBeam(float angle)
@@ -435,26 +532,17 @@ float PioneerBase::getAngleOfSonarBeam(int k)
 
 int PioneerBase::getNearestLaserBeam(float angle)
 {
+    // default scanner:
     // k = 0   -- angle  90
     // k = 90  -- angle   0
     // k = 180 -- angle -90
 
-    if(angle>90.0)
-        return 0;
-    else if(angle<-90.0)
-        return 180;
-    else{
-        return 90-(int)((angle > 0.0)?(angle + 0.5):(angle - 0.5));
-    }
+    return laser_.getNearestBeam(angle);
 }
 
 float PioneerBase::getAngleOfLaserBeam(int k)
 {
-    // k = 0   -- angle  90
-    // k = 90  -- angle   0
-    // k = 180 -- angle -90
-
-    return 90.0-(float)k;
+    return laser_.getAngleOfBeam(k);
 }
 
 float PioneerBase::getKthSonarReading(int k)
@@ -568,8 +656,10 @@ void PioneerBase::setWheelsVelocity_fromLinAngVelocity(float linV, float angV)
     else if(vRight_ < -maxVel)
         vRight_ = -maxVel;
 
-    std::cout << "linVel: " << linV << " angVel: " << angV << std::endl;
-    std::cout << "vLeft_: " << vLeft_ << " vRight_: " << vRight_ << std::endl;
+    if(verbose_){
+        std::cout << "linVel: " << linV << " angVel: " << angV << std::endl;
+        std::cout << "vLeft_: " << vLeft_ << " vRight_: " << vRight_ << std::endl;
+    }
 
 }
 
@@ -581,20 +671,36 @@ void PioneerBase::setWheelsVelocity(float lv, float rv)
 
 void PioneerBase::stopMovement()
 {
+    if(sim_!=NULL){
+        sim_->setWheelsVelocity(0.0, 0.0);
+        return;
+    }
+#ifndef HEADLESS
     robot_.stop();
+#endif
 }
 
 void PioneerBase::resumeMovement()
 {
+    if(sim_!=NULL){
+        sim_->setWheelsVelocity(vLeft_, vRight_);
+        return;
+    }
+#ifndef HEADLESS
     robot_.setVel2(vLeft_, vRight_);
+#endif
 }
 
 bool PioneerBase::isMoving()
 {
+    if(sim_!=NULL)
+        return sim_->isMoving();
+#ifndef HEADLESS
     if(robot_.getRightVel()!=0.0)
         return true;
     if(robot_.getLeftVel()!=0.0)
         return true;
+#endif
     return false;
 }
 
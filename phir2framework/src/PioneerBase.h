@@ -1,8 +1,13 @@
 #ifndef PIONEERBASE_H
 #define PIONEERBASE_H
 
+#ifndef HEADLESS
 #include <Aria.h>
+#endif
 
+#include <pthread.h>
+
+#include "Simulator.h"
 #include "Utils.h"
 
 class PioneerBase
@@ -14,10 +19,17 @@ public:
     bool initialize(ConnectionMode cmode, LogMode lmode, std::string fname);
     void closeARIAConnection();
 
+    // In-process simulation stuff
+    void setSimulationMap(std::string mapname);
+    Simulator* getSimulator();
+    void setVerbose(bool v);
+
+#ifndef HEADLESS
     // Drawing stuff
     void drawBase();
     void drawSonars(bool drawCones=false);
     void drawLasers(bool fill=true);
+#endif
 
     // Navigation stuff
     void setMovementSimple(MovingDirection dir);
@@ -44,10 +56,15 @@ public:
     float getKthSonarReading(int k);
 
     const std::vector<float>& getLaserReadings();
+    const LaserPointCloud& getLaserPoints();
+    const LaserDescription& getLaserDescription();
+    void setLaserDescription(const LaserDescription& d);
     int getNumLasers();
     float getMaxLaserRange();
     void setLaserReadings(const std::vector<float> &l);
     float getMinLaserValueInRange(int idFirst, int idLast, int kernelSize=0);
+    float getMeanLaserValueInRange(int idFirst, int idLast);
+    void setLaserDespeckle(bool d);
     int getNearestLaserBeam(float angle);
     float getAngleOfLaserBeam(int k);
     float getKthLaserReading(int k);
@@ -60,6 +77,7 @@ private:
     Pose odometry_;
     Pose truePose_;
 
+#ifndef HEADLESS
     // ARIA stuff
     ArRobot robot_;
     ArRobotConnector *robotConnector_;
@@ -69,9 +87,16 @@ private:
     ArLaserConnector *laserConnector_;
     bool initARIAConnection(int argc, char** argv);
     void resetSimPose();
+#endif
 
     bool resetSimPose_;
 
+    // In-process simulation stuff
+    Simulator* sim_;
+    std::string simMapFile_;
+
+    bool verbose_;
+
     // Navigation stuff
     double vLeft_, vRight_;
     double oldVLeft_, oldVRight_;
@@ -81,9 +106,14 @@ private:
     int numSonars_;
     std::vector<float> sonars_;
     float maxSonarRange_;
+    LaserDescription laser_;
     int numLasers_;
     std::vector<float> lasers_;
     float maxLaserRange_;
+    LaserScanFilter laserFilter_; // range queries on the current scan
+    LaserPointCloud laserPoints_; // points of the current scan
+    pthread_mutex_t laserPointsMutex_; // held while laserPoints_ is replaced or copied for drawing
+    void updateLaserScan();
 
     LogFile* logFile_;
 };
@@ -1,8 +1,12 @@
 #include "Planning.h"
+#include "Trace.h"
+#include "Metrics.h"
 
 #include <queue>
 #include <float.h> //DBL_MAX
+#ifndef HEADLESS
 #include <GL/glut.h>
+#endif
 
 ////////////////////////
 ///                  ///
@@ -21,14 +25,47 @@ Planning::Planning()
     newGridLimits.maxX = newGridLimits.maxY = -1000;
 
     gridLimits = newGridLimits;
+    newChangedLimits = newGridLimits;
+    classified_ = false;
+
+    preference = 0.3;
+    numPotentialIterations = 100;
+    fastMarchingObstacleCost = 4.0;
+    fastMarchingObstacleRange = 8.0; // NEAR_WALLS
+    fastMarchingDangerCost = 100.0;
+    fastMarchingToTarget = false;
+    minFrontierSize = 5;
+    frontierSizeWeight = 1.0;
+    frontierHysteresis = 1.0;
+    incrementalClassification = true;
+    targetFrontier = -1;
+    pathStatus = PathPlanner::NO_PATH;
+    hasWaypoint_ = false;
+    hadFrontierGoal_ = false;
+    numActiveCells_ = 0;
+    activeCellsStale_ = true;
+    activeLimits_.minX = activeLimits_.minY = 1000;
+    activeLimits_.maxX = activeLimits_.maxY = -1000;
+    frontierLimits_.minX = frontierLimits_.minY = 1000;
+    frontierLimits_.maxX = frontierLimits_.maxY = -1000;
+    pthread_mutex_init(&pathMutex_, NULL);
+    motionMode_ = MANUAL_SIMPLE;
+    pendingCosts_.minX = pendingCosts_.minY = 1000;
+    pendingCosts_.maxX = pendingCosts_.maxY = -1000;
+    planningTime = 0.0;
+    for(int k=0; k<FAST_MARCHING_POTENTIAL; k++)
+        potentialResidual[k] = 0.0;
 }
 
 Planning::~Planning()
-{}
+{
+    pthread_mutex_destroy(&pathMutex_);
+}
 
 void Planning::setGrid(Grid *g)
 {
     grid = g;
+    activeCellsStale_ = true;
 }
 
 void Planning::setMaxUpdateRange(int r)
@@ -45,29 +82,131 @@ void Planning::setNewRobotPose(Pose p)
     newGridLimits.maxX = std::max(newGridLimits.maxX,newRobotPosition.x+maxUpdateRange);
     newGridLimits.minY = std::min(newGridLimits.minY,newRobotPosition.y-maxUpdateRange);
     newGridLimits.maxY = std::max(newGridLimits.maxY,newRobotPosition.y+maxUpdateRange);
+
+    newChangedLimits.minX = std::min(newChangedLimits.minX,newRobotPosition.x-maxUpdateRange);
+    newChangedLimits.maxX = std::max(newChangedLimits.maxX,newRobotPosition.x+maxUpdateRange);
+    newChangedLimits.minY = std::min(newChangedLimits.minY,newRobotPosition.y-maxUpdateRange);
+    newChangedLimits.maxY = std::max(newChangedLimits.maxY,newRobotPosition.y+maxUpdateRange);
+}
+
+void Planning::setMotionMode(MotionMode m)
+{
+    motionMode_ = m;
+}
+
+void Planning::setWaypoint(int x, int y)
+{
+    pthread_mutex_lock(&pathMutex_);
+    waypoint_.x = x;
+    waypoint_.y = y;
+    hasWaypoint_ = true;
+    pthread_mutex_unlock(&pathMutex_);
+}
+
+void Planning::clearWaypoint()
+{
+    pthread_mutex_lock(&pathMutex_);
+    hasWaypoint_ = false;
+    pthread_mutex_unlock(&pathMutex_);
+}
+
+void Planning::getPath(std::vector<point2d>& path)
+{
+    pthread_mutex_lock(&pathMutex_);
+    path = path_;
+    pthread_mutex_unlock(&pathMutex_);
 }
 
 void Planning::run()
 {
-    pthread_mutex_lock(grid->mutex);
+    TRACE_ZONE("Planning::run");
+    static MetricHistogram* planningLatency = Metrics::histogram("phir2_planning_seconds", "Duration of a planning cycle");
+    static MetricGauge* exploredCells = Metrics::gauge("phir2_explored_cells", "Cells classified as FREE or OCCUPIED");
+    static MetricGauge* numFrontiers = Metrics::gauge("phir2_frontiers", "Frontiers reachable from the robot");
+    static MetricGauge* activeCells = Metrics::gauge("phir2_active_cells", "FREE cells reachable from the robot, relaxed by the potential fields");
+    // pot[3] is solved exactly by fast marching, so only the relaxed fields have a residual
+    static MetricGauge* residuals[FAST_MARCHING_POTENTIAL] = {
+        Metrics::gauge("phir2_potential_residual", "Largest change of a potential in one more iteration", "field=\"0\""),
+        Metrics::gauge("phir2_potential_residual", "Largest change of a potential in one more iteration", "field=\"1\""),
+        Metrics::gauge("phir2_potential_residual", "Largest change of a potential in one more iteration", "field=\"2\"")};
+
+    Timer timer;
+
+    Trace::lockMutex(grid->mutex, "wait grid mutex", "hold grid mutex");
+
+    TraceZone stage("classify");
+    bbox changed = reclassifyCells();
+
+    // the path is only followed in FOLLOW_PATH, or planned to the operator's waypoint; otherwise
+    // the reclassified cells wait for the next update of the path costs
+    pthread_mutex_lock(&pathMutex_);
+    bool pathWanted = (motionMode_ == FOLLOW_PATH || hasWaypoint_);
+    pthread_mutex_unlock(&pathMutex_);
+
+    pendingCosts_.minX = std::min(pendingCosts_.minX, changed.minX);
+    pendingCosts_.maxX = std::max(pendingCosts_.maxX, changed.maxX);
+    pendingCosts_.minY = std::min(pendingCosts_.minY, changed.minY);
+    pendingCosts_.maxY = std::max(pendingCosts_.maxY, changed.maxY);
+    if(pathWanted){
+        stage.next("path costs");
+        pathPlanner.updateCosts(grid, gridLimits, pendingCosts_);
+        pendingCosts_.minX = pendingCosts_.minY = 1000;
+        pendingCosts_.maxX = pendingCosts_.maxY = -1000;
+    }
+    stage.end();
 
-    resetCellsTypes();
+    if(Metrics::isEnabled())
+        exploredCells->set(grid->countCells(FREE) + grid->countCells(OCCUPIED));
 
-    // update robot position and grid limits using last position informed by the robot
-    robotPosition = newRobotPosition;
-    gridLimits = newGridLimits;
+    Trace::unlockMutex(grid->mutex);
 
-    updateCellsTypes();
+    stage.next("frontiers");
+    detectFrontiers();
+    numFrontiers->set(frontiers.size());
+
+    if(pathWanted){
+        stage.next("path");
+        planPath();
+    }else{
+        pthread_mutex_lock(&pathMutex_);
+        path_.clear();
+        pathStatus = PathPlanner::NO_PATH;
+        pthread_mutex_unlock(&pathMutex_);
+    }
 
-    pthread_mutex_unlock(grid->mutex);
+    stage.next("active cells");
+    updateActiveCells();
+    activeCells->set(numActiveCells_);
 
+    stage.next("initialize potentials");
     initializePotentials();
 
-    for(int i=0; i<100; i++){
+    // iterations are traced in batches of 10
+    for(int i=0; i<numPotentialIterations; i++){
+        if(i%10 == 0)
+            stage.next("iterate potentials x10");
         iteratePotentials();
     }
 
+    stage.next("gradient");
     updateGradient();
+
+    // the navigation function is only followed in POTFIELD_3 and drawn in its view mode
+    if(motionMode_ == POTFIELD_3 || grid->viewMode == grid->firstPotViewMode + FAST_MARCHING_POTENTIAL){
+        stage.next("fast marching");
+        computeFastMarching();
+        updateFastMarchingGradient();
+    }
+    stage.end();
+
+    planningTime = timer.getTotalTime();
+    planningLatency->record(planningTime);
+
+    if(Metrics::isEnabled()){
+        computeResiduals();
+        for(int k=0; k<FAST_MARCHING_POTENTIAL; k++)
+            residuals[k]->set(potentialResidual[k]);
+    }
 }
 
 /////////////////////////////////////////////
@@ -76,21 +215,49 @@ void Planning::run()
 ///                                       ///
 /////////////////////////////////////////////
 
-void Planning::resetCellsTypes()
+// Takes the robot position and grid limits last informed by the robot, and classifies the
+// cells again: all of them the first time or without incrementalClassification, else only
+// the cells the sensors reached since the last run, with the types they change 9 cells further
+// (NEAR_WALLS, then FRONTIER_NEAR_WALL). Returns the box classified.
+bbox Planning::reclassifyCells()
 {
-    for(int i=gridLimits.minX;i<=gridLimits.maxX;i++){
-        for(int j=gridLimits.minY;j<=gridLimits.maxY;j++){
+    if(!incrementalClassification || !classified_)
+        resetCellsTypes();
 
-            Cell* c = grid->getCell(i,j);
-            c->planType = REGULAR;
-        }
+    robotPosition = newRobotPosition;
+    gridLimits = newGridLimits;
+
+    bbox changed = gridLimits;
+    if(incrementalClassification && classified_){
+        changed.minX = std::max(gridLimits.minX, newChangedLimits.minX - 9);
+        changed.maxX = std::min(gridLimits.maxX, newChangedLimits.maxX + 9);
+        changed.minY = std::max(gridLimits.minY, newChangedLimits.minY - 9);
+        changed.maxY = std::min(gridLimits.maxY, newChangedLimits.maxY + 9);
     }
+    newChangedLimits.minX = newChangedLimits.minY = 1000;
+    newChangedLimits.maxX = newChangedLimits.maxY = -1000;
+    classified_ = true;
+    lastChanged_ = changed;
+
+    updateCellsTypes(changed);
+    return changed;
+}
+
+void Planning::resetCellsTypes()
+{
+    grid->forEachRow(gridLimits, [](Cell* c, int, int minX, int maxX){
+        for(int i=minX; i<=maxX; i++, c++)
+            c->planType = REGULAR;
+    });
 }
 
 void Planning::updateCellsTypes()
 {
-    Cell* c;
+    updateCellsTypes(gridLimits);
+}
 
+void Planning::updateCellsTypes(const bbox& limits)
+{
     // If you want to access all observed cells (since the start), use this range
     //
     //  (gridLimits.minX, gridLimits.maxY)  -------  (gridLimits.maxX, gridLimits.maxY)
@@ -114,73 +281,250 @@ void Planning::updateCellsTypes()
     // c->planType = FRONTIER_NEAR_WALL
 
 
-    for (int cellX = gridLimits.minX; cellX <= gridLimits.maxX; cellX++) {
-        for (int cellY = gridLimits.minY; cellY <= gridLimits.maxY; cellY++) {
-            Cell *cell = grid->getCell(cellX, cellY);
+    // the cells are visited row by row, and their neighbours read at fixed offsets (see Grid.h)
+    int stride = grid->getRowStride();
+
+    grid->forEachRow(limits, [&](Cell* cell, int cellY, int minX, int maxX){
+        for (int cellX = minX; cellX <= maxX; cellX++, cell++) {
+            CellOccType oldType = cell->occType;
 
             if (cell->himm <= 5) cell->occType = FREE;
             if (cell->himm >= 10) cell->occType = OCCUPIED;
-        }
-    }
 
-    
-    for (int cellX = gridLimits.minX; cellX <= gridLimits.maxX; cellX++) {
-        for (int cellY = gridLimits.minY; cellY <= gridLimits.maxY; cellY++) {
-            Cell *cell = grid->getCell(cellX, cellY);
+            if (cell->occType != oldType) {
+                grid->markDirty(cellX, cellY);
+                if (oldType == FREE || cell->occType == FREE) activeCellsStale_ = true;
+            }
+        }
+    });
 
+    // DANGER within 3 cells of a wall, else NEAR_WALLS within 8: the 17 rows read around each
+    // cell stay in cache over a tile
+    grid->forEachTileRow(limits, [&](Cell* cell, int, int minX, int maxX){
+        for (int cellX = minX; cellX <= maxX; cellX++, cell++) {
             cell->planType = REGULAR;
 
-            if (cell->occType == FREE) {
-                for (int x = cellX - 8; x <= cellX + 8; x++) {
-                    for (int y = cellY - 8; y <= cellY + 8; y++) {
-                        Cell *adjacentCell = grid->getCell(x, y);
+            if (cell->occType != FREE)
+                continue;
 
-                        if (adjacentCell->occType == OCCUPIED)
-                            cell->planType = NEAR_WALLS;
-                    }
-                }
+            for (int y = -3; y <= 3 && cell->planType == REGULAR; y++) {
+                Cell *row = cell + y*stride;
+                for (int x = -3; x <= 3; x++)
+                    if (row[x].occType == OCCUPIED)
+                        cell->planType = DANGER;
             }
 
-            if (cell->occType == FREE) {
-                for (int x = cellX - 3; x <= cellX + 3; x++) {
-                    for (int y = cellY - 3; y <= cellY + 3; y++) {
-                        Cell *adjacentCell = grid->getCell(x, y);
+            for (int y = -8; y <= 8 && cell->planType == REGULAR; y++) {
+                Cell *row = cell + y*stride;
+                for (int x = -8; x <= 8; x++)
+                    if (row[x].occType == OCCUPIED)
+                        cell->planType = NEAR_WALLS;
+            }
+        }
+    });
+
+    grid->forEachRow(limits, [&](Cell* cell, int, int minX, int maxX){
+        for (int cellX = minX; cellX <= maxX; cellX++, cell++) {
+            if (cell->occType != UNEXPLORED)
+                continue;
+
+            for (int y = -1; y <= 1; y++) {
+                Cell *row = cell + y*stride;
+                for (int x = -1; x <= 1; x++)
+                    if (row[x].occType == FREE)
+                        cell->planType = FRONTIER;
+            }
 
-                        if (adjacentCell->occType == OCCUPIED)
-                            cell->planType = DANGER;
-                    }
-                }
+            for (int y = -1; y <= 1; y++) {
+                Cell *row = cell + y*stride;
+                for (int x = -1; x <= 1; x++)
+                    if (row[x].planType == DANGER || row[x].planType == NEAR_WALLS)
+                        cell->planType = FRONTIER_NEAR_WALL;
             }
         }
+    });
+}
+
+//////////////////////////////
+///                        ///
+/// Frontier detection     ///
+///                        ///
+//////////////////////////////
+
+static bool isFrontierCell(Grid* grid, int x, int y)
+{
+    if(grid->getCell(x,y)->occType != UNEXPLORED)
+        return false;
+    for(int j=y-1; j<=y+1; j++)
+        for(int i=x-1; i<=x+1; i++)
+            if(grid->getCell(i,j)->occType == FREE)
+                return true;
+    return false;
+}
+
+// Wavefront frontier detection: a BFS from the robot through the FREE cells only, so just the
+// reachable part of the map is visited, in order of path distance. The first time the wave
+// touches a frontier cell, a second BFS over the frontier cells extracts its whole segment.
+//
+// Segments away from the cells reclassified by this run cannot have changed: they are kept
+// from the previous run and only get their new distance when the wave reaches them. A cell is
+// a frontier cell depending on the types around it, so the frontier cells change at most one
+// cell out of the reclassified box; a segment kept two cells out of it has no new neighbour
+// and is still whole.
+void Planning::detectFrontiers()
+{
+    int width = gridLimits.maxX - gridLimits.minX + 1;
+    int height = gridLimits.maxY - gridLimits.minY + 1;
+    int scale = grid->getMapScale();
+    bool hadTarget = (targetFrontier >= 0);
+    point2d lastTarget = hadTarget ? frontiers[targetFrontier].centroid : robotPosition;
+    targetFrontier = -1;
+    if(width <= 0 || height <= 0){
+        frontiers.clear();
+        return;
+    }
+    int n = width*height;
+
+    // only the cells set by the last run are cleared, unless gridLimits moved
+    std::vector<int>& label = frontierLabel_;
+    std::vector<int>& distance = frontierDistance_;
+    std::vector<int>& visited = frontierVisited_;
+    if(frontierLimits_.minX != gridLimits.minX || frontierLimits_.maxX != gridLimits.maxX ||
+       frontierLimits_.minY != gridLimits.minY || frontierLimits_.maxY != gridLimits.maxY){
+        label.assign(n, -1);
+        distance.assign(n, -1);
+        frontierLimits_ = gridLimits;
+    }else{
+        for(unsigned int v=0; v<visited.size(); v++)
+            label[visited[v]] = distance[visited[v]] = -1;
+    }
+    visited.clear();
+
+    std::vector<Frontier> segments;
+    for(unsigned int k=0; k<frontiers.size(); k++){
+        const Frontier& f = frontiers[k];
+        bool keep = true;
+        for(unsigned int c=0; c<f.cells.size() && keep; c++){
+            const point2d& p = f.cells[c];
+            keep = p.x < lastChanged_.minX-2 || p.x > lastChanged_.maxX+2 || p.y < lastChanged_.minY-2 || p.y > lastChanged_.maxY+2;
+        }
+        if(!keep)
+            continue;
+        for(unsigned int c=0; c<f.cells.size(); c++){
+            int q = (f.cells[c].y - gridLimits.minY)*width + f.cells[c].x - gridLimits.minX;
+            label[q] = segments.size();
+            visited.push_back(q);
+        }
+        segments.push_back(f);
+        segments.back().distance = -1.0;
     }
 
-    for (int cellX = gridLimits.minX; cellX <= gridLimits.maxX; cellX++) {
-        for (int cellY = gridLimits.minY; cellY <= gridLimits.maxY; cellY++) {
-            Cell *cell = grid->getCell(cellX, cellY);
+    std::queue<int> wave;
+    if(robotPosition.x >= gridLimits.minX && robotPosition.x <= gridLimits.maxX &&
+       robotPosition.y >= gridLimits.minY && robotPosition.y <= gridLimits.maxY){
+        int start = (robotPosition.y - gridLimits.minY)*width + robotPosition.x - gridLimits.minX;
+        distance[start] = 0;
+        visited.push_back(start);
+        wave.push(start);
+    }
 
-            if (cell->occType == UNEXPLORED) {
-                for (int x = cellX - 1; x <= cellX + 1; x++) {
-                    for (int y = cellY - 1; y <= cellY + 1; y++) {
-                        Cell *adjacentCell = grid->getCell(x, y);
+    while(!wave.empty()){
+        int p = wave.front();
+        wave.pop();
+        int x = gridLimits.minX + p % width, y = gridLimits.minY + p / width;
 
-                        if (adjacentCell->occType == FREE)
-                            cell->planType = FRONTIER;
+        for(int j=y-1; j<=y+1; j++)
+            for(int i=x-1; i<=x+1; i++){
+                if(i < gridLimits.minX || i > gridLimits.maxX || j < gridLimits.minY || j > gridLimits.maxY)
+                    continue;
+                int q = (j - gridLimits.minY)*width + i - gridLimits.minX;
+                Cell* c = grid->getCell(i,j);
+
+                // the wave moves in 4 directions, frontiers are touched in 8
+                if(c->occType == FREE && distance[q] < 0 && (i == x || j == y)){
+                    distance[q] = distance[p] + 1;
+                    visited.push_back(q);
+                    wave.push(q);
+                }
+                if(c->occType != UNEXPLORED)
+                    continue;
 
+                if(label[q] >= 0){
+                    Frontier& f = segments[label[q]];
+
+                    // the first cell reached is the nearest, but the robot does not fit in the DANGER ones
+                    if(f.distance < 0.0 || (grid->getCell(f.access.x,f.access.y)->planType == DANGER &&
+                                            grid->getCell(x,y)->planType != DANGER)){
+                        if(f.distance < 0.0)
+                            f.distance = (float)distance[p]/scale;
+                        f.access.x = x;
+                        f.access.y = y;
+                        f.nearest.x = i;
+                        f.nearest.y = j;
                     }
+                    continue;
                 }
+                if(!isFrontierCell(grid, i, j))
+                    continue;
 
-                for (int x = cellX - 1; x <= cellX + 1; x++) {
-                    for (int y = cellY - 1; y <= cellY + 1; y++) {
-                        Cell *adjacentCell = grid->getCell(x, y);
-
-                        if (adjacentCell->planType == DANGER || adjacentCell->planType == NEAR_WALLS)
-                            cell->planType = FRONTIER_NEAR_WALL;
-                    }
+                Frontier f;
+                f.distance = (float)distance[p]/scale;
+                f.access.x = x;
+                f.access.y = y;
+                f.nearest.x = i;
+                f.nearest.y = j;
+                std::queue<point2d> segment;
+                label[q] = segments.size();
+                visited.push_back(q);
+                segment.push({i,j});
+                while(!segment.empty()){
+                    point2d s = segment.front();
+                    segment.pop();
+                    f.cells.push_back(s);
+                    for(int v=s.y-1; v<=s.y+1; v++)
+                        for(int u=s.x-1; u<=s.x+1; u++){
+                            if(u < gridLimits.minX || u > gridLimits.maxX || v < gridLimits.minY || v > gridLimits.maxY)
+                                continue;
+                            int r = (v - gridLimits.minY)*width + u - gridLimits.minX;
+                            if(label[r] < 0 && isFrontierCell(grid, u, v)){
+                                label[r] = segments.size();
+                                visited.push_back(r);
+                                segment.push({u,v});
+                            }
+                        }
                 }
+                segments.push_back(f);
             }
-        }
     }
 
+    // unreached and small segments are dropped, the others ranked
+    frontiers.clear();
+    float bestScore = -FLT_MAX;
+    for(unsigned int k=0; k<segments.size(); k++){
+        Frontier& f = segments[k];
+        if(f.distance < 0.0 || (int)f.cells.size() < minFrontierSize)
+            continue;
+
+        long sumX = 0, sumY = 0;
+        for(unsigned int c=0; c<f.cells.size(); c++){
+            sumX += f.cells[c].x;
+            sumY += f.cells[c].y;
+        }
+        f.centroid.x = sumX/(long)f.cells.size();
+        f.centroid.y = sumY/(long)f.cells.size();
+
+        // the segment where the last target was stays the target unless another one is clearly better
+        f.score = frontierSizeWeight*f.cells.size()/scale - f.distance;
+        if(hadTarget && abs(f.centroid.x - lastTarget.x) + abs(f.centroid.y - lastTarget.y) <= scale)
+            f.score += frontierHysteresis;
+
+        // a frontier only reached along the walls is no target, the robot would not fit
+        if(f.score > bestScore && grid->getCell(f.access.x,f.access.y)->planType != DANGER){
+            bestScore = f.score;
+            targetFrontier = frontiers.size();
+        }
+        frontiers.push_back(f);
+    }
 }
 
 void Planning::initializePotentials()
@@ -198,9 +542,8 @@ void Planning::initializePotentials()
     //                  |                       \                    |
     //  (gridLimits.minX, gridLimits.minY)  -------  (gridLimits.maxX, gridLimits.minY)
 
-    for (int cellX = gridLimits.minX; cellX <= gridLimits.maxX; cellX++) {
-        for (int cellY = gridLimits.minY; cellY <= gridLimits.maxY; cellY++) {
-            Cell *cell = grid->getCell(cellX, cellY);
+    grid->forEachRow(gridLimits, [&](Cell* cell, int, int minX, int maxX){
+        for (int cellX = minX; cellX <= maxX; cellX++, cell++) {
 
             // Harmonic fields
             if (cell->occType == OCCUPIED) {
@@ -220,8 +563,6 @@ void Planning::initializePotentials()
             }
 
             // With preference
-            float preference = 0.3;
-
             if (cell->occType == FREE) {
                 if (cell->planType == NEAR_WALLS) {
                     cell->pref = preference;
@@ -263,48 +604,150 @@ void Planning::initializePotentials()
                 }
             }
         }
-    }
+    });
 }
 
-void Planning::iteratePotentials()
+// The harmonic fields are only relaxed over the robot's side of the map: the FREE cells reached
+// from its cell through FREE cells, the way the frontiers are found. The other FREE cells keep
+// their potentials and lose their gradient. The cells are kept as the runs they form in each row,
+// in the order of the grid's memory (rows from top to bottom, cells from left to right), so the
+// kernels stream along the rows instead of testing every cell of gridLimits.
+// The cells only change with the FREE cells, gridLimits and the robot's component, so the last
+// search is kept while the robot stays on its cells.
+void Planning::updateActiveCells()
 {
-    // the update of a FREE cell in position (i,j) will use the potential of the four adjacent cells
-    // where, for example:
-    //     left  = grid->getCell(i-1,j);
-
-
-    // TODO: iterate the potential field in the known map
-    //
-    //  (gridLimits.minX, gridLimits.maxY)  -------  (gridLimits.maxX, gridLimits.maxY)
-    //                  |                     \                      |
-    //                  |                      \                     |
-    //                  |                       \                    |
-    //  (gridLimits.minX, gridLimits.minY)  -------  (gridLimits.maxX, gridLimits.minY)
+    int width = gridLimits.maxX - gridLimits.minX + 1;
+    int height = gridLimits.maxY - gridLimits.minY + 1;
+
+    bool sameLimits = activeLimits_.minX == gridLimits.minX && activeLimits_.maxX == gridLimits.maxX &&
+                      activeLimits_.minY == gridLimits.minY && activeLimits_.maxY == gridLimits.maxY;
+    if(!activeCellsStale_ && sameLimits){
+        auto marked = [&](const point2d& p){
+            return p.x >= gridLimits.minX && p.x <= gridLimits.maxX && p.y >= gridLimits.minY && p.y <= gridLimits.maxY &&
+                   activeMarks_[(p.y - gridLimits.minY)*width + p.x - gridLimits.minX];
+        };
+        if(robotPosition.x == activeStart_.x && robotPosition.y == activeStart_.y)
+            return;
+        // from one FREE cell of the component to another (a blocked start also reaches its neighbours)
+        if(marked(activeStart_) && marked(robotPosition)){
+            activeStart_ = robotPosition;
+            return;
+        }
+    }
+    activeCellsStale_ = false;
+    activeLimits_ = gridLimits;
+    activeStart_ = robotPosition;
 
-    // Harmonic
-    for (int cellX = gridLimits.minX; cellX <= gridLimits.maxX; cellX++) {
-        for (int cellY = gridLimits.minY; cellY <= gridLimits.maxY; cellY++) {
-            Cell *cell = grid->getCell(cellX, cellY);
-            if (cell->occType == FREE) {
+    activeSpans_.clear();
+    numActiveCells_ = 0;
 
-                // Harmonic fields
-                cell->pot[0] = (grid->getCell(cellX - 1, cellY)->pot[0] + grid->getCell(cellX, cellY - 1)->pot[0] +
-                            grid->getCell(cellX + 1, cellY)->pot[0] + grid->getCell(cellX, cellY + 1)->pot[0]) / 4;
+    if(width <= 0 || height <= 0){
+        activeMarks_.clear();
+        return;
+    }
+    // assign() keeps the buffer while gridLimits keeps its size
+    activeMarks_.assign(width*height, 0);
+
+    // the robot's cell starts the search even when it is not FREE
+    if(robotPosition.x < gridLimits.minX || robotPosition.x > gridLimits.maxX ||
+       robotPosition.y < gridLimits.minY || robotPosition.y > gridLimits.maxY)
+        return;
+    int start = (robotPosition.y - gridLimits.minY)*width + robotPosition.x - gridLimits.minX;
+    std::vector<int> stack(1, start);
+    activeMarks_[start] = 1;
+
+    while(!stack.empty()){
+        int p = stack.back();
+        stack.pop_back();
+        int x = gridLimits.minX + p % width, y = gridLimits.minY + p / width;
+        int neighbors[4][2] = {{x-1,y}, {x+1,y}, {x,y-1}, {x,y+1}};
+        for(int k=0; k<4; k++){
+            int i = neighbors[k][0], j = neighbors[k][1];
+            if(i < gridLimits.minX || i > gridLimits.maxX || j < gridLimits.minY || j > gridLimits.maxY)
+                continue;
+            int q = (j - gridLimits.minY)*width + i - gridLimits.minX;
+            if(activeMarks_[q] == 0 && grid->getCell(i,j)->occType == FREE){
+                activeMarks_[q] = 1;
+                stack.push_back(q);
+            }
+        }
+    }
+    if(grid->getCell(robotPosition.x, robotPosition.y)->occType != FREE)
+        activeMarks_[start] = 0;
+
+    for(int y=gridLimits.maxY; y>=gridLimits.minY; y--){
+        const unsigned char* row = &activeMarks_[(y - gridLimits.minY)*width];
+        for(int i=0; i<width; i++){
+            if(!row[i])
+                continue;
+            CellSpan span;
+            span.y = y;
+            span.minX = gridLimits.minX + i;
+            while(i+1 < width && row[i+1])
+                i++;
+            span.maxX = gridLimits.minX + i;
+            numActiveCells_ += span.maxX - span.minX + 1;
+            activeSpans_.push_back(span);
+        }
+    }
+}
 
+void Planning::iteratePotentials()
+{
+    // the update of a FREE cell in position (i,j) will use the potential of the four adjacent cells,
+    // in place (Gauss-Seidel), over the active cells only (see updateActiveCells()): the cells of a
+    // row are consecutive in the grid, so a span walks its row and the rows above and below together
+    int stride = grid->getRowStride();
+    for (unsigned int s = 0; s < activeSpans_.size(); s++) {
+        const CellSpan& span = activeSpans_[s];
+        Cell *cell = grid->getCell(span.minX, span.y);
+
+        for (int cellX = span.minX; cellX <= span.maxX; cellX++, cell++) {
+            Cell *left = cell - 1;
+            Cell *right = cell + 1;
+            Cell *up = cell - stride;
+            Cell *down = cell + stride;
 
-                // With preference
-                float h = (grid->getCell(cellX - 1, cellY)->pot[1] + grid->getCell(cellX, cellY - 1)->pot[1] +
-                            grid->getCell(cellX + 1, cellY)->pot[1] + grid->getCell(cellX, cellY + 1)->pot[1]) / 4;
+            // Harmonic fields
+            cell->pot[0] = (left->pot[0] + down->pot[0] + right->pot[0] + up->pot[0]) / 4;
 
-                float d = fabs((grid->getCell(cellX, cellY + 1)->pot[1] - grid->getCell(cellX, cellY - 1)->pot[1]) / 2) +
-                        fabs((grid->getCell(cellX + 1, cellY)->pot[1] - grid->getCell(cellX - 1, cellY)->pot[1]) / 2);
+            // With preference
+            float h = (left->pot[1] + down->pot[1] + right->pot[1] + up->pot[1]) / 4;
+            float d = fabs((up->pot[1] - down->pot[1]) / 2) + fabs((right->pot[1] - left->pot[1]) / 2);
+            cell->pot[1] = h - cell->pref / 4 * d;
 
-                cell->pot[1] = h - cell->pref / 4 * d;
+            // Objetivos Dinâmicos
+            cell->pot[2] = (left->pot[2] + down->pot[2] + right->pot[2] + up->pot[2]) / 4;
+        }
+    }
+}
 
-                // Objetivos Dinâmicos
-                cell->pot[2] = (grid->getCell(cellX - 1, cellY)->pot[2] + grid->getCell(cellX, cellY - 1)->pot[2] +
-                                grid->getCell(cellX + 1, cellY)->pot[2] + grid->getCell(cellX, cellY + 1)->pot[2]) / 4;
-            }
+void Planning::computeResiduals()
+{
+    for(int k=0; k<FAST_MARCHING_POTENTIAL; k++)
+        potentialResidual[k] = 0.0;
+
+    // same updates as iteratePotentials(), without writing them
+    int stride = grid->getRowStride();
+    for (unsigned int s = 0; s < activeSpans_.size(); s++) {
+        const CellSpan& span = activeSpans_[s];
+        Cell *cell = grid->getCell(span.minX, span.y);
+
+        for (int cellX = span.minX; cellX <= span.maxX; cellX++, cell++) {
+            Cell *left = cell - 1;
+            Cell *right = cell + 1;
+            Cell *up = cell - stride;
+            Cell *down = cell + stride;
+
+            float next[FAST_MARCHING_POTENTIAL];
+            next[0] = (left->pot[0] + down->pot[0] + right->pot[0] + up->pot[0]) / 4;
+            float h = (left->pot[1] + down->pot[1] + right->pot[1] + up->pot[1]) / 4;
+            float d = fabs((up->pot[1] - down->pot[1]) / 2) + fabs((right->pot[1] - left->pot[1]) / 2);
+            next[1] = h - cell->pref / 4 * d;
+            next[2] = (left->pot[2] + down->pot[2] + right->pot[2] + up->pot[2]) / 4;
+
+            for(int k=0; k<FAST_MARCHING_POTENTIAL; k++)
+                potentialResidual[k] = std::max(potentialResidual[k], (float)fabs(next[k] - cell->pot[k]));
         }
     }
 }
@@ -314,36 +757,22 @@ void Planning::updateGradient()
     // the components of the descent gradient of a cell are stored in:
     // c->dirX[i] and c->dirY[i], for pot[i]
 
-    Cell *left,*right,*up,*down;
-
-    // the gradient of a FREE cell in position (i,j) is computed using the potential of the four adjacent cells
-    // where, for example:
-    //     left  = grid->getCell(i-1,j);
+    // the gradient of an active cell in position (i,j) is computed using the potential of the four
+    // adjacent cells, span by span as in iteratePotentials()
+    int stride = grid->getRowStride();
+    for (unsigned int s = 0; s < activeSpans_.size(); s++) {
+        const CellSpan& span = activeSpans_[s];
+        Cell *cell = grid->getCell(span.minX, span.y);
 
+        for (int cellX = span.minX; cellX <= span.maxX; cellX++, cell++) {
+            Cell *left = cell - 1;
+            Cell *right = cell + 1;
+            Cell *up = cell - stride;
+            Cell *down = cell + stride;
 
-    // TODO: compute the gradient of the FREE cells in the known map
-    //
-    //  (gridLimits.minX, gridLimits.maxY)  -------  (gridLimits.maxX, gridLimits.maxY)
-    //                  |                     \                      |
-    //                  |                      \                     |
-    //                  |                       \                    |
-    //  (gridLimits.minX, gridLimits.minY)  -------  (gridLimits.maxX, gridLimits.minY)
-
-
-    // Harmonic
-    for (int cellX = gridLimits.minX; cellX <= gridLimits.maxX; cellX++) {
-        for (int cellY = gridLimits.minY; cellY <= gridLimits.maxY; cellY++) {
-            for (int i = 0; i <= 2; i++) {
-                Cell *cell = grid->getCell(cellX, cellY);
-
-                if (cell->occType != FREE) {
-                    cell->dirX[i] = 0;
-                    cell->dirY[i] = 0;
-                    continue;
-                }
-
-                cell->dirX[i] = -(grid->getCell(cellX + 1, cellY)->pot[i] - grid->getCell(cellX - 1, cellY)->pot[i]) / 2;
-                cell->dirY[i] = -(grid->getCell(cellX, cellY + 1)->pot[i] - grid->getCell(cellX, cellY - 1)->pot[i]) / 2;
+            for (int i = 0; i < FAST_MARCHING_POTENTIAL; i++) {
+                cell->dirX[i] = -(right->pot[i] - left->pot[i]) / 2;
+                cell->dirY[i] = -(up->pot[i] - down->pot[i]) / 2;
 
                 float norm = sqrt(pow(cell->dirX[i], 2) + pow(cell->dirY[i], 2));
                 if (norm != 0) {
@@ -353,5 +782,271 @@ void Planning::updateGradient()
             }
         }
     }
+
+    // the cells that had a gradient and are no longer active lose it, after the new ones are
+    // written so that the robot never reads a null gradient where there is one
+    int width = gridLimits.maxX - gridLimits.minX + 1;
+    for (unsigned int s = 0; s < gradientSpans_.size(); s++) {
+        const CellSpan& span = gradientSpans_[s];
+        Cell *cell = grid->getCell(span.minX, span.y);
+        for (int cellX = span.minX; cellX <= span.maxX; cellX++, cell++) {
+            if (cellX >= gridLimits.minX && cellX <= gridLimits.maxX && span.y >= gridLimits.minY && span.y <= gridLimits.maxY &&
+                activeMarks_[(span.y - gridLimits.minY)*width + cellX - gridLimits.minX])
+                continue;
+            for (int i = 0; i < FAST_MARCHING_POTENTIAL; i++) {
+                cell->dirX[i] = 0;
+                cell->dirY[i] = 0;
+            }
+        }
+    }
+    gradientSpans_ = activeSpans_;
+}
+
+//////////////////////////////////////////
+///                                    ///
+/// Navigation function: Fast Marching ///
+///                                    ///
+//////////////////////////////////////////
+
+// Arrival time of a front leaving the frontiers over the FREE cells, in a single pass: the
+// solution of the Eikonal equation |grad T| = cost, with a cost that grows next to the walls.
+// Cells are accepted in order of arrival (binary heap), so every reached cell has a neighbor
+// that arrived strictly earlier and its gradient is never flat, however far the frontier is.
+void Planning::computeFastMarching()
+{
+    const float INF = FLT_MAX;
+    int width = gridLimits.maxX - gridLimits.minX + 1;
+    int height = gridLimits.maxY - gridLimits.minY + 1;
+    if(width <= 0 || height <= 0)
+        return;
+    int n = width*height;
+
+    // distance to the nearest OCCUPIED cell, 3-4 chamfer in two passes (in thirds of a cell)
+    obstacleDistance_.assign(n, INF);
+    grid->forEachRow(gridLimits, [&](Cell* c, int y, int minX, int maxX){
+        float* row = &obstacleDistance_[(y - gridLimits.minY)*width];
+        for(int i=0; i<=maxX-minX; i++, c++)
+            if(c->occType == OCCUPIED)
+                row[i] = 0.0;
+    });
+
+    std::vector<float>& d = obstacleDistance_;
+    for(int j=0; j<height; j++)
+        for(int i=0; i<width; i++){
+            float& c = d[j*width+i];
+            if(i > 0)                   c = std::min(c, d[j*width+i-1] + 3);
+            if(j > 0)                   c = std::min(c, d[(j-1)*width+i] + 3);
+            if(i > 0 && j > 0)          c = std::min(c, d[(j-1)*width+i-1] + 4);
+            if(i < width-1 && j > 0)    c = std::min(c, d[(j-1)*width+i+1] + 4);
+        }
+    for(int j=height-1; j>=0; j--)
+        for(int i=width-1; i>=0; i--){
+            float& c = d[j*width+i];
+            if(i < width-1)                 c = std::min(c, d[j*width+i+1] + 3);
+            if(j < height-1)                c = std::min(c, d[(j+1)*width+i] + 3);
+            if(i < width-1 && j < height-1) c = std::min(c, d[(j+1)*width+i+1] + 4);
+            if(i > 0 && j < height-1)       c = std::min(c, d[(j+1)*width+i-1] + 4);
+        }
+
+    // frontiers (or just the target one) start the front, the FREE cells carry it
+    bool toTarget = fastMarchingToTarget && targetFrontier >= 0;
+    std::vector<float>& T = arrivalTime_;
+    T.assign(n, INF);
+    std::vector<unsigned char> accepted(n, 0), passable(n, 0), danger(n, 0);
+    typedef std::pair<float,int> Trial;
+    std::priority_queue<Trial, std::vector<Trial>, std::greater<Trial> > front;
+    grid->forEachRow(gridLimits, [&](Cell* c, int y, int minX, int maxX){
+        int p = (y - gridLimits.minY)*width;
+        for(int i=0; i<=maxX-minX; i++, c++, p++){
+            if(c->occType == FREE){
+                passable[p] = 1;
+                danger[p] = (c->planType == DANGER);
+            }else if(!toTarget && (c->planType == FRONTIER || c->planType == FRONTIER_NEAR_WALL)){
+                T[p] = 0.0;
+                front.push(Trial(0.0, p));
+            }
+        }
+    });
+    if(toTarget){
+        const std::vector<point2d>& cells = frontiers[targetFrontier].cells;
+        for(unsigned int k=0; k<cells.size(); k++){
+            int p = (cells[k].y - gridLimits.minY)*width + cells[k].x - gridLimits.minX;
+            T[p] = 0.0;
+            front.push(Trial(0.0, p));
+        }
+    }
+
+    int dx[4] = {-1, 1, 0, 0}, dy[4] = {0, 0, -1, 1};
+    while(!front.empty()){
+        Trial t = front.top();
+        front.pop();
+        int p = t.second;
+        if(accepted[p] || t.first > T[p])
+            continue;
+        accepted[p] = 1;
+
+        int i = p % width, j = p / width;
+        for(int k=0; k<4; k++){
+            int ni = i+dx[k], nj = j+dy[k];
+            if(ni < 0 || nj < 0 || ni >= width || nj >= height)
+                continue;
+            int q = nj*width + ni;
+            if(accepted[q] || !passable[q])
+                continue;
+
+            // upwind: the earliest accepted neighbor on each axis
+            float a = INF, b = INF;
+            if(ni > 0 && accepted[q-1])           a = T[q-1];
+            if(ni < width-1 && accepted[q+1])     a = std::min(a, T[q+1]);
+            if(nj > 0 && accepted[q-width])       b = T[q-width];
+            if(nj < height-1 && accepted[q+width]) b = std::min(b, T[q+width]);
+
+            // the robot does not fit in the DANGER cells, they are only crossed to leave them
+            float s = 1.0 - d[q]/(3.0*fastMarchingObstacleRange);
+            float f = 1.0 + (s > 0.0 ? fastMarchingObstacleCost*s*s : 0.0);
+            if(danger[q])
+                f = fastMarchingDangerCost;
+
+            float value;
+            if(fabs(a - b) >= f)
+                value = std::min(a, b) + f;
+            else
+                value = (a + b + sqrt(2*f*f - (a-b)*(a-b)))/2;
+
+            if(value < T[q]){
+                T[q] = value;
+                front.push(Trial(value, q));
+            }
+        }
+    }
+
+    // pot[3] in [0,1) where the front arrived, 1 elsewhere
+    float maxT = 0.0;
+    for(int p=0; p<n; p++)
+        if(T[p] < INF)
+            maxT = std::max(maxT, T[p]);
+    grid->forEachRow(gridLimits, [&](Cell* c, int y, int minX, int maxX){
+        const float* row = &T[(y - gridLimits.minY)*width];
+        for(int i=0; i<=maxX-minX; i++, c++)
+            c->pot[FAST_MARCHING_POTENTIAL] = (row[i] < INF) ? row[i]/(maxT+1.0) : 1.0;
+    });
 }
 
+// Descent direction towards the earlier neighbor of each axis, one-sided so the walls and the
+// unreached cells (at infinity) do not enter the difference
+void Planning::updateFastMarchingGradient()
+{
+    const float INF = FLT_MAX;
+    int width = gridLimits.maxX - gridLimits.minX + 1;
+    int height = gridLimits.maxY - gridLimits.minY + 1;
+    if(width <= 0 || height <= 0 || (int)arrivalTime_.size() != width*height)
+        return;
+    const std::vector<float>& T = arrivalTime_;
+    int k = FAST_MARCHING_POTENTIAL;
+
+    grid->forEachRow(gridLimits, [&](Cell* cell, int y, int minX, int maxX){
+        int j = y - gridLimits.minY;
+        for(int i=0; i<=maxX-minX; i++, cell++){
+            cell->dirX[k] = cell->dirY[k] = 0.0;
+            float t = T[j*width+i];
+            if(cell->occType != FREE || t == INF)
+                continue;
+
+            float left = (i > 0) ? T[j*width+i-1] : INF, right = (i < width-1) ? T[j*width+i+1] : INF;
+            float down = (j > 0) ? T[(j-1)*width+i] : INF, up = (j < height-1) ? T[(j+1)*width+i] : INF;
+            if(std::min(left, right) < t)
+                cell->dirX[k] = (left < right) ? -(t - left) : (t - right);
+            if(std::min(down, up) < t)
+                cell->dirY[k] = (down < up) ? -(t - down) : (t - up);
+
+            float norm = sqrt(pow(cell->dirX[k], 2) + pow(cell->dirY[k], 2));
+            if(norm != 0){
+                cell->dirX[k] /= norm;
+                cell->dirY[k] /= norm;
+            }
+        }
+    });
+}
+
+/////////////////////////
+///                   ///
+/// Path planning     ///
+///                   ///
+/////////////////////////
+
+// Path to the operator's waypoint or, without one, to the cell of the target frontier closest to
+// the robot (through its access cell, as the frontier may only touch the FREE cells by a corner).
+// The waypoint is dropped once the robot is next to it.
+void Planning::planPath()
+{
+    static MetricHistogram* latency = Metrics::histogram("phir2_path_planning_seconds", "Duration of a path query");
+
+    pthread_mutex_lock(&pathMutex_);
+    if(hasWaypoint_ && abs(waypoint_.x - robotPosition.x) <= 1 && abs(waypoint_.y - robotPosition.y) <= 1)
+        hasWaypoint_ = false;
+    bool toWaypoint = hasWaypoint_;
+    point2d goal = waypoint_;
+    pthread_mutex_unlock(&pathMutex_);
+
+    point2d last = {UNDEF, UNDEF};
+    if(!toWaypoint && targetFrontier >= 0){
+        goal = frontiers[targetFrontier].access;
+        last = frontiers[targetFrontier].nearest;
+
+        // D* Lite keeps its tree while the goal stays: the last goal is kept as long as it is still
+        // a way into the target frontier
+        if(pathPlanner.algorithm == PathPlanner::D_STAR_LITE && hadFrontierGoal_){
+            Cell* c = grid->getCell(frontierGoal_.x, frontierGoal_.y);
+            const std::vector<point2d>& cells = frontiers[targetFrontier].cells;
+            for(unsigned int i=0; i<cells.size() && c->occType == FREE && c->planType != DANGER; i++)
+                if(abs(cells[i].x - frontierGoal_.x) <= 1 && abs(cells[i].y - frontierGoal_.y) <= 1){
+                    goal = frontierGoal_;
+                    last = cells[i];
+                    break;
+                }
+        }
+    }
+    hadFrontierGoal_ = (!toWaypoint && targetFrontier >= 0);
+    frontierGoal_ = goal;
+
+    newPath_.clear();
+    pathStatus = PathPlanner::NO_PATH;
+    if((toWaypoint && grid->getCell(goal.x,goal.y)->occType != OCCUPIED) || (!toWaypoint && targetFrontier >= 0)){
+        pathStatus = pathPlanner.findPath(robotPosition, goal, newPath_);
+        latency->record(pathPlanner.getLastTime());
+
+        // last step into the frontier, so that the robot ends up facing it
+        if(!toWaypoint && pathStatus == PathPlanner::FOUND)
+            newPath_.push_back(last);
+    }
+
+    pthread_mutex_lock(&pathMutex_);
+    path_.swap(newPath_);
+    pthread_mutex_unlock(&pathMutex_);
+}
+
+#ifndef HEADLESS
+void Planning::drawPath()
+{
+    pthread_mutex_lock(&pathMutex_);
+    if(path_.size() > 1){
+        glLineWidth(2);
+        glColor3f(0.0,0.6,0.0);
+        glBegin( GL_LINE_STRIP );
+        for(unsigned int i=0; i<path_.size(); i++)
+            glVertex2f(path_[i].x+0.5, path_[i].y+0.5);
+        glEnd();
+        glLineWidth(1);
+    }
+    if(hasWaypoint_){
+        glColor3f(0.0,0.6,0.0);
+        glBegin( GL_QUADS );
+        glVertex2f(waypoint_.x-0.5, waypoint_.y-0.5);
+        glVertex2f(waypoint_.x+1.5, waypoint_.y-0.5);
+        glVertex2f(waypoint_.x+1.5, waypoint_.y+1.5);
+        glVertex2f(waypoint_.x-0.5, waypoint_.y+1.5);
+        glEnd();
+    }
+    pthread_mutex_unlock(&pathMutex_);
+}
+#endif
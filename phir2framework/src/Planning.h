@@ -5,18 +5,22 @@ class Planning;
 
 #include <pthread.h>
 #include <queue>
+#include <vector>
 #include "Robot.h"
 #include "Grid.h"
+#include "PathPlanner.h"
 
-typedef struct
+// Connected set of frontier cells (UNEXPLORED cells next to FREE ones) reachable by the robot
+class Frontier
 {
-    int x,y;
-} point2d;
-
-typedef struct
-{
-    int minX, maxX, minY, maxY;
-} bbox;
+    public:
+        std::vector<point2d> cells;
+        point2d centroid;   // mean of the cells
+        float distance;     // m, along the FREE cells from the robot to the nearest cell
+        point2d nearest;    // cell closest to the robot, out of the DANGER cells if possible
+        point2d access;     // FREE cell next to it, on the way from the robot
+        float score;        // see Planning::frontierSizeWeight
+};
 
 
 class Planning {
@@ -29,33 +33,119 @@ class Planning {
         void initialize();
 
         void setNewRobotPose(Pose p);
+        // the stages only used by the controller of a mode are skipped in the other modes
+        void setMotionMode(MotionMode m);
         void setGrid(Grid* g);
         void setMaxUpdateRange(int r);
 
         void drawRoadmap();
+#ifndef HEADLESS
+        void drawPath();
+#endif
+
+        // Goal set by the operator, in cells; without one the path leads to the target frontier
+        void setWaypoint(int x, int y);
+        void clearWaypoint();
+
+        // Copy of the path found by the last run(), from the robot's cell (empty when there is none)
+        void getPath(std::vector<point2d>& path);
 
         Grid* grid;
 
-	private:
+        // Parameters
+        float preference;
+        int numPotentialIterations;
+        float fastMarchingObstacleCost;  // extra cost of a step next to an obstacle
+        float fastMarchingObstacleRange; // cells, distance at which the extra cost vanishes
+        float fastMarchingDangerCost;    // cost of a step in a DANGER cell
+        bool fastMarchingToTarget;       // the navigation function leads to the target frontier only
+
+        int minFrontierSize;        // cells, smaller frontiers are noise
+        float frontierSizeWeight;   // score = weight*size (m) - distance (m)
+        float frontierHysteresis;   // score bonus of the frontier where the last target was
+        bool incrementalClassification; // reclassify only around the robot's latest positions
+
+        // Frontiers found by the last run() and the best of them (-1 when there is none)
+        std::vector<Frontier> frontiers;
+        int targetFrontier;
 
+        // Point-to-point planner, its parameters and the outcome of the last query
+        PathPlanner pathPlanner;
+        PathPlanner::Status pathStatus;
+
+        // Duration of the last run(), in seconds
+        float planningTime;
+
+        // Largest change that one more iteration would make to each relaxed potential field
+        // (only computed while the metrics server is running)
+        float potentialResidual[FAST_MARCHING_POTENTIAL];
+
+	protected:
+
+        bbox reclassifyCells();
         void resetCellsTypes();
         void updateCellsTypes();
+        void updateCellsTypes(const bbox& limits);
         void expandObstacles();
         void detectFrontiers();
 
+        void updateActiveCells();
         void initializePotentials();
         void iteratePotentials();
         void iterateDistortedPotentials();
 
         void updateGradient();
+        void computeResiduals();
+
+        void computeFastMarching();
+        void updateFastMarchingGradient();
+
+        void planPath();
 
         point2d robotPosition;
         bbox gridLimits;
 
         point2d newRobotPosition;
         bbox newGridLimits;
+        bbox newChangedLimits; // reached by the sensors since the last run()
+        bool classified_;
+        bbox lastChanged_;     // cells reclassified by the last run()
+        bbox pendingCosts_;    // cells reclassified since the path costs were last updated
 
         int maxUpdateRange;
+        MotionMode motionMode_;
+
+        // Frontier detection buffers, over gridLimits: segment of each frontier cell and
+        // distance of each FREE cell from the robot, -1 for none
+        std::vector<int> frontierLabel_, frontierDistance_;
+        // cells set in them by the last detectFrontiers(), reset by the next one, and the box
+        // they are laid out over
+        std::vector<int> frontierVisited_;
+        bbox frontierLimits_;
+
+        // FREE cells reached from the robot through FREE cells (as the frontiers), row by row in
+        // memory order, marked over gridLimits; the cells given a gradient by the last updateGradient()
+        std::vector<CellSpan> activeSpans_, gradientSpans_;
+        std::vector<unsigned char> activeMarks_;
+        int numActiveCells_;
+        // the search is repeated only when a cell became or stopped being FREE, gridLimits moved,
+        // or the robot left the marked cells
+        bool activeCellsStale_;
+        bbox activeLimits_;
+        point2d activeStart_;
+
+        // Fast Marching buffers, over gridLimits
+        std::vector<float> obstacleDistance_, arrivalTime_;
+
+        // waypoint and path, shared with the robot and GUI threads under pathMutex_
+        point2d waypoint_;
+        bool hasWaypoint_;
+        std::vector<point2d> path_, newPath_;
+        pthread_mutex_t pathMutex_;
+
+        // goal of the last path to a frontier
+        point2d frontierGoal_;
+        bool hadFrontierGoal_;
 
 };
 
@@ -0,0 +1,270 @@
+#include "PoseGraph.h"
+
+#include <algorithm>
+#include <cmath>
+
+///////////////////////////
+///// SPARSE CHOLESKY /////
+///////////////////////////
+
+void SparseCholesky::initialize(const std::vector<int>& firstColumn)
+{
+    first_ = firstColumn;
+    offset_.resize(first_.size());
+    int size = 0;
+    for(unsigned int i=0; i<first_.size(); i++){
+        offset_[i] = size;
+        size += i - first_[i] + 1;
+    }
+    values_.assign(size, 0.0);
+}
+
+void SparseCholesky::add(int i, int j, double value)
+{
+    at(i,j) += value;
+}
+
+double SparseCholesky::get(int i, int j) const
+{
+    if(j > i)
+        std::swap(i,j);
+    return (j < first_[i]) ? 0.0 : at(i,j);
+}
+
+// Row by row: L(i,j) only needs the rows above, over the columns both rows have
+bool SparseCholesky::factorize()
+{
+    int n = first_.size();
+    for(int i=0; i<n; i++){
+        for(int j=first_[i]; j<=i; j++){
+            double s = at(i,j);
+            const double* li = &values_[offset_[i] - first_[i]];
+            const double* lj = &values_[offset_[j] - first_[j]];
+            for(int k=std::max(first_[i], first_[j]); k<j; k++)
+                s -= li[k]*lj[k];
+
+            if(j < i)
+                at(i,j) = s/at(j,j);
+            else if(s <= 0.0)
+                return false;
+            else
+                at(i,i) = sqrt(s);
+        }
+    }
+    return true;
+}
+
+void SparseCholesky::solve(std::vector<double>& b) const
+{
+    int n = first_.size();
+
+    // L*y = b
+    for(int i=0; i<n; i++){
+        double s = b[i];
+        for(int k=first_[i]; k<i; k++)
+            s -= at(i,k)*b[k];
+        b[i] = s/at(i,i);
+    }
+    // L^T*x = y, subtracting each solved x from the rows above
+    for(int i=n-1; i>=0; i--){
+        b[i] /= at(i,i);
+        for(int k=first_[i]; k<i; k++)
+            b[k] -= at(i,k)*b[i];
+    }
+}
+
+//////////////////////
+///// POSE GRAPH /////
+//////////////////////
+
+Pose composePoses(const Pose& a, const Pose& b)
+{
+    float c = cos(DEG2RAD(a.theta)), s = sin(DEG2RAD(a.theta));
+    return Pose(a.x + c*b.x - s*b.y, a.y + s*b.x + c*b.y, normalizeAngleDEG(a.theta + b.theta));
+}
+
+Pose invertPose(const Pose& a)
+{
+    float c = cos(DEG2RAD(a.theta)), s = sin(DEG2RAD(a.theta));
+    return Pose(-c*a.x - s*a.y, s*a.x - c*a.y, normalizeAngleDEG(-a.theta));
+}
+
+Pose relativePose(const Pose& a, const Pose& b)
+{
+    return composePoses(invertPose(a), b);
+}
+
+int PoseGraph::addNode(const Pose& p)
+{
+    nodes.push_back(p);
+    return nodes.size()-1;
+}
+
+void PoseGraph::addEdge(const PoseGraphEdge& e)
+{
+    edges.push_back(e);
+}
+
+// Error of an edge, in the frame of the measurement, and its Jacobians over both nodes
+static void getEdgeError(const PoseGraphEdge& e, const Pose& pi, const Pose& pj, double err[3], double A[3][3], double B[3][3])
+{
+    double ti = DEG2RAD(pi.theta), tj = DEG2RAD(pj.theta), tz = DEG2RAD(e.measurement.theta);
+    double c = cos(ti), s = sin(ti), cz = cos(tz), sz = sin(tz);
+    double dx = pj.x - pi.x, dy = pj.y - pi.y;
+
+    // j in the frame of i, against the measurement
+    double rx = c*dx + s*dy - e.measurement.x;
+    double ry = -s*dx + c*dy - e.measurement.y;
+    err[0] = cz*rx + sz*ry;
+    err[1] = -sz*rx + cz*ry;
+    err[2] = normalizeAngleRAD(tj - ti - tz);
+
+    if(A == NULL)
+        return;
+
+    // d(rel)/d(theta_i)
+    double drx = -s*dx + c*dy, dry = -c*dx - s*dy;
+    A[0][0] = -(cz*c - sz*s);  A[0][1] = -(cz*s + sz*c);  A[0][2] = cz*drx + sz*dry;
+    A[1][0] = -(-sz*c - cz*s); A[1][1] = -(-sz*s + cz*c); A[1][2] = -sz*drx + cz*dry;
+    A[2][0] = 0.0;             A[2][1] = 0.0;             A[2][2] = -1.0;
+
+    for(int r=0; r<2; r++)
+        for(int k=0; k<2; k++)
+            B[r][k] = -A[r][k];
+    B[0][2] = B[1][2] = B[2][0] = B[2][1] = 0.0;
+    B[2][2] = 1.0;
+}
+
+// Huber cost of a squared weighted error, and its derivative (the weight of the edge in the
+// normal equations)
+static double getRobustError(const PoseGraphEdge& e, double chi2, double* weight)
+{
+    double d = e.huberDelta;
+    if(d <= 0.0 || chi2 <= d*d){
+        if(weight) *weight = 1.0;
+        return chi2;
+    }
+    double r = sqrt(chi2);
+    if(weight) *weight = d/r;
+    return 2.0*d*r - d*d;
+}
+
+double PoseGraph::getError() const
+{
+    double chi2 = 0.0;
+    double err[3];
+    for(unsigned int k=0; k<edges.size(); k++){
+        const PoseGraphEdge& e = edges[k];
+        getEdgeError(e, nodes[e.from], nodes[e.to], err, NULL, NULL);
+        double s = e.informationXY*(err[0]*err[0] + err[1]*err[1]) + e.informationTheta*err[2]*err[2];
+        chi2 += getRobustError(e, s, NULL);
+    }
+    return chi2;
+}
+
+// Normal equations H*dx = -b over every node but the first (node k > 0 is at 3*(k-1)), each
+// edge weighted by its Huber weight at the current poses
+void PoseGraph::buildSystem(SparseCholesky& H, std::vector<double>& b) const
+{
+    int n = 3*(nodes.size()-1);
+
+    std::vector<int> first(n);
+    for(int i=0; i<n; i++)
+        first[i] = i - i%3;
+    for(unsigned int k=0; k<edges.size(); k++){
+        int lo = std::min(edges[k].from, edges[k].to), hi = std::max(edges[k].from, edges[k].to);
+        if(lo == 0)
+            continue;
+        for(int r=0; r<3; r++)
+            first[3*(hi-1)+r] = std::min(first[3*(hi-1)+r], 3*(lo-1));
+    }
+    H.initialize(first);
+    b.assign(n, 0.0);
+
+    double err[3], A[3][3], B[3][3];
+    for(unsigned int k=0; k<edges.size(); k++){
+        const PoseGraphEdge& e = edges[k];
+        getEdgeError(e, nodes[e.from], nodes[e.to], err, A, B);
+        double robust;
+        getRobustError(e, e.informationXY*(err[0]*err[0] + err[1]*err[1]) + e.informationTheta*err[2]*err[2], &robust);
+        double w[3] = {robust*e.informationXY, robust*e.informationXY, robust*e.informationTheta};
+
+        int nodeOf[2] = {e.from, e.to};
+        double (*J[2])[3] = {A, B};
+        for(int p=0; p<2; p++){
+            if(nodeOf[p] == 0)
+                continue;
+            int rp = 3*(nodeOf[p]-1);
+            for(int a=0; a<3; a++)
+                for(int r=0; r<3; r++)
+                    b[rp+a] += J[p][r][a]*w[r]*err[r];
+
+            for(int q=0; q<2; q++){
+                if(nodeOf[q] == 0)
+                    continue;
+                int rq = 3*(nodeOf[q]-1);
+                for(int a=0; a<3; a++)
+                    for(int c=0; c<3; c++){
+                        // lower triangle only: each symmetric pair is visited twice
+                        if(rp+a < rq+c)
+                            continue;
+                        double v = 0.0;
+                        for(int r=0; r<3; r++)
+                            v += J[p][r][a]*w[r]*J[q][r][c];
+                        H.add(rp+a, rq+c, v);
+                    }
+            }
+        }
+    }
+}
+
+double PoseGraph::optimize(int maxIterations)
+{
+    double chi2 = getError();
+    if(nodes.size() < 2 || edges.empty())
+        return chi2;
+
+    double lambda = 1e-4;
+    SparseCholesky H, damped;
+    std::vector<double> b, dx;
+    for(int it=0; it<maxIterations; it++){
+        buildSystem(H, b);
+
+        bool improved = false;
+        while(!improved && lambda < 1e8){
+            // Marquardt: the diagonal scaled by (1 + lambda)
+            damped = H;
+            for(int i=0; i<H.size(); i++)
+                damped.add(i, i, lambda*H.get(i,i) + 1e-9);
+            if(!damped.factorize()){
+                lambda *= 10.0;
+                continue;
+            }
+            dx = b;
+            damped.solve(dx);
+
+            std::vector<Pose> previous = nodes;
+            for(unsigned int k=1; k<nodes.size(); k++){
+                nodes[k].x -= dx[3*(k-1)];
+                nodes[k].y -= dx[3*(k-1)+1];
+                nodes[k].theta = normalizeAngleDEG(nodes[k].theta - RAD2DEG(dx[3*(k-1)+2]));
+            }
+
+            double newChi2 = getError();
+            if(newChi2 < chi2){
+                improved = true;
+                lambda = std::max(lambda*0.1, 1e-9);
+                double gain = chi2 - newChi2;
+                chi2 = newChi2;
+                if(gain < 1e-6*chi2)
+                    return chi2;
+            }else{
+                nodes.swap(previous);
+                lambda *= 10.0;
+            }
+        }
+        if(!improved)
+            break;
+    }
+    return chi2;
+}
@@ -0,0 +1,73 @@
+#ifndef POSEGRAPH_H
+#define POSEGRAPH_H
+
+#include <vector>
+
+#include "Utils.h"
+
+// Cholesky factorization L*L^T of a sparse symmetric positive definite matrix, in envelope
+// (profile) storage: row i keeps its columns from the first nonzero one up to the diagonal.
+// Fill-in never leaves the envelope, so the structure is fixed before the values are added.
+// A chain of poses gives a band, each loop closure extends the rows of its later node.
+class SparseCholesky
+{
+    public:
+        // firstColumn[i] <= i: first nonzero column of row i
+        void initialize(const std::vector<int>& firstColumn);
+        void add(int i, int j, double value); // entry (i,j) and (j,i), j <= i
+        double get(int i, int j) const;
+
+        bool factorize();
+        void solve(std::vector<double>& b) const; // in place: b becomes x of A*x = b
+
+        int size() const { return first_.size(); }
+
+    private:
+        std::vector<int> first_;
+        std::vector<int> offset_; // row i starts at values_[offset_[i]]
+        std::vector<double> values_;
+
+        double& at(int i, int j) { return values_[offset_[i] + j - first_[i]]; }
+        double at(int i, int j) const { return values_[offset_[i] + j - first_[i]]; }
+};
+
+// Relative pose measured from node 'from' to node 'to', in the frame of 'from' (m, m, deg),
+// with the inverse variances of its components (per m^2, per rad^2). Past huberDelta (in
+// standard deviations, 0 for none) the error of the edge grows linearly: a wrong loop closure
+// pulls the graph much less than its squared error would.
+class PoseGraphEdge
+{
+    public:
+        PoseGraphEdge() : from(0), to(0), informationXY(1.0), informationTheta(1.0), huberDelta(0.0) {}
+
+        int from, to;
+        Pose measurement;
+        float informationXY, informationTheta;
+        float huberDelta;
+};
+
+// 2D pose graph, optimized with Levenberg-Marquardt over the sparse normal equations.
+// The first node is fixed.
+class PoseGraph
+{
+    public:
+        int addNode(const Pose& p);
+        void addEdge(const PoseGraphEdge& e);
+
+        // Returns the final weighted squared error
+        double optimize(int maxIterations);
+        double getError() const;
+
+        std::vector<Pose> nodes;
+        std::vector<PoseGraphEdge> edges;
+
+    private:
+        void buildSystem(SparseCholesky& H, std::vector<double>& b) const;
+};
+
+// Pose composition helpers (theta in degrees): a*b, a^-1 and a^-1*b
+Pose composePoses(const Pose& a, const Pose& b);
+Pose invertPose(const Pose& a);
+Pose relativePose(const Pose& a, const Pose& b);
+
+#endif // POSEGRAPH_H
@@ -0,0 +1,808 @@
+#include <pthread.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+
+#include "Robot.h"
+#include "Planning.h"
+
+// Golden-output regression harness: a recorded log goes through the reference mapping and
+// planning kernels and through a selected variant, on two separate grids, frame by frame.
+// After every frame the cells around the robot are compared layer by layer, with per-layer
+// tolerances, and the first divergent cell and frame are reported. The exit code is 1 when
+// any layer diverged, so the harness can gate performance changes.
+//
+// New kernels are added to mappingVariants() / planningVariants(). The reference entries are
+// copies of the original column-by-column kernels of Robot and Planning, frozen here, so that
+// rewriting the live methods never changes what they are compared against. A planning variant
+// that relaxes fewer cells, or in another order, states which cells and what tolerance apply to
+// its potentials, or has both sides relaxed until they converge. The descent directions are
+// compared as angles, where the potential tolerance bounds them.
+
+class TestRobot : public Robot
+{
+    public:
+        TestRobot(int gridWidth) : Robot(gridWidth) {}
+
+        void setScan(const Pose& p, const std::vector<float>& sonars, const std::vector<float>& lasers)
+        {
+            base.setOdometry(p);
+            base.setSonarReadings(sonars);
+            base.setLaserReadings(lasers);
+            currentPose_ = p;
+        }
+
+        int getSensorRange() { return std::max(base.getMaxLaserRange(), base.getMaxSonarRange())*grid->getMapScale(); }
+
+        // Frozen reference kernels: mappingWithHIMMUsingLaser, mappingWithLogOddsUsingLaser and
+        // mappingUsingSonar as originally written, with the default parameters
+        void referenceHIMMUsingLaser()
+        {
+            float lambda_r = 0.2; //  20 cm
+            float lambda_phi = 1.0;  // 1 degree
+
+            int scale = grid->getMapScale();
+            float maxRange = base.getMaxLaserRange();
+            int maxRangeInt = maxRange*scale;
+
+            int robotX=currentPose_.x*scale;
+            int robotY=currentPose_.y*scale;
+            float robotAngle = currentPose_.theta;
+
+            for(int cellX = robotX - maxRangeInt; cellX <= robotX + maxRangeInt; cellX++) {
+                for(int cellY = robotY - maxRangeInt; cellY <= robotY + maxRangeInt; cellY++) {
+                    Cell* cell = grid->getCell(cellX, cellY);
+
+                    float r = sqrt(pow(cellX - robotX, 2) + pow(cellY - robotY, 2)) / scale;
+                    float phi = normalizeAngleDEG(RAD2DEG(atan2(cellY - robotY, cellX - robotX)) - robotAngle);
+                    int k = base.getNearestLaserBeam(phi);
+
+                    if((fabs(phi - base.getAngleOfLaserBeam(k)) > lambda_phi / 2) ||
+                    (r > std::min(maxRange, base.getKthLaserReading(k)))) {
+                        continue;
+                    }
+
+                    if((base.getKthLaserReading(k) < maxRange) &&
+                        (fabs(r - base.getKthLaserReading(k)) < lambda_r / 2)) {
+                        cell->himm += 3;
+                        cell->himm = std::min(cell->himm, 15);
+                        continue;
+                    }
+
+                    if(r <= base.getKthLaserReading(k)) {
+                        cell->himm -= 1;
+                        cell->himm = std::max(cell->himm, 0);
+                        continue;
+                    }
+                }
+            }
+        }
+
+        double referenceInverseSensorModel(int xCell, int yCell, int xRobot, int yRobot, float robotAngle)
+        {
+            float lambda_r = 0.1;   //  10 cm
+            float lambda_phi = 1.0; // 1 degree
+            int scale = grid->getMapScale();
+            float maxRange = base.getMaxLaserRange();
+            float r = sqrt(pow(xCell - xRobot, 2) + pow(yCell - yRobot, 2)) / scale;
+            float phi = normalizeAngleDEG(RAD2DEG(atan2(yCell - yRobot, xCell - xRobot)) - robotAngle);
+            int k = base.getNearestLaserBeam(phi);
+
+            if ((fabs(phi - base.getAngleOfLaserBeam(k)) > lambda_phi / 2) ||
+                (r > std::min(maxRange, base.getKthLaserReading(k)))) {
+                return 0.5;
+            }
+
+            if ((base.getKthLaserReading(k) < maxRange) &&
+                (fabs(r - base.getKthLaserReading(k)) < lambda_r / 2)) {
+                return 0.9;
+            }
+
+            if (r <= base.getKthLaserReading(k)) {
+                return 0.1;
+            }
+
+            // The original falls off its end here. The first test already returned for
+            // r > min(maxRange, reading), so only a NaN reading gets here, and no update is made.
+            return 0.5;
+        }
+
+        void referenceLogOddsUsingLaser()
+        {
+            int scale = grid->getMapScale();
+            float maxRange = base.getMaxLaserRange();
+            int maxRangeInt = maxRange * scale;
+
+            int robotX = currentPose_.x * scale;
+            int robotY = currentPose_.y * scale;
+            float robotAngle = currentPose_.theta;
+
+            for (int cellX = robotX - maxRangeInt; cellX <= robotX + maxRangeInt; cellX++) {
+                for (int cellY = robotY - maxRangeInt; cellY <= robotY + maxRangeInt; cellY++) {
+                    Cell *cell = grid->getCell(cellX, cellY);
+                    double r = sqrt(pow(cell->x - robotX, 2) + pow(cell->y - robotY, 2));
+                    if (r < maxRangeInt) {
+                        float occupancyUpdate = referenceInverseSensorModel(cell->x, cell->y, robotX, robotY, robotAngle);
+                        cell->logodds += log(occupancyUpdate/(1.0-occupancyUpdate));
+                        cell->occupancy = 1.0 - 1.0/(1.0+exp(cell->logodds));
+                    }
+                }
+            }
+        }
+
+        void referenceSonar()
+        {
+            float lambda_r = 0.5; //  50 cm
+            float lambda_phi = 30.0;  // 30 degrees
+
+            int scale = grid->getMapScale();
+            float maxRange = base.getMaxSonarRange();
+            int maxRangeInt = maxRange * scale;
+
+            int robotX = currentPose_.x * scale;
+            int robotY = currentPose_.y * scale;
+            float robotAngle = currentPose_.theta;
+
+            for (int cellX = robotX - maxRangeInt; cellX <= robotX + maxRangeInt; cellX++) {
+                for (int cellY = robotY - maxRangeInt; cellY <= robotY + maxRangeInt; cellY++) {
+                    Cell *cell = grid->getCell(cellX, cellY);
+                    float r = sqrt(pow(cellX - robotX, 2) + pow(cellY - robotY, 2)) / scale;
+                    float phi = normalizeAngleDEG(RAD2DEG(atan2(cellY - robotY, cellX - robotX)) - robotAngle);
+                    int k = base.getNearestSonarBeam(phi);
+                    float occUpdate;
+                    float R = maxRange;
+                    float alpha = fabs(phi - base.getAngleOfSonarBeam(k));
+                    float beta = lambda_phi / 2;
+                    float occUpdateMainTerm = (((R-r)/R) + ((beta-alpha)/beta))/2;
+
+                    // If sonar not in direction
+                    if (fabs(phi - base.getAngleOfSonarBeam(k)) > lambda_phi / 2) {
+                        continue;
+                    }
+
+                    // if in region 1
+                    if ((base.getKthSonarReading(k) < maxRange) &&
+                        (fabs(r - base.getKthSonarReading(k)) < lambda_r / 2)) {
+                        occUpdate = 0.5 * occUpdateMainTerm + 0.5;
+                    } else if (r <= base.getKthSonarReading(k)) { // if in region 2
+                        occUpdate = 0.5 * (1 - occUpdateMainTerm);
+                    }
+                    else {
+                        continue;
+                    }
+
+                    cell->occupancySonar = (occUpdate * cell->occupancySonar) /
+                                            ((occUpdate * cell->occupancySonar) + ((1.0 - occUpdate) * (1.0 - cell->occupancySonar)));
+
+                    if(cell->occupancySonar > 0.99) cell->occupancySonar = 0.99;
+                    if(cell->occupancySonar < 0.01) cell->occupancySonar = 0.01;
+                }
+            }
+        }
+
+        using Robot::mappingWithHIMMUsingLaser;
+        using Robot::mappingWithLogOddsUsingLaser;
+        using Robot::mappingUsingSonar;
+        using Robot::mappingUsingSonarStamps;
+        using Robot::mappingFused;
+};
+
+class TestPlanning : public Planning
+{
+    public:
+        bbox getLimits() { return newGridLimits; }
+
+        // the cell is relaxed by the span kernels (see updateActiveCells())
+        bool isActive(int x, int y)
+        {
+            int width = gridLimits.maxX - gridLimits.minX + 1;
+            return x >= gridLimits.minX && x <= gridLimits.maxX && y >= gridLimits.minY && y <= gridLimits.maxY &&
+                   activeMarks_[(y - gridLimits.minY)*width + x - gridLimits.minX];
+        }
+
+        void classify()
+        {
+            robotPosition = newRobotPosition;
+            gridLimits = newGridLimits;
+            resetCellsTypes();
+            updateCellsTypes();
+            updateActiveCells();
+        }
+
+        // the live classification alone, for the frozen potential kernels
+        void classifyTiles()
+        {
+            robotPosition = newRobotPosition;
+            gridLimits = newGridLimits;
+            resetCellsTypes();
+            updateCellsTypes();
+        }
+
+        using Planning::reclassifyCells;
+        using Planning::initializePotentials;
+        using Planning::iteratePotentials;
+        using Planning::updateGradient;
+
+        // Frozen reference kernels: the classification and the potential fields as originally
+        // written, column by column over gridLimits, on every FREE cell
+        void referenceClassify()
+        {
+            robotPosition = newRobotPosition;
+            gridLimits = newGridLimits;
+
+            for(int i=gridLimits.minX;i<=gridLimits.maxX;i++)
+                for(int j=gridLimits.minY;j<=gridLimits.maxY;j++)
+                    grid->getCell(i,j)->planType = REGULAR;
+
+            for (int cellX = gridLimits.minX; cellX <= gridLimits.maxX; cellX++) {
+                for (int cellY = gridLimits.minY; cellY <= gridLimits.maxY; cellY++) {
+                    Cell *cell = grid->getCell(cellX, cellY);
+
+                    if (cell->himm <= 5) cell->occType = FREE;
+                    if (cell->himm >= 10) cell->occType = OCCUPIED;
+                }
+            }
+
+            for (int cellX = gridLimits.minX; cellX <= gridLimits.maxX; cellX++) {
+                for (int cellY = gridLimits.minY; cellY <= gridLimits.maxY; cellY++) {
+                    Cell *cell = grid->getCell(cellX, cellY);
+
+                    cell->planType = REGULAR;
+
+                    if (cell->occType == FREE) {
+                        for (int x = cellX - 8; x <= cellX + 8; x++)
+                            for (int y = cellY - 8; y <= cellY + 8; y++)
+                                if (grid->getCell(x, y)->occType == OCCUPIED)
+                                    cell->planType = NEAR_WALLS;
+                    }
+
+                    if (cell->occType == FREE) {
+                        for (int x = cellX - 3; x <= cellX + 3; x++)
+                            for (int y = cellY - 3; y <= cellY + 3; y++)
+                                if (grid->getCell(x, y)->occType == OCCUPIED)
+                                    cell->planType = DANGER;
+                    }
+                }
+            }
+
+            for (int cellX = gridLimits.minX; cellX <= gridLimits.maxX; cellX++) {
+                for (int cellY = gridLimits.minY; cellY <= gridLimits.maxY; cellY++) {
+                    Cell *cell = grid->getCell(cellX, cellY);
+
+                    if (cell->occType == UNEXPLORED) {
+                        for (int x = cellX - 1; x <= cellX + 1; x++)
+                            for (int y = cellY - 1; y <= cellY + 1; y++)
+                                if (grid->getCell(x, y)->occType == FREE)
+                                    cell->planType = FRONTIER;
+
+                        for (int x = cellX - 1; x <= cellX + 1; x++)
+                            for (int y = cellY - 1; y <= cellY + 1; y++)
+                                if (grid->getCell(x, y)->planType == DANGER || grid->getCell(x, y)->planType == NEAR_WALLS)
+                                    cell->planType = FRONTIER_NEAR_WALL;
+                    }
+                }
+            }
+        }
+
+        void referenceInitializePotentials()
+        {
+            for (int cellX = gridLimits.minX; cellX <= gridLimits.maxX; cellX++) {
+                for (int cellY = gridLimits.minY; cellY <= gridLimits.maxY; cellY++) {
+                    Cell *cell = grid->getCell(cellX, cellY);
+
+                    // Harmonic fields
+                    if (cell->occType == OCCUPIED) {
+                        cell->pot[0] = 1.0;
+                    } else {
+                        switch (cell->planType) {
+                        case FRONTIER:
+                        case FRONTIER_NEAR_WALL:
+                            cell->pot[0] = 0.0;
+                            break;
+                        case DANGER:
+                            cell->pot[0] = 1.0;
+                            break;
+                        default:
+                            break;
+                        }
+                    }
+
+                    // With preference
+                    float preference = 0.3;
+
+                    if (cell->occType == FREE) {
+                        if (cell->planType == NEAR_WALLS) {
+                            cell->pref = preference;
+                        } else {
+                            cell->pref = -preference;
+                        }
+                    }
+
+                    if (cell->occType == OCCUPIED) {
+                        cell->pot[1] = 1.0;
+                    } else {
+                        switch (cell->planType) {
+                        case FRONTIER:
+                        case FRONTIER_NEAR_WALL:
+                            cell->pot[1] = 0.0;
+                            break;
+                        case DANGER:
+                            cell->pot[1] = 1.0;
+                            break;
+                        default:
+                            break;
+                        }
+                    }
+
+                    // Objetivos Dinâmicos
+                    if (cell->occType == OCCUPIED) {
+                        cell->pot[2] = 1.0;
+                    } else {
+                        switch (cell->planType) {
+                        case FRONTIER_NEAR_WALL:
+                            cell->pot[2] = 0.0;
+                            break;
+                        case FRONTIER:
+                        case DANGER:
+                            cell->pot[2] = 1.0;
+                            break;
+                        default:
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+
+        void referenceIteratePotentials()
+        {
+            for (int cellX = gridLimits.minX; cellX <= gridLimits.maxX; cellX++) {
+                for (int cellY = gridLimits.minY; cellY <= gridLimits.maxY; cellY++) {
+                    Cell *cell = grid->getCell(cellX, cellY);
+                    if (cell->occType == FREE) {
+
+                        // Harmonic fields
+                        cell->pot[0] = (grid->getCell(cellX - 1, cellY)->pot[0] + grid->getCell(cellX, cellY - 1)->pot[0] +
+                                    grid->getCell(cellX + 1, cellY)->pot[0] + grid->getCell(cellX, cellY + 1)->pot[0]) / 4;
+
+                        // With preference
+                        float h = (grid->getCell(cellX - 1, cellY)->pot[1] + grid->getCell(cellX, cellY - 1)->pot[1] +
+                                    grid->getCell(cellX + 1, cellY)->pot[1] + grid->getCell(cellX, cellY + 1)->pot[1]) / 4;
+
+                        float d = fabs((grid->getCell(cellX, cellY + 1)->pot[1] - grid->getCell(cellX, cellY - 1)->pot[1]) / 2) +
+                                fabs((grid->getCell(cellX + 1, cellY)->pot[1] - grid->getCell(cellX - 1, cellY)->pot[1]) / 2);
+
+                        cell->pot[1] = h - cell->pref / 4 * d;
+
+                        // Objetivos Dinâmicos
+                        cell->pot[2] = (grid->getCell(cellX - 1, cellY)->pot[2] + grid->getCell(cellX, cellY - 1)->pot[2] +
+                                        grid->getCell(cellX + 1, cellY)->pot[2] + grid->getCell(cellX, cellY + 1)->pot[2]) / 4;
+                    }
+                }
+            }
+        }
+
+        void referenceUpdateGradient()
+        {
+            for (int cellX = gridLimits.minX; cellX <= gridLimits.maxX; cellX++) {
+                for (int cellY = gridLimits.minY; cellY <= gridLimits.maxY; cellY++) {
+                    for (int i = 0; i <= 2; i++) {
+                        Cell *cell = grid->getCell(cellX, cellY);
+
+                        if (cell->occType != FREE) {
+                            cell->dirX[i] = 0;
+                            cell->dirY[i] = 0;
+                            continue;
+                        }
+
+                        cell->dirX[i] = -(grid->getCell(cellX + 1, cellY)->pot[i] - grid->getCell(cellX - 1, cellY)->pot[i]) / 2;
+                        cell->dirY[i] = -(grid->getCell(cellX, cellY + 1)->pot[i] - grid->getCell(cellX, cellY - 1)->pot[i]) / 2;
+
+                        float norm = sqrt(pow(cell->dirX[i], 2) + pow(cell->dirY[i], 2));
+                        if (norm != 0) {
+                            cell->dirX[i] /= norm;
+                            cell->dirY[i] /= norm;
+                        }
+                    }
+                }
+            }
+        }
+};
+
+class MappingVariant
+{
+    public:
+        std::string name;
+        std::function<void(TestRobot*)> map;
+};
+
+class PlanningVariant
+{
+    public:
+        std::string name;
+        std::function<void(TestPlanning*)> classify;
+        std::function<void(TestPlanning*, int)> iterate;
+
+        // cells whose potentials are compared (all when empty), and the largest difference
+        // accepted there unless given with -t
+        std::function<bool(TestPlanning*, int, int)> relaxes;
+        double potentialTolerance;
+
+        // when not 0, the variant and the reference are both relaxed, from -i iterations on,
+        // until the compared potentials have less than this left to change (see relaxUntilConverged())
+        double convergence;
+};
+
+static std::vector<MappingVariant> mappingVariants()
+{
+    std::vector<MappingVariant> v(4);
+    v[0].name = "reference";
+    v[0].map = [](TestRobot* r){
+        r->referenceHIMMUsingLaser();
+        r->referenceLogOddsUsingLaser();
+        r->referenceSonar();
+    };
+    v[1].name = "fused";
+    v[1].map = [](TestRobot* r){ r->mappingFused(); };
+    v[2].name = "sonarStamps";
+    v[2].map = [](TestRobot* r){
+        r->mappingWithHIMMUsingLaser();
+        r->mappingWithLogOddsUsingLaser();
+        r->mappingUsingSonarStamps();
+    };
+    // the laser and sonar kernels run row by row over the sensor window (mapScan() is covered by
+    // "fused")
+    v[3].name = "rows";
+    v[3].map = [](TestRobot* r){
+        r->mappingWithHIMMUsingLaser();
+        r->mappingWithLogOddsUsingLaser();
+        r->mappingUsingSonar();
+    };
+    return v;
+}
+
+static std::vector<PlanningVariant> planningVariants()
+{
+    std::vector<PlanningVariant> v(4);
+    for(unsigned int i=0; i<v.size(); i++){
+        v[i].potentialTolerance = 1e-5;
+        v[i].convergence = 0.0;
+    }
+    v[0].name = "reference";
+    v[0].classify = [](TestPlanning* p){ p->referenceClassify(); };
+    v[0].iterate = [](TestPlanning* p, int n){
+        p->referenceInitializePotentials();
+        for(int i=0; i<n; i++)
+            p->referenceIteratePotentials();
+        p->referenceUpdateGradient();
+    };
+    // the potentials of the FREE cells the robot cannot reach are not relaxed any more, and the
+    // others are relaxed row by row instead of column by column. After a given number of
+    // Gauss-Seidel sweeps the two orders leave different residues, but they converge to the same
+    // harmonic function on the cells relaxed: both sides are relaxed until it is reached
+    v[1].name = "spans";
+    v[1].classify = [](TestPlanning* p){ p->classify(); };
+    v[1].iterate = [](TestPlanning* p, int n){
+        p->initializePotentials();
+        for(int i=0; i<n; i++)
+            p->iteratePotentials();
+        p->updateGradient();
+    };
+    v[1].relaxes = [](TestPlanning* p, int x, int y){ return p->isActive(x,y); };
+    v[1].convergence = 1e-6;
+    // the classification by tiles, DANGER tested before NEAR_WALLS with an early exit, under the
+    // frozen potential kernels: the types and so the potentials must match exactly
+    v[2].name = "tiles";
+    v[2].classify = [](TestPlanning* p){ p->classifyTiles(); };
+    v[2].iterate = v[0].iterate;
+    v[2].potentialTolerance = 0.0;
+    // the classification of run(): only the cells the sensors reached since the last plan, against
+    // the whole of gridLimits classified again
+    v[3].name = "incremental";
+    v[3].classify = [](TestPlanning* p){ p->reclassifyCells(); };
+    v[3].iterate = v[0].iterate;
+    v[3].potentialTolerance = 0.0;
+    return v;
+}
+
+// Compared layers, with the largest difference still accepted
+enum Layer {HIMM, LOGODDS, OCCUPANCY, SONAR, OCCTYPE, PLANTYPE, POT0, POT1, POT2, GRADIENT, NUM_LAYERS};
+static const char* layerNames[NUM_LAYERS] = {"himm", "logodds", "occupancy", "sonar", "occType", "planType", "pot0", "pot1", "pot2", "gradient"};
+
+class LayerReport
+{
+    public:
+        double tolerance;
+        double maxDiff;
+        long numDivergent;
+        int firstFrame, firstX, firstY;
+        double firstRef, firstOpt;
+};
+
+static double getLayer(Cell* c, int layer)
+{
+    switch(layer){
+        case HIMM:      return c->himm;
+        case LOGODDS:   return c->logodds;
+        case OCCUPANCY: return c->occupancy;
+        case SONAR:     return c->occupancySonar;
+        case OCCTYPE:   return c->occType;
+        case PLANTYPE:  return c->planType;
+        case POT0:      return c->pot[0];
+        case POT1:      return c->pot[1];
+        case POT2:      return c->pot[2];
+        default:        return RAD2DEG(atan2(c->dirY[0], c->dirX[0]));
+    }
+}
+
+// The descent directions are compared where the reference gradient is steep enough for the
+// potential tolerance to bound their angle: an error e on the four neighbours moves the central
+// differences by up to sqrt(2)*e, which turns a gradient of norm g by at most asin(sqrt(2)*e/g)
+static double minGradientNorm = 0.0;
+
+// Largest angle (deg) between the descent directions of the cell in the two grids, over the
+// relaxed fields; a direction against none counts as opposite
+static double getGradientAngle(Grid* ref, Grid* opt, int x, int y)
+{
+    Cell* a = ref->getCell(x,y);
+    Cell* b = opt->getCell(x,y);
+    double angle = 0.0;
+    for(int i=0; i<FAST_MARCHING_POTENTIAL; i++){
+        double gx = (ref->getCell(x+1,y)->pot[i] - ref->getCell(x-1,y)->pot[i])/2;
+        double gy = (ref->getCell(x,y+1)->pot[i] - ref->getCell(x,y-1)->pot[i])/2;
+        if(sqrt(gx*gx + gy*gy) < minGradientNorm)
+            continue;
+
+        bool noneA = (a->dirX[i] == 0 && a->dirY[i] == 0), noneB = (b->dirX[i] == 0 && b->dirY[i] == 0);
+        if(noneA && noneB)
+            continue;
+        if(noneA || noneB)
+            return 180.0;
+        // the kernels leave unnormalized the directions too small for a float norm
+        double turn = fabs(atan2(a->dirY[i], a->dirX[i]) - atan2(b->dirY[i], b->dirX[i]));
+        angle = std::max(angle, RAD2DEG(std::min(turn, 2*M_PI - turn)));
+    }
+    return angle;
+}
+
+static void compareWindow(Grid* ref, Grid* opt, int frame, int minX, int minY, int maxX, int maxY,
+                          int firstLayer, int lastLayer, std::vector<LayerReport>& reports,
+                          std::function<bool(int,int)> compared = std::function<bool(int,int)>())
+{
+    for(int y=maxY; y>=minY; y--)
+        for(int x=minX; x<=maxX; x++){
+            if(compared && !compared(x,y))
+                continue;
+            Cell* a = ref->getCell(x,y);
+            Cell* b = opt->getCell(x,y);
+            for(int l=firstLayer; l<=lastLayer; l++){
+                double va = getLayer(a,l), vb = getLayer(b,l);
+                double diff = (l == GRADIENT) ? getGradientAngle(ref, opt, x, y) : fabs(va-vb);
+                if(diff != diff) // NaN on one side only
+                    diff = (va != va && vb != vb) ? 0.0 : 1e30;
+
+                LayerReport& r = reports[l];
+                r.maxDiff = std::max(r.maxDiff, diff);
+                if(diff > r.tolerance){
+                    if(r.numDivergent == 0){
+                        r.firstFrame = frame;
+                        r.firstX = x; r.firstY = y;
+                        r.firstRef = va; r.firstOpt = vb;
+                    }
+                    r.numDivergent++;
+                }
+            }
+        }
+}
+
+// Relaxes the potentials until they change by less than convergence on the compared cells of the
+// window. Every call of iterate() sets the DANGER cells back to 1 before the sweeps relax them like
+// the other FREE cells, so a fixed number of sweeps per call keeps a residue that depends on the
+// order of the sweeps: each call doubles the sweeps of the last one instead, from the given number
+// up to 2^12 times it. Gauss-Seidel converges geometrically, so once a call changes the potentials
+// by less than half as much as the call before, what is left to change is below that change.
+static void relaxUntilConverged(TestPlanning* plan, Grid* grid, const PlanningVariant& v, int iterations, double convergence,
+                                const bbox& b, std::function<bool(int,int)> compared)
+{
+    std::vector<double> last;
+    double lastChange = 0.0;
+    for(int batch = 0; batch <= 12; batch++){
+        last.clear();
+        for(int y=b.maxY; y>=b.minY; y--)
+            for(int x=b.minX; x<=b.maxX; x++)
+                for(int k=0; k<FAST_MARCHING_POTENTIAL; k++)
+                    last.push_back(grid->getCell(x,y)->pot[k]);
+
+        v.iterate(plan, iterations << batch);
+
+        double change = 0.0;
+        int i = 0;
+        for(int y=b.maxY; y>=b.minY; y--)
+            for(int x=b.minX; x<=b.maxX; x++)
+                for(int k=0; k<FAST_MARCHING_POTENTIAL; k++, i++)
+                    if(!compared || compared(x,y))
+                        change = std::max(change, fabs(grid->getCell(x,y)->pot[k] - last[i]));
+
+        if(batch > 0 && change <= convergence && change <= lastChange/2)
+            return;
+        lastChange = change;
+    }
+}
+
+static bool readLog(std::string filename, std::vector<Pose>& poses, std::vector< std::vector<float> >& sonars,
+                    std::vector< std::vector<float> >& lasers, LaserDescription& laser)
+{
+    std::ifstream test(filename.c_str());
+    if(!test.is_open())
+        return false;
+    test.close();
+
+    LogFile log(PLAYBACK, filename);
+    laser = log.hasLaserDescription() ? log.getLaserDescription() : LaserDescription::getConfigured();
+
+    while(!log.hasEnded()){
+        Pose p = log.readPose("Odometry");
+        std::vector<float> s = log.readSensors("Sonar");
+        std::vector<float> l = log.readSensors("Laser");
+        if(s.size() < 8 || (int)l.size() < laser.getNumBeams())
+            break;
+        poses.push_back(p);
+        sonars.push_back(s);
+        lasers.push_back(l);
+    }
+    return !poses.empty();
+}
+
+int main(int argc, char* argv[])
+{
+    // the log recorded for the harness, from the build directory like the other tools' files
+    std::string logname = "../phir2framework/Sensors/sensors-261018-103641.txt";
+    std::string mappingName = "reference", planningName = "reference";
+    int planEvery = 10, numIterations = 100;
+    double tolerances[NUM_LAYERS] = {0, 1e-4, 1e-5, 1e-5, 0, 0, 1e-5, 1e-5, 1e-5, 1.0};
+    bool givenTolerances[NUM_LAYERS] = {false};
+
+    for(int i=1; i<argc; i++){
+        if(!strncmp(argv[i], "-m", 2) && i+1<argc)
+            mappingName = argv[++i];
+        else if(!strncmp(argv[i], "-p", 2) && i+1<argc)
+            planningName = argv[++i];
+        else if(!strncmp(argv[i], "-e", 2) && i+1<argc)
+            planEvery = std::max(1, atoi(argv[++i]));
+        else if(!strncmp(argv[i], "-i", 2) && i+1<argc)
+            numIterations = atoi(argv[++i]);
+        else if(!strncmp(argv[i], "-t", 2) && i+1<argc){
+            // layer=tolerance
+            std::string t = argv[++i];
+            size_t eq = t.find('=');
+            for(int l=0; l<NUM_LAYERS && eq!=std::string::npos; l++)
+                if(t.substr(0,eq) == layerNames[l]){
+                    tolerances[l] = atof(t.substr(eq+1).c_str());
+                    givenTolerances[l] = true;
+                }
+        }else if(argv[i][0] != '-')
+            logname = argv[i];
+    }
+
+    std::vector<MappingVariant> mVariants = mappingVariants();
+    std::vector<PlanningVariant> pVariants = planningVariants();
+    int mv = -1, pv = -1;
+    for(unsigned int i=0; i<mVariants.size(); i++)
+        if(mVariants[i].name == mappingName) mv = i;
+    for(unsigned int i=0; i<pVariants.size(); i++)
+        if(pVariants[i].name == planningName) pv = i;
+
+    if(mv < 0 || pv < 0){
+        std::cout << "Usage: " << argv[0] << " [log] [-m mapping variant] [-p planning variant]"
+                  << " [-e frames between plans] [-i potential iterations] [-t layer=tolerance ...]" << std::endl;
+        std::cout << "  mapping variants:";
+        for(unsigned int i=0; i<mVariants.size(); i++) std::cout << ' ' << mVariants[i].name;
+        std::cout << std::endl << "  planning variants:";
+        for(unsigned int i=0; i<pVariants.size(); i++) std::cout << ' ' << pVariants[i].name;
+        std::cout << std::endl;
+        return 2;
+    }
+
+    for(int l=POT0; l<=POT2; l++)
+        if(!givenTolerances[l])
+            tolerances[l] = pVariants[pv].potentialTolerance;
+    double potentialTolerance = std::max(tolerances[POT0], std::max(tolerances[POT1], tolerances[POT2]));
+    minGradientNorm = sqrt(2.0)*potentialTolerance/sin(DEG2RAD(tolerances[GRADIENT]));
+
+    std::vector<Pose> poses;
+    std::vector< std::vector<float> > sonars, lasers;
+    LaserDescription laser;
+    if(!readLog(logname, poses, sonars, lasers, laser)){
+        std::cerr << "Error: could not read " << logname << std::endl;
+        return 2;
+    }
+
+    // both grids must hold every pose and the sensors' range
+    int scale = 10;
+    double maxCoord = 0.0;
+    for(unsigned int i=0; i<poses.size(); i++)
+        maxCoord = std::max(maxCoord, (double)std::max(fabs(poses[i].x), fabs(poses[i].y)));
+    int margin = (int)(std::max(laser.getMaxRange(), 5.0f) + 5.0)*scale;
+    int gridWidth = 2*((int)(maxCoord*scale) + margin);
+    gridWidth = (gridWidth + LOD_TILE_SIZE-1)/LOD_TILE_SIZE*LOD_TILE_SIZE;
+
+    TestRobot* ref = new TestRobot(gridWidth);
+    TestRobot* opt = new TestRobot(gridWidth);
+    ref->setLaserDescription(laser);
+    opt->setLaserDescription(laser);
+    TestPlanning* refPlan = new TestPlanning();
+    TestPlanning* optPlan = new TestPlanning();
+    refPlan->setGrid(ref->grid);
+    optPlan->setGrid(opt->grid);
+    refPlan->setMaxUpdateRange(4);
+    optPlan->setMaxUpdateRange(4);
+
+    std::vector<LayerReport> reports(NUM_LAYERS);
+    for(int l=0; l<NUM_LAYERS; l++){
+        reports[l].tolerance = tolerances[l];
+        reports[l].maxDiff = 0.0;
+        reports[l].numDivergent = 0;
+    }
+
+    std::function<bool(int,int)> relaxed;
+    if(pVariants[pv].relaxes)
+        relaxed = [&](int x, int y){ return pVariants[pv].relaxes(optPlan, x, y); };
+
+    int range = ref->getSensorRange() + 1;
+    for(unsigned int f=0; f<poses.size(); f++){
+        ref->setScan(poses[f], sonars[f], lasers[f]);
+        opt->setScan(poses[f], sonars[f], lasers[f]);
+        mVariants[0].map(ref);
+        mVariants[mv].map(opt);
+
+        int x = poses[f].x*scale, y = poses[f].y*scale;
+        compareWindow(ref->grid, opt->grid, f, x-range, y-range, x+range, y+range, HIMM, SONAR, reports);
+
+        refPlan->setNewRobotPose(poses[f]);
+        optPlan->setNewRobotPose(poses[f]);
+        if((int)(f % planEvery) == planEvery-1 || f+1 == poses.size()){
+            pVariants[0].classify(refPlan);
+            pVariants[pv].classify(optPlan);
+            bbox b = refPlan->getLimits();
+            if(pVariants[pv].convergence > 0.0){
+                relaxUntilConverged(refPlan, ref->grid, pVariants[0], numIterations, pVariants[pv].convergence, b, relaxed);
+                relaxUntilConverged(optPlan, opt->grid, pVariants[pv], numIterations, pVariants[pv].convergence, b, relaxed);
+            }else{
+                pVariants[0].iterate(refPlan, numIterations);
+                pVariants[pv].iterate(optPlan, numIterations);
+            }
+
+            compareWindow(ref->grid, opt->grid, f, b.minX, b.minY, b.maxX, b.maxY, OCCTYPE, PLANTYPE, reports);
+            compareWindow(ref->grid, opt->grid, f, b.minX, b.minY, b.maxX, b.maxY, POT0, GRADIENT, reports, relaxed);
+        }
+    }
+
+    std::cout << "Compared " << poses.size() << " frames of " << logname << ": mapping '" << mappingName
+              << "', planning '" << planningName << "' against the reference" << std::endl;
+
+    bool diverged = false;
+    for(int l=0; l<NUM_LAYERS; l++){
+        LayerReport& r = reports[l];
+        std::cout << "  " << layerNames[l] << ": max diff " << r.maxDiff << " (tolerance " << r.tolerance << ")";
+        if(r.numDivergent > 0){
+            std::cout << ", " << r.numDivergent << " divergent cells, first at frame " << r.firstFrame
+                      << " cell (" << r.firstX << "," << r.firstY << "): reference " << r.firstRef
+                      << " variant " << r.firstOpt;
+            diverged = true;
+        }
+        std::cout << std::endl;
+    }
+    std::cout << (diverged ? "FAILED" : "PASSED") << std::endl;
+
+    delete refPlan;
+    delete optPlan;
+    delete ref->plan;
+    delete opt->plan;
+    delete ref;
+    delete opt;
+
+    return diverged ? 1 : 0;
+}
@@ -1,7 +1,13 @@
 #include "Robot.h"
+#include "SensorModels.h"
+#include "Trace.h"
+#include "Metrics.h"
 
 #include <unistd.h>
+#ifndef HEADLESS
 #include <GL/glut.h>
+#endif
+#include <cfloat>
 #include <cmath>
 #include <iostream>
 
@@ -10,17 +16,72 @@
 ///// CONSTRUCTORS & DESTRUCTORS /////
 //////////////////////////////////////
 
-Robot::Robot()
+RobotParameters::RobotParameters()
+{
+    himmIncrement = 3;
+    himmDecrement = 1;
+    himmLambdaR = 0.2;      //  20 cm
+    himmLambdaPhi = 1.0;    //   1 degree
+    logOddsLambdaR = 0.1;   //  10 cm
+    logOddsLambdaPhi = 1.0; //   1 degree
+    sonarLambdaR = 0.5;     //  50 cm
+    sonarLambdaPhi = 30.0;  //  30 degrees
+
+    potFieldLinVel = 0.1;
+    potFieldAngGain = 0.01;
+    pathLookahead = 0.5;
+
+    fusedMapping = true;
+    useHIMM = useLogOdds = useSonar = true;
+
+    gaussianLaserModel = false;
+    gaussianLaserSigma = 0.05;
+
+    sonarConeStamps = true;
+
+    scanMatching = false;
+    matchLinearWindow = 0.3;    //  30 cm
+    matchAngularWindow = 5.0;   //   5 degrees
+    matchAngularStep = 0.5;     // 0.5 degree
+    matchLevels = 4;            //  8 cells at the coarsest
+    matchMinScore = 0.6;
+    matchTranslationCost = 1.0; // per m
+    matchRotationCost = 0.1;    // per degree
+
+    mclMinParticles = 100;
+    mclMaxParticles = 5000;
+    mclKLDError = 0.05;
+    mclSigmaHit = 0.2;          //  20 cm
+    mclBeamStep = 2;
+    mclTranslationNoise = 0.1;
+    mclRotationNoise = 0.1;
+    mclGlobalInit = false;
+    mclThreads = getNumberOfCores();
+
+    submapSlam = false;
+    slamScansPerSubmap = 20;
+    slamMaxRange = 10.0;
+    slamLoopClosureDistance = 5.0;
+    slamLoopClosureMinScore = 0.6;
+}
+
+Robot::Robot(int gridWidth)
 {
     ready_ = false;
     running_ = true;
+    connectionMode_ = SIMULATION;
 
-    grid = new Grid();
+    grid = new Grid(gridWidth);
+    Metrics::gauge("phir2_grid_bytes", "Memory used by the cells and the LOD pyramid of the grid")->set(grid->getMemoryUsage());
 
     plan = new Planning();
     plan->setGrid(grid);
     plan->setMaxUpdateRange(base.getMaxLaserRange());
 
+    sonarStamps_ = new SonarConeStamps();
+    mcl_ = NULL;
+    slam_ = NULL;
+
     // variables used for navigation
     isFollowingLeftWall_=false;
 
@@ -29,6 +90,8 @@ Robot::Robot()
     numViewModes=5;
     motionMode_=MANUAL_SIMPLE;
 
+    sensingTime = matchingTime = mappingTime = controlTime = 0.0;
+
 }
 
 Robot::~Robot()
@@ -36,6 +99,9 @@ Robot::~Robot()
     base.closeARIAConnection();
     if(grid!=NULL)
         delete grid;
+    delete sonarStamps_;
+    delete mcl_;
+    delete slam_;
 }
 
 ////////////////////////////////////
@@ -44,6 +110,7 @@ Robot::~Robot()
 
 void Robot::initialize(ConnectionMode cmode, LogMode lmode, std::string fname)
 {
+    connectionMode_ = cmode;
     logMode_ = lmode;
 //    logFile_ = new LogFile(logMode_,fname);
     ready_ = true;
@@ -63,7 +130,18 @@ void Robot::initialize(ConnectionMode cmode, LogMode lmode, std::string fname)
 
 void Robot::run()
 {
-    controlTimer.waitTime(0.2);
+    // the in-process simulator advances a fixed time step per cycle, no need to wait
+    if(connectionMode_!=LOCAL_SIMULATION)
+        controlTimer.waitTime(0.2);
+
+    TRACE_ZONE("Robot::run");
+    static MetricCounter* scans = Metrics::counter("phir2_scans_total", "Sensor scans processed by the robot thread");
+    static MetricCounter* droppedScans = Metrics::counter("phir2_scans_dropped_total", "Cycles without a new sensor scan");
+    static MetricGauge* scanRate = Metrics::gauge("phir2_scan_rate_hz", "Scans per second, from the last interval");
+    static MetricHistogram* mappingLatency = Metrics::histogram("phir2_mapping_seconds", "Mapping time per scan, all methods");
+
+    Timer stageTimer;
+    TraceZone stage("sensors");
 
     if(logMode_==PLAYBACK){
         bool hasEnded = base.readFromLog();
@@ -74,6 +152,7 @@ void Robot::run()
     }else{
         bool success = base.readOdometryAndSensors();
         if(!success){
+            droppedScans->add();
             usleep(50000);
             return;
         }
@@ -84,20 +163,34 @@ void Robot::run()
 
     currentPose_ = base.getOdometry();
 
-    pthread_mutex_lock(grid->mutex);
+    scans->add();
+    scanRate->set(1.0/std::max(scanTimer_.getLapTime(), 1e-6f));
+    scanTimer_.startLap();
 
-    // Mapping
-    mappingWithHIMMUsingLaser();
-    mappingWithLogOddsUsingLaser();
-    mappingUsingSonar();
+    sensingTime = stageTimer.getLapTime();
+    stageTimer.startLap();
 
-    pthread_mutex_unlock(grid->mutex);
+    stage.next("scan matching");
+    localize();
+    matchingTime = stageTimer.getLapTime();
+    stageTimer.startLap();
+
+    stage.next("mapping");
+    Trace::lockMutex(grid->mutex, "wait grid mutex", "hold grid mutex");
+    updateMap();
+    Trace::unlockMutex(grid->mutex);
+
+    mappingTime = stageTimer.getLapTime();
+    mappingLatency->record(mappingTime);
+    stageTimer.startLap();
+    stage.next("control");
 
     plan->setNewRobotPose(currentPose_);
+    plan->setMotionMode(motionMode_);
 
     // Save path traversed by the robot
     if(base.isMoving() || logMode_==PLAYBACK){
-        path_.push_back(base.getOdometry());
+        path_.push_back(currentPose_);
     }
 
     // Navigation
@@ -117,6 +210,12 @@ void Robot::run()
         case POTFIELD_2:
             followPotentialField(2);
             break;
+        case POTFIELD_3:
+            followPotentialField(3);
+            break;
+        case FOLLOW_PATH:
+            followPath();
+            break;
         case ENDING:
             running_=false;
             break;
@@ -126,7 +225,81 @@ void Robot::run()
 
     base.resumeMovement();
 
-    usleep(50000);
+    controlTime = stageTimer.getLapTime();
+    stage.end();
+
+    if(connectionMode_!=LOCAL_SIMULATION)
+        usleep(50000);
+}
+
+// Offline mapping: updates the grid with a recorded set of readings, without any control
+void Robot::mapReadings(const Pose& odometry, const std::vector<float>& sonars, const std::vector<float>& lasers)
+{
+    base.setOdometry(odometry);
+    base.setSonarReadings(sonars);
+    base.setLaserReadings(lasers);
+    currentPose_ = base.getOdometry();
+
+    Trace::lockMutex(grid->mutex, "wait grid mutex", "hold grid mutex");
+    updateMap();
+    Trace::unlockMutex(grid->mutex);
+
+    path_.push_back(currentPose_);
+}
+
+void Robot::setSimulationMap(std::string mapname)
+{
+    base.setSimulationMap(mapname);
+}
+
+Simulator* Robot::getSimulator()
+{
+    return base.getSimulator();
+}
+
+void Robot::setLaserDescription(const LaserDescription& d)
+{
+    base.setLaserDescription(d);
+    plan->setMaxUpdateRange(base.getMaxLaserRange());
+}
+
+// Localizes against a map saved by the map builder, in the frame of the log it was built from
+// (the robot has to start at the same place). The map is also loaded in the grid, for planning.
+bool Robot::setLocalizationMap(std::string filename)
+{
+    ParticleFilter* mcl = new ParticleFilter();
+    if(!mcl->loadMap(filename)){
+        delete mcl;
+        return false;
+    }
+    delete mcl_;
+    mcl_ = mcl;
+
+    const SavedMap& m = mcl_->getMap();
+    int half = grid->getMapWidth()/2;
+    pthread_mutex_lock(grid->mutex);
+    for(int j=0; j<m.height; j++)
+        for(int i=0; i<m.width; i++){
+            int x = m.left + i, y = m.top - j;
+            if(x <= -half || x > half || y <= -half || y > half)
+                continue;
+            Cell* c = grid->getCell(x,y);
+            int p = j*m.width + i;
+            c->logodds = m.logodds[p];
+            c->occupancy = getOccupancyFromLogOdds(c->logodds);
+            c->logoddsSonar = getLogOddsFromOccupancy(m.occupancySonar[p]);
+            c->occupancySonar = m.occupancySonar[p];
+            c->himm = m.himm[p];
+            grid->markDirty(x,y);
+        }
+    pthread_mutex_unlock(grid->mutex);
+
+    return true;
+}
+
+void Robot::setVerbose(bool v)
+{
+    base.setVerbose(v);
 }
 
 //////////////////////////////
@@ -213,90 +386,248 @@ void Robot::followPotentialField(int t)
 
     float phi = RAD2DEG(atan2(c->dirY[t], c->dirX[t])) - robotAngle;
     phi = normalizeAngleDEG(phi);
-    angVel = 0.01 * phi;
-    linVel = 0.1;
+    angVel = params.potFieldAngGain * phi;
+    linVel = params.potFieldLinVel;
 
     base.setWheelsVelocity_fromLinAngVelocity(linVel,angVel);
 }
 
+// Pure pursuit on the path of the planner: heads for the first cell of the path that is at least
+// pathLookahead away, past the cell closest to the robot, slowing down when facing away from it.
+// It does not head for cells it could only reach straight through a wall, so it follows the path
+// around corners. Next to the end of the path the robot only turns towards it.
+void Robot::followPath()
+{
+    plan->getPath(plannedPath_);
+    if(plannedPath_.size() < 2){
+        base.setWheelsVelocity_fromLinAngVelocity(0.0,0.0);
+        return;
+    }
 
-///////////////////////////
-///// MAPPING METHODS /////
-///////////////////////////
+    int scale = grid->getMapScale();
+    float robotX = currentPose_.x*scale;
+    float robotY = currentPose_.y*scale;
+    float lookahead = params.pathLookahead*scale;
+
+    unsigned int target = 0;
+    float closest = FLT_MAX;
+    for(unsigned int i=0; i<plannedPath_.size(); i++){
+        float d = pow(plannedPath_[i].x+0.5-robotX, 2) + pow(plannedPath_[i].y+0.5-robotY, 2);
+        if(d < closest){
+            closest = d;
+            target = i;
+        }
+    }
+    unsigned int nearest = target;
+    while(target+1 < plannedPath_.size() &&
+          pow(plannedPath_[target].x+0.5-robotX, 2) + pow(plannedPath_[target].y+0.5-robotY, 2) < pow(lookahead, 2) &&
+          (target == nearest || target+2 == plannedPath_.size() ||
+           isClearLine(robotX, robotY, plannedPath_[target+1].x+0.5, plannedPath_[target+1].y+0.5)))
+        target++;
+
+    float dx = plannedPath_[target].x+0.5-robotX;
+    float dy = plannedPath_[target].y+0.5-robotY;
+    float phi = normalizeAngleDEG(RAD2DEG(atan2(dy, dx)) - currentPose_.theta);
+    float angVel = params.potFieldAngGain * phi;
+    float linVel = params.potFieldLinVel * std::max(0.0, cos(DEG2RAD(phi)));
+    if(target+1 == plannedPath_.size() && dx*dx + dy*dy < 2.0)
+        linVel = 0.0;
 
-float Robot::getOccupancyFromLogOdds(float logodds)
-{
-    return 1.0 - 1.0/(1.0+exp(logodds));
+    base.setWheelsVelocity_fromLinAngVelocity(linVel,angVel);
 }
 
-float Robot::getLogOddsFromOccupancy(float occupancy)
+// Whether the segment between two points (in cells) stays off the DANGER and OCCUPIED cells, apart
+// from the ones the robot is already in: cutting a corner of the path there would hit the wall.
+bool Robot::isClearLine(float x0, float y0, float x1, float y1)
 {
-    return log(occupancy/(1.0-occupancy));
+    int steps = ceil(std::max(fabs(x1-x0), fabs(y1-y0)));
+    bool leaving = true;
+    for(int i=1; i<=steps; i++){
+        Cell* c = grid->getCell(floor(x0 + (x1-x0)*i/steps), floor(y0 + (y1-y0)*i/steps));
+        bool blocked = c->occType == OCCUPIED || c->planType == DANGER;
+        if(blocked && !leaving)
+            return false;
+        leaving = leaving && blocked;
+    }
+    return true;
 }
 
-double Robot::inverseSensorModel(int xCell, int yCell, int xRobot, int yRobot, float robotAngle) {
-    float lambda_r = 0.1;   //  10 cm
-    float lambda_phi = 1.0; // 1 degree
-    int scale = grid->getMapScale();
-    float maxRange = base.getMaxLaserRange();
-    int maxRangeInt = maxRange * scale;
-    float r = sqrt(pow(xCell - xRobot, 2) + pow(yCell - yRobot, 2)) / scale;
-    float phi = normalizeAngleDEG(RAD2DEG(atan2(yCell - yRobot, xCell - xRobot)) - robotAngle);
-    int k = base.getNearestLaserBeam(phi);
 
-    if ((fabs(phi - base.getAngleOfLaserBeam(k)) > lambda_phi / 2) ||
-        (r > std::min(maxRange, base.getKthLaserReading(k)))) {
-        return 0.5;
-    }
+////////////////////////////////
+///// LOCALIZATION METHODS /////
+////////////////////////////////
 
-    if ((base.getKthLaserReading(k) < maxRange) &&
-        (fabs(r - base.getKthLaserReading(k)) < lambda_r / 2)) {
-        return 0.9;
+// Corrects currentPose_ (the odometry) by matching the scan against the map. The correction is
+// kept as a transform from the odometry frame to the map frame, so the next guess already
+// includes it and the matcher only searches the drift of one cycle.
+void Robot::localize()
+{
+    if(mcl_ != NULL){
+        localizeWithParticleFilter();
+        return;
     }
-
-    if (r <= base.getKthLaserReading(k)) {
-        return 0.1;
+    if(params.submapSlam){
+        localizeWithSubmapSlam();
+        return;
+    }
+    if(!params.scanMatching)
+        return;
+
+    const Pose& odom = base.getOdometry();
+    float c = cos(DEG2RAD(odomToMap_.theta)), s = sin(DEG2RAD(odomToMap_.theta));
+    currentPose_.x = odomToMap_.x + c*odom.x - s*odom.y;
+    currentPose_.y = odomToMap_.y + s*odom.x + c*odom.y;
+    currentPose_.theta = normalizeAngleDEG(odomToMap_.theta + odom.theta);
+
+    static MetricHistogram* latency = Metrics::histogram("phir2_scan_matching_seconds", "Scan matching time per scan");
+    static MetricCounter* corrections = Metrics::counter("phir2_scan_match_corrections_total", "Scans whose pose was corrected by the matcher");
+    static MetricGauge* score = Metrics::gauge("phir2_scan_match_score", "Mean occupancy under the laser hits, last match");
+    Timer timer;
+
+    matcher_.linearWindow = params.matchLinearWindow;
+    matcher_.angularWindow = params.matchAngularWindow;
+    matcher_.angularStep = params.matchAngularStep;
+    matcher_.numLevels = params.matchLevels;
+    matcher_.minScore = params.matchMinScore;
+    matcher_.translationCost = params.matchTranslationCost;
+    matcher_.rotationCost = params.matchRotationCost;
+
+    // only the robot thread writes occupancies, no need to lock the grid to read them
+    Pose corrected;
+    if(matcher_.match(grid, base.getLaserPoints(), currentPose_, corrected)){
+        currentPose_ = corrected;
+        corrections->add();
+
+        // odomToMap_ = corrected * odom^-1
+        odomToMap_.theta = normalizeAngleDEG(corrected.theta - odom.theta);
+        c = cos(DEG2RAD(odomToMap_.theta));
+        s = sin(DEG2RAD(odomToMap_.theta));
+        odomToMap_.x = corrected.x - (c*odom.x - s*odom.y);
+        odomToMap_.y = corrected.y - (s*odom.x + c*odom.y);
     }
+    score->set(matcher_.getLastScore());
+    latency->record(timer.getTotalTime());
 }
 
-void Robot::mappingWithLogOddsUsingLaser()
+// Moves the particles with the odometry of the last cycle and weights them with the scan, the
+// estimate replaces the odometry as the robot's pose
+void Robot::localizeWithParticleFilter()
 {
-    float lambda_r = 0.1;   //  10 cm
-    float lambda_phi = 1.0; // 1 degree
+    static MetricHistogram* latency = Metrics::histogram("phir2_mcl_update_seconds", "Particle filter update time per scan");
+    static MetricGauge* particles = Metrics::gauge("phir2_mcl_particles", "Particles of the Monte Carlo localization");
+    Timer timer;
+
+    mcl_->minParticles = params.mclMinParticles;
+    mcl_->maxParticles = params.mclMaxParticles;
+    mcl_->kldError = params.mclKLDError;
+    mcl_->sigmaHit = params.mclSigmaHit;
+    mcl_->beamStep = params.mclBeamStep;
+    mcl_->translationNoise = params.mclTranslationNoise;
+    mcl_->rotationNoise = params.mclRotationNoise;
+    mcl_->numThreads = params.mclThreads;
+
+    const Pose& odom = base.getOdometry();
+    if(!mcl_->isInitialized()){
+        if(params.mclGlobalInit)
+            mcl_->initializeGlobal();
+        else
+            mcl_->initialize(odom, 0.2, 5.0);
+    }else
+        mcl_->predict(lastOdometry_, odom);
+    lastOdometry_ = odom;
+
+    mcl_->correct(base.getLaserPoints());
+    if(mcl_->isInitialized())
+        currentPose_ = mcl_->getEstimate();
+
+    particles->set(mcl_->getNumParticles());
+    latency->record(timer.getTotalTime());
+}
 
+// The odometry is the front end: the back end returns it corrected by the optimized submaps
+void Robot::localizeWithSubmapSlam()
+{
+    static MetricHistogram* latency = Metrics::histogram("phir2_slam_update_seconds", "Submap SLAM update time per scan");
+    static MetricGauge* submaps = Metrics::gauge("phir2_slam_submaps", "Submaps of the pose graph");
+    static MetricGauge* loopClosures = Metrics::gauge("phir2_slam_loop_closures", "Loop closures found by the submap SLAM");
+    Timer timer;
+
+    if(slam_ == NULL)
+        slam_ = new SubmapSlam(grid->getMapScale());
+    slam_->scansPerSubmap = params.slamScansPerSubmap;
+    slam_->maxRange = params.slamMaxRange;
+    slam_->loopClosureDistance = params.slamLoopClosureDistance;
+    slam_->loopClosureMinScore = params.slamLoopClosureMinScore;
+
+    currentPose_ = slam_->addScan(base.getLaserPoints(), base.getOdometry());
+
+    submaps->set(slam_->getNumSubmaps());
+    loopClosures->set(slam_->getNumLoopClosures());
+    latency->record(timer.getTotalTime());
+}
+
+///////////////////////////
+///// MAPPING METHODS /////
+///////////////////////////
+
+void Robot::updateMap()
+{
+    if(params.fusedMapping){
+        TRACE_ZONE("mapping fused");
+        mappingFused();
+    }else{
+        TraceZone pass("mapping HIMM");
+        if(params.useHIMM)
+            mappingWithHIMMUsingLaser();
+        pass.next("mapping log-odds");
+        if(params.useLogOdds && slam_ == NULL)
+            mappingWithLogOddsUsingLaser();
+        pass.next("mapping sonar");
+        if(params.useSonar && params.sonarConeStamps)
+            mappingUsingSonarStamps();
+        else if(params.useSonar)
+            mappingUsingSonar();
+        pass.end();
+    }
+    if(slam_ != NULL){
+        TRACE_ZONE("mapping submaps");
+        slam_->render(grid);
+    }
+
+    // Flag the updated window for the grid's level-of-detail pyramid
     int scale = grid->getMapScale();
-    float maxRange = base.getMaxLaserRange();
-    int maxRangeInt = maxRange * scale;
+    int range = std::max(base.getMaxLaserRange(), base.getMaxSonarRange())*scale;
+    grid->markDirty(currentPose_.x*scale - range, currentPose_.y*scale - range,
+                    currentPose_.x*scale + range, currentPose_.y*scale + range);
+}
+
+float Robot::getOccupancyFromLogOdds(float logodds)
+{
+    return occupancyFromLogOdds(logodds);
+}
+
+float Robot::getLogOddsFromOccupancy(float occupancy)
+{
+    return logOddsFromOccupancy(occupancy);
+}
 
+// Log-odds with the cone model of LaserLogOddsModel: 0.9 at the hit, 0.1 before it
+void Robot::mappingWithLogOddsUsingLaser()
+{
+    int scale = grid->getMapScale();
     int robotX = currentPose_.x * scale;
     int robotY = currentPose_.y * scale;
-    float robotAngle = currentPose_.theta;
 
-    // how to access a grid cell:
-    //    Cell* c=grid->getCell(robotX,robotY);
-
-    // access log-odds value of variable in c->logodds
-    // how to convert logodds to occupancy values:
-    //    c->occupancy = getOccupancyFromLogOdds(c->logodds);
-    float locc, lfree;
-
-    for (int cellX = robotX - maxRangeInt; cellX <= robotX + maxRangeInt; cellX++) {
-        for (int cellY = robotY - maxRangeInt; cellY <= robotY + maxRangeInt; cellY++) {
-            Cell *cell = grid->getCell(cellX, cellY);
-            double r = sqrt(pow(cell->x - robotX, 2) + pow(cell->y - robotY, 2));
-            if (r < maxRangeInt) {
-                float occupancyUpdate = inverseSensorModel(cell->x, cell->y, robotX, robotY, robotAngle);
-                cell->logodds += getLogOddsFromOccupancy(occupancyUpdate);
-                cell->occupancy = getOccupancyFromLogOdds(cell->logodds);
-            }
-        }
-    }
+    ScanView scan(base.getLaserReadings(), base.getSonarReadings(), base.getLaserDescription(), base.getMaxSonarRange());
+    LaserLogOddsModel logOdds(params, scan, scale);
+    logOdds.enabled = true;
+    mapScan(grid, robotX, robotY, currentPose_.theta, logOdds);
 }
 
 void Robot::mappingUsingSonar()
 {
-    float lambda_r = 0.5; //  50 cm
-    float lambda_phi = 30.0;  // 30 degrees
+    float lambda_r = params.sonarLambdaR;
+    float lambda_phi = params.sonarLambdaPhi;
 
     // TODO: update cells in the sensors' field-of-view
     // Follow the example in mappingWithLogOddsUsingLaser()
@@ -309,9 +640,9 @@ void Robot::mappingUsingSonar()
     int robotY = currentPose_.y * scale;
     float robotAngle = currentPose_.theta;
 
-    for (int cellX = robotX - maxRangeInt; cellX <= robotX + maxRangeInt; cellX++) {
-        for (int cellY = robotY - maxRangeInt; cellY <= robotY + maxRangeInt; cellY++) {
-            Cell *cell = grid->getCell(cellX, cellY);
+    bbox window = {robotX - maxRangeInt, robotX + maxRangeInt, robotY - maxRangeInt, robotY + maxRangeInt};
+    grid->forEachRow(window, [&](Cell* cell, int cellY, int minX, int maxX){
+        for (int cellX = minX; cellX <= maxX; cellX++, cell++) {
             float r = sqrt(pow(cellX - robotX, 2) + pow(cellY - robotY, 2)) / scale;
             float phi = normalizeAngleDEG(RAD2DEG(atan2(cellY - robotY, cellX - robotX)) - robotAngle);
             int k = base.getNearestSonarBeam(phi);
@@ -342,14 +673,79 @@ void Robot::mappingUsingSonar()
 
             if(cell->occupancySonar > 0.99) cell->occupancySonar = 0.99;
             if(cell->occupancySonar < 0.01) cell->occupancySonar = 0.01;
+
+            // logoddsSonar follows it, so that mappingUsingSonarStamps() can go on from this map
+            cell->logoddsSonar = log(cell->occupancySonar/(1.0-cell->occupancySonar));
         }
+    });
+}
+
+// Same update as mappingUsingSonar, but only the cells of the cones are visited (see SonarConeStamps)
+// and the Bayesian rule is applied in log-odds, where it becomes a sum: logoddsSonar keeps the
+// sum and occupancySonar follows it. The 0.01-0.99 clamp is applied to the log-odds.
+// The cones are looked up in the window at the exact heading, not in stamps per heading bin, so
+// the cells and their updates stay those of mappingUsingSonar; occupancySonar is what the map
+// builder and the localization read, so it still follows each update.
+void Robot::mappingUsingSonarStamps()
+{
+    float lambda_r = params.sonarLambdaR;
+    float lambda_phi = params.sonarLambdaPhi;
+
+    int scale = grid->getMapScale();
+    float maxRange = base.getMaxSonarRange();
+    int maxRangeInt = maxRange * scale;
+    sonarStamps_->build(maxRangeInt, scale);
+
+    int robotX = currentPose_.x * scale;
+    int robotY = currentPose_.y * scale;
+    float robotAngle = currentPose_.theta;
+
+    float halfR = lambda_r / 2;
+    float halfPhi = lambda_phi / 2;
+    double maxLogOdds = log(SONAR_P_MAX/(1.0-SONAR_P_MAX));
+
+    for(int k = 0; k < NUM_SONAR_BEAMS; k++) {
+        float reading = base.getKthSonarReading(k);
+        float beamAngle = SONAR_BEAM_ANGLES[k];
+        float maxR = reading + halfR;
+
+        // the part of the cone where the beam is the nearest one, a degree wider: the exact test
+        // is the one of mappingUsingSonar
+        float minPhi = std::max(beamAngle - halfPhi, SONAR_SECTOR_MIN[k]);
+        float maxPhi = std::min(beamAngle + halfPhi, SONAR_SECTOR_MAX[k]);
+        sonarStamps_->forEachInArc(robotAngle + minPhi - 1.0, robotAngle + maxPhi + 1.0,
+                                   [&](const SonarConeStamps::StampCell& s){
+            if(s.r > maxR)
+                return;
+
+            float phi = normalizeAngleDEG(s.angle - robotAngle);
+            if(ScanView::nearestSonarBeam(phi) != k)
+                return;
+            float alpha = fabs(phi - beamAngle);
+            if(alpha > halfPhi)
+                return;
+
+            float occUpdateMainTerm = (((maxRange-s.r)/maxRange) + ((halfPhi-alpha)/halfPhi))/2;
+            float occUpdate;
+            if(reading < maxRange && fabs(s.r - reading) < halfR)
+                occUpdate = 0.5 * occUpdateMainTerm + 0.5;
+            else if(s.r <= reading)
+                occUpdate = 0.5 * (1 - occUpdateMainTerm);
+            else
+                return;
+
+            Cell* cell = grid->getCell(robotX + s.dx, robotY + s.dy);
+            cell->logoddsSonar += log(occUpdate/(1.0-occUpdate));
+            cell->logoddsSonar = std::max(-maxLogOdds, std::min(maxLogOdds, cell->logoddsSonar));
+            cell->occupancySonar = 1.0 - 1.0/(1.0+exp(cell->logoddsSonar));
+        });
     }
 }
 
 void Robot::mappingWithHIMMUsingLaser()
 {
-    float lambda_r = 0.2; //  20 cm
-    float lambda_phi = 1.0;  // 1 degree
+    float lambda_r = params.himmLambdaR;
+    float lambda_phi = params.himmLambdaPhi;
 
     int scale = grid->getMapScale();
     float maxRange = base.getMaxLaserRange();
@@ -359,9 +755,9 @@ void Robot::mappingWithHIMMUsingLaser()
     int robotY=currentPose_.y*scale;
     float robotAngle = currentPose_.theta;
 
-    for(int cellX = robotX - maxRangeInt; cellX <= robotX + maxRangeInt; cellX++) {
-        for(int cellY = robotY - maxRangeInt; cellY <= robotY + maxRangeInt; cellY++) {
-            Cell* cell = grid->getCell(cellX, cellY);
+    bbox window = {robotX - maxRangeInt, robotX + maxRangeInt, robotY - maxRangeInt, robotY + maxRangeInt};
+    grid->forEachRow(window, [&](Cell* cell, int cellY, int minX, int maxX){
+        for(int cellX = minX; cellX <= maxX; cellX++, cell++) {
 
             float r = sqrt(pow(cellX - robotX, 2) + pow(cellY - robotY, 2)) / scale;
             float phi = normalizeAngleDEG(RAD2DEG(atan2(cellY - robotY, cellX - robotX)) - robotAngle);
@@ -374,18 +770,48 @@ void Robot::mappingWithHIMMUsingLaser()
 
             if((base.getKthLaserReading(k) < maxRange) &&
                 (fabs(r - base.getKthLaserReading(k)) < lambda_r / 2)) {
-                cell->himm += 3;
+                cell->himm += params.himmIncrement;
                 cell->himm = std::min(cell->himm, 15);
                 continue;
             }
 
             if(r <= base.getKthLaserReading(k)) {
-                cell->himm -= 1;
+                cell->himm -= params.himmDecrement;
                 cell->himm = std::max(cell->himm, 0);
                 continue;
             }
         }
+    });
+}
+
+// Same updates as mappingWithHIMMUsingLaser, mappingWithLogOddsUsingLaser and mappingUsingSonar,
+// but the window around the robot is swept once: the distance and angle of each cell are computed
+// a single time and shared by the enabled sensor models (see SensorModels.h)
+void Robot::mappingFused()
+{
+    int scale = grid->getMapScale();
+    int robotX = currentPose_.x*scale;
+    int robotY = currentPose_.y*scale;
+
+    ScanView scan(base.getLaserReadings(), base.getSonarReadings(), base.getLaserDescription(), base.getMaxSonarRange());
+    LaserHIMMModel himm(params, scan, scale);
+    SonarBayesModel sonar(params, scan, scale);
+    sonar.enabled = params.useSonar && !params.sonarConeStamps;
+
+    // with the submap SLAM, the laser log-odds come from the submaps
+    if(params.gaussianLaserModel){
+        LaserGaussianModel logOdds(params, scan, scale);
+        logOdds.enabled = params.useLogOdds && slam_ == NULL;
+        mapScan(grid, robotX, robotY, currentPose_.theta, himm, logOdds, sonar);
+    }else{
+        LaserLogOddsModel logOdds(params, scan, scale);
+        logOdds.enabled = params.useLogOdds && slam_ == NULL;
+        mapScan(grid, robotX, robotY, currentPose_.theta, himm, logOdds, sonar);
     }
+
+    // the sonar window is the largest, the stamps avoid sweeping it
+    if(params.useSonar && params.sonarConeStamps)
+        mappingUsingSonarStamps();
 }
 
 /////////////////////////////////////////////////////
@@ -415,6 +841,7 @@ bool Robot::readFromLog() {
     return false;
 }
 
+#ifndef HEADLESS
 ////////////////////////
 ///// DRAW METHODS /////
 ////////////////////////
@@ -443,6 +870,7 @@ void Robot::draw(float xRobot, float yRobot, float angRobot)
     glRotatef(-angRobot,0.0,0.0,1.0);
     glTranslatef(-xRobot,-yRobot,0.0);
 }
+#endif
 
 /////////////////////////
 ///// OTHER METHODS /////
@@ -463,6 +891,7 @@ const Pose& Robot::getCurrentPose()
     return currentPose_;
 }
 
+#ifndef HEADLESS
 void Robot::drawPath()
 {
     float scale = grid->getMapScale();
@@ -485,6 +914,7 @@ void Robot::drawPath()
 
     }
 }
+#endif
 
 void Robot::waitTime(float t){
     float l;
@@ -4,22 +4,87 @@
 #include <vector>
 
 #include "Grid.h"
+#include "Localization.h"
 #include "PioneerBase.h"
 #include "Planning.h"
+#include "ScanMatcher.h"
+#include "SubmapSlam.h"
 #include "Utils.h"
 
+// Tunable parameters of the mapping and control methods
+class RobotParameters
+{
+public:
+    RobotParameters();
+
+    int himmIncrement, himmDecrement;
+    float himmLambdaR, himmLambdaPhi;       // m, deg
+    float logOddsLambdaR, logOddsLambdaPhi; // m, deg
+    float sonarLambdaR, sonarLambdaPhi;     // m, deg
+
+    float potFieldLinVel;  // m/s
+    float potFieldAngGain; // angular velocity per degree of heading error
+    float pathLookahead;   // m, distance along the planned path to the point the robot heads for
+
+    // Mapping stage: the three methods in a single sweep (fusedMapping) or one after the other,
+    // each method can be turned off
+    bool fusedMapping;
+    bool useHIMM, useLogOdds, useSonar;
+
+    // Fused mapping only: Gaussian beam model instead of the log-odds cone for the laser
+    bool gaussianLaserModel;
+    float gaussianLaserSigma; // m
+
+    // Sonar mapping from the precomputed cone stamps, in log-odds
+    bool sonarConeStamps;
+
+    // Scan-to-map localization before mapping (see ScanMatcher)
+    bool scanMatching;
+    float matchLinearWindow, matchAngularWindow, matchAngularStep; // m, deg, deg
+    int matchLevels;
+    float matchMinScore;
+    float matchTranslationCost, matchRotationCost; // per m, per deg
+
+    // Monte Carlo localization, when a saved map is given (see ParticleFilter)
+    int mclMinParticles, mclMaxParticles;
+    float mclKLDError;
+    float mclSigmaHit; // m
+    int mclBeamStep;
+    float mclTranslationNoise, mclRotationNoise; // fractions of the odometry displacement and rotation
+    bool mclGlobalInit; // particles all over the map instead of around the starting pose
+    int mclThreads;     // the particles are scored in parallel; 1 when the instances already run in parallel
+
+    // Pose-graph SLAM over submaps, the laser log-odds are drawn from the submaps (see SubmapSlam)
+    bool submapSlam;
+    int slamScansPerSubmap;
+    float slamMaxRange; // m
+    float slamLoopClosureDistance; // m
+    float slamLoopClosureMinScore;
+};
+
+class SonarConeStamps;
+
 class Robot
 {
 public:
-    Robot();
+    Robot(int gridWidth=2000);
     ~Robot();
 
     void initialize(ConnectionMode cmode, LogMode lmode, std::string fname);
     void run();
+    void mapReadings(const Pose& odometry, const std::vector<float>& sonars, const std::vector<float>& lasers);
+
+    void setSimulationMap(std::string mapname);
+    void setLaserDescription(const LaserDescription& d);
+    bool setLocalizationMap(std::string filename);
+    Simulator* getSimulator();
+    void setVerbose(bool v);
 
     void move(MovingDirection dir);
+#ifndef HEADLESS
     void draw(float xRobot, float yRobot, float angRobot);
     void drawPath();
+#endif
 
     const Pose& getCurrentPose();
 
@@ -32,6 +97,11 @@ public:
     int viewMode;
     int numViewModes;
 
+    RobotParameters params;
+
+    // Duration of each stage of the last cycle, in seconds
+    float sensingTime, matchingTime, mappingTime, controlTime;
+
 
 protected:
 
@@ -41,6 +111,8 @@ protected:
     bool ready_;
     bool running_;
 
+    ConnectionMode connectionMode_;
+
     // ARIA stuff
     PioneerBase base;
 
@@ -54,19 +126,35 @@ protected:
     void wanderAvoidingCollisions();
     void wallFollow();
     void followPotentialField(int t);
+    void followPath();
+    bool isClearLine(float x0, float y0, float x1, float y1);
     bool isFollowingLeftWall_;
+    std::vector<point2d> plannedPath_;
+
+    // Localization stuff
+    ScanMatcher matcher_;
+    Pose odomToMap_; // correction of the odometry found by the scan matcher
+    void localize();
+    ParticleFilter* mcl_; // localization against a saved map, NULL when there is none
+    Pose lastOdometry_;
+    void localizeWithParticleFilter();
+    SubmapSlam* slam_; // NULL until the first scan with params.submapSlam
+    void localizeWithSubmapSlam();
 
     // Mapping stuff
+    void updateMap();
     float getOccupancyFromLogOdds(float logodds);
     float getLogOddsFromOccupancy(float occupancy);
     void mappingWithHIMMUsingLaser();
     void mappingWithLogOddsUsingLaser();
     void mappingUsingSonar();
+    void mappingUsingSonarStamps();
+    void mappingFused();
+    SonarConeStamps* sonarStamps_;
 
     Timer controlTimer;
+    Timer scanTimer_;
     void waitTime(float t);
-
-    double inverseSensorModel(int xCell, int yCell, int xRobot, int yRobot, float robotAngle);
 };
 
 #endif // ROBOT_H
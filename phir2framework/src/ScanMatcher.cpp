@@ -0,0 +1,199 @@
+#include "ScanMatcher.h"
+
+#include <algorithm>
+#include <cmath>
+
+ScanMatcher::ScanMatcher()
+{
+    linearWindow = 0.3;
+    angularWindow = 5.0;
+    angularStep = 0.5;
+    numLevels = 4;
+    minScore = 0.6;
+    translationCost = 1.0;
+    rotationCost = 0.1;
+
+    numAngles_ = 0;
+    windowCells_ = 0;
+    scale_ = 1;
+    bestScore_ = 0.0;
+}
+
+float ScanMatcher::getLastScore()
+{
+    return bestScore_;
+}
+
+bool ScanMatcher::match(Grid* grid, const LaserPointCloud& points, const Pose& guess, Pose& result)
+{
+    int half = grid->getMapWidth()/2;
+    OccupancyLookup occupancy = [grid, half](int x, int y) -> float {
+        if(x <= -half || x > half || y <= -half || y > half)
+            return 0.0;
+        return grid->getCell(x,y)->occupancy;
+    };
+    return match(occupancy, grid->getMapScale(), points, guess, result);
+}
+
+bool ScanMatcher::match(const OccupancyLookup& occupancy, int scale, const LaserPointCloud& points, const Pose& guess, Pose& result)
+{
+    result = guess;
+    bestScore_ = 0.0;
+    scale_ = scale;
+
+    rotateScan(points, guess, scale);
+    if(offsetsX_.empty() || offsetsX_[0].empty())
+        return false;
+
+    // the hits of any candidate stay within the window plus the longest reading
+    int maxOffset = 0;
+    for(int a=0; a<numAngles_; a++)
+        for(unsigned int i=0; i<offsetsX_[a].size(); i++)
+            maxOffset = std::max(maxOffset, std::max(abs(offsetsX_[a][i]), abs(offsetsY_[a][i])));
+
+    int robotX = guess.x*scale;
+    int robotY = guess.y*scale;
+    buildLikelihoodGrids(occupancy, robotX, robotY, windowCells_ + maxOffset);
+
+    // the guess itself has to be beaten, ties keep it
+    Candidate center;
+    center.angle = numAngles_/2;
+    center.x = center.y = 0;
+    center.score = getScore(0, center);
+    best_ = center;
+    bestScore_ = std::max(minScore, center.score);
+
+    int top = levels_.size()-1;
+    int step = 1 << top;
+    std::vector<Candidate> candidates;
+    for(int a=0; a<numAngles_; a++)
+        for(int x=-windowCells_; x<=windowCells_; x+=step)
+            for(int y=-windowCells_; y<=windowCells_; y+=step){
+                Candidate c;
+                c.angle = a;
+                c.x = x;
+                c.y = y;
+                c.score = getScore(top, c);
+                candidates.push_back(c);
+            }
+    search(candidates, top);
+
+    if(best_.x == 0 && best_.y == 0 && best_.angle == numAngles_/2){
+        bestScore_ = center.score;
+        return false;
+    }
+
+    result.x = guess.x + (float)best_.x/scale;
+    result.y = guess.y + (float)best_.y/scale;
+    result.theta = normalizeAngleDEG(guess.theta + (best_.angle - numAngles_/2)*angularStep);
+    return true;
+}
+
+// Depth-first, best candidates first: a candidate whose bound does not beat the best match
+// so far is pruned together with the rest of the (sorted) list
+void ScanMatcher::search(std::vector<Candidate>& candidates, int level)
+{
+    std::sort(candidates.begin(), candidates.end());
+
+    for(unsigned int i=0; i<candidates.size(); i++){
+        const Candidate& c = candidates[i];
+        if(c.score <= bestScore_)
+            break;
+
+        if(level == 0){
+            best_ = c;
+            bestScore_ = c.score;
+            continue;
+        }
+
+        int half = 1 << (level-1);
+        std::vector<Candidate> children;
+        for(int dx=0; dx<=half; dx+=half)
+            for(int dy=0; dy<=half; dy+=half){
+                Candidate child = c;
+                child.x += dx;
+                child.y += dy;
+                if(child.x > windowCells_ || child.y > windowCells_)
+                    continue;
+                child.score = getScore(level-1, child);
+                children.push_back(child);
+            }
+        search(children, level-1);
+    }
+}
+
+// Smallest penalty of the translations covered by the candidate (a 2^level block)
+float ScanMatcher::getPenalty(int level, const Candidate& c)
+{
+    int lastX = std::min(c.x + (1 << level) - 1, windowCells_);
+    int lastY = std::min(c.y + (1 << level) - 1, windowCells_);
+    int minX = (c.x > 0) ? c.x : (lastX < 0 ? -lastX : 0);
+    int minY = (c.y > 0) ? c.y : (lastY < 0 ? -lastY : 0);
+    return translationCost*sqrt((float)(minX*minX + minY*minY))/scale_ + rotationCost*fabs((c.angle - numAngles_/2)*angularStep);
+}
+
+float ScanMatcher::getScore(int level, const Candidate& c)
+{
+    const std::vector<int>& ox = offsetsX_[c.angle];
+    const std::vector<int>& oy = offsetsY_[c.angle];
+    const float* l = &levels_[level][0];
+
+    // offsets are relative to the center of the likelihood grids
+    int base = (c.y + size_/2)*size_ + c.x + size_/2;
+    float sum = 0.0;
+    for(unsigned int i=0; i<ox.size(); i++)
+        sum += l[base + oy[i]*size_ + ox[i]];
+    return sum/ox.size() - getPenalty(level, c);
+}
+
+void ScanMatcher::rotateScan(const LaserPointCloud& points, const Pose& guess, int scale)
+{
+    windowCells_ = ceil(linearWindow*scale);
+    int n = std::max(0, (int)(angularWindow/angularStep + 0.5));
+    numAngles_ = 2*n+1;
+
+    offsetsX_.resize(numAngles_);
+    offsetsY_.resize(numAngles_);
+    for(int a=0; a<numAngles_; a++){
+        float theta = DEG2RAD((guess.theta + (a-n)*angularStep));
+        float c = cos(theta), s = sin(theta);
+
+        offsetsX_[a].clear();
+        offsetsY_[a].clear();
+        for(int k=0; k<points.size(); k++){
+            if(!points.hit[k])
+                continue;
+            offsetsX_[a].push_back(lround((c*points.x[k] - s*points.y[k])*scale));
+            offsetsY_[a].push_back(lround((s*points.x[k] + c*points.y[k])*scale));
+        }
+    }
+}
+
+void ScanMatcher::buildLikelihoodGrids(const OccupancyLookup& occupancy, int centerX, int centerY, int halfWidth)
+{
+    int numLevels = std::max(1, this->numLevels);
+    int pad = 1 << (numLevels-1);
+
+    // level h is read up to 2^h-1 cells beyond the window, and is pooled from level h-1
+    size_ = 2*(halfWidth + pad) + 1;
+    originX_ = centerX - size_/2;
+    originY_ = centerY - size_/2;
+
+    levels_.resize(numLevels);
+    levels_[0].resize(size_*size_);
+    for(int j=0; j<size_; j++)
+        for(int i=0; i<size_; i++)
+            levels_[0][j*size_ + i] = occupancy(originX_ + i, originY_ + j);
+
+    for(int h=1; h<numLevels; h++){
+        int d = 1 << (h-1);
+        const std::vector<float>& prev = levels_[h-1];
+        std::vector<float>& cur = levels_[h];
+        cur.assign(size_*size_, 0.0);
+        for(int j=0; j+d<size_; j++)
+            for(int i=0; i+d<size_; i++){
+                int p = j*size_ + i;
+                cur[p] = std::max(std::max(prev[p], prev[p+d]), std::max(prev[p+d*size_], prev[p+d*size_+d]));
+            }
+    }
+}
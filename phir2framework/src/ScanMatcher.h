@@ -0,0 +1,73 @@
+#ifndef SCANMATCHER_H
+#define SCANMATCHER_H
+
+#include <functional>
+#include <vector>
+
+#include "Grid.h"
+#include "Utils.h"
+
+// Real-time correlative scan matcher: finds the pose near a guess where the laser hits fall
+// on the most occupied cells of the grid, searching x, y (one cell steps) and theta (angularStep)
+// exhaustively within the window, but with branch-and-bound.
+//
+// Around the guess the occupancies are copied to a likelihood grid, and coarser grids are
+// max-pooled from it: level h holds, for each cell, the maximum over the 2^h x 2^h block
+// starting there. The score of a scan on level h bounds the score of all the translations
+// of that block, so the search starts with 2^h-cell steps and only splits the blocks that
+// can still beat the best full-resolution match.
+//
+// The map is built from the corrected poses themselves, so a wall smeared over two cells would
+// let the pose wander by a cell at a time: every candidate pays a cost for its distance to the
+// guess, and a block is bounded with the cost of its translation closest to the guess.
+class ScanMatcher
+{
+    public:
+        ScanMatcher();
+
+        // Best pose of the scan (robot-frame hits) in the grid near 'guess'. Returns false and keeps
+        // the guess when no candidate scores (cost included) above minScore and above the guess itself.
+        bool match(Grid* grid, const LaserPointCloud& points, const Pose& guess, Pose& result);
+
+        // Same, against any map: occupancy of cell (x,y), in cells of 1/scale m, 0 where there is no map
+        typedef std::function<float(int x, int y)> OccupancyLookup;
+        bool match(const OccupancyLookup& occupancy, int scale, const LaserPointCloud& points, const Pose& guess, Pose& result);
+
+        float getLastScore();
+
+        // Search parameters
+        float linearWindow;  // m, on each side of the guess
+        float angularWindow; // deg, on each side of the guess
+        float angularStep;   // deg
+        int numLevels;       // resolutions of the likelihood grid, 1 is the plain exhaustive search
+        float minScore;      // mean occupancy under the hits, to accept a match
+        float translationCost, rotationCost; // subtracted from the score, per m and per deg away from the guess
+
+    private:
+        class Candidate
+        {
+            public:
+                int angle, x, y; // angle index, offsets in cells
+                float score;
+                bool operator<(const Candidate& c) const { return score > c.score; }
+        };
+
+        void buildLikelihoodGrids(const OccupancyLookup& occupancy, int centerX, int centerY, int halfWidth);
+        void rotateScan(const LaserPointCloud& points, const Pose& guess, int scale);
+        float getScore(int level, const Candidate& c);
+        float getPenalty(int level, const Candidate& c);
+        void search(std::vector<Candidate>& candidates, int level);
+
+        // likelihood grids, row by row from (originX_, originY_)
+        std::vector< std::vector<float> > levels_;
+        int originX_, originY_, size_;
+
+        // offsets in cells of the hits, for each angle of the search
+        std::vector< std::vector<int> > offsetsX_, offsetsY_;
+        int numAngles_, windowCells_, scale_;
+
+        Candidate best_;
+        float bestScore_;
+};
+
+#endif // SCANMATCHER_H
@@ -0,0 +1,350 @@
+#include "SegmentGrid.h"
+
+#include <cmath>
+#include <float.h> // FLT_MAX
+#include <algorithm>
+
+bool intersectRay(float ox, float oy, float dx, float dy, const Segment& s, float& t)
+{
+    float ex = s.x2 - s.x1;
+    float ey = s.y2 - s.y1;
+    float den = dx*ey - dy*ex;
+    if(den == 0.0)
+        return false;
+
+    float wx = s.x1 - ox;
+    float wy = s.y1 - oy;
+    float tr = (wx*ey - wy*ex)/den; // position along the ray
+    float u  = (wx*dy - wy*dx)/den; // position along the segment
+
+    // small tolerance so rays through the corner shared by two segments do not leak
+    if(tr < 0.0 || u < -1e-5 || u > 1.0+1e-5)
+        return false;
+
+    t = tr;
+    return true;
+}
+
+float distanceToSegment(float x, float y, const Segment& s)
+{
+    float ex = s.x2 - s.x1;
+    float ey = s.y2 - s.y1;
+    float len2 = ex*ex + ey*ey;
+    float u = 0.0;
+    if(len2 > 0.0)
+        u = std::max(0.0f, std::min(1.0f, ((x-s.x1)*ex + (y-s.y1)*ey)/len2));
+
+    float px = s.x1 + u*ex - x;
+    float py = s.y1 + u*ey - y;
+    return sqrt(px*px + py*py);
+}
+
+// Liang-Barsky clipping of the parametric interval [t0,t1] of o+t*d against [lo,hi]
+static bool clipSlab(float o, float d, float lo, float hi, float& t0, float& t1)
+{
+    if(d == 0.0)
+        return o >= lo && o <= hi;
+
+    float ta = (lo-o)/d;
+    float tb = (hi-o)/d;
+    if(ta > tb)
+        std::swap(ta,tb);
+    t0 = std::max(t0,ta);
+    t1 = std::min(t1,tb);
+    return t0 <= t1;
+}
+
+static bool segmentIntersectsBox(const Segment& s, float x0, float y0, float x1, float y1)
+{
+    float t0 = 0.0, t1 = 1.0;
+    return clipSlab(s.x1, s.x2-s.x1, x0, x1, t0, t1) &&
+           clipSlab(s.y1, s.y2-s.y1, y0, y1, t0, t1);
+}
+
+// Angle a measured in the direction of the beams' increment, in [0, 2pi)
+static float relativeAngle(float a, float sign)
+{
+    a = fmod(sign*a, (float)(2*M_PI));
+    if(a < 0.0)
+        a += 2*M_PI;
+    return a;
+}
+
+SegmentGrid::SegmentGrid()
+{
+    lines_ = NULL;
+    cellSize_ = 1.0;
+    minX_ = minY_ = 0.0;
+    width_ = height_ = 0;
+    currentStamp_ = 0;
+    tableFirstAngle_ = tableIncrement_ = 0.0;
+}
+
+void SegmentGrid::build(const std::vector<Segment>& lines, float cellSize)
+{
+    lines_ = &lines;
+    cellSize_ = cellSize;
+
+    float maxX, maxY;
+    minX_ = minY_ = FLT_MAX;
+    maxX = maxY = -FLT_MAX;
+    for(unsigned int s=0; s<lines.size(); s++){
+        minX_ = std::min(minX_, std::min(lines[s].x1, lines[s].x2));
+        minY_ = std::min(minY_, std::min(lines[s].y1, lines[s].y2));
+        maxX = std::max(maxX, std::max(lines[s].x1, lines[s].x2));
+        maxY = std::max(maxY, std::max(lines[s].y1, lines[s].y2));
+    }
+    if(lines.empty())
+        minX_ = minY_ = maxX = maxY = 0.0;
+
+    minX_ -= cellSize_;
+    minY_ -= cellSize_;
+    width_ = (int)ceil((maxX - minX_)/cellSize_) + 1;
+    height_ = (int)ceil((maxY - minY_)/cellSize_) + 1;
+
+    // two passes: count the segments of each cell, then fill the compressed rows
+    cellStart_.assign(width_*height_+1, 0);
+    std::vector<int> fill;
+    for(int pass=0; pass<2; pass++){
+        for(unsigned int s=0; s<lines.size(); s++){
+            const Segment& seg = lines[s];
+            int cx0 = (int)floor((std::min(seg.x1,seg.x2) - minX_)/cellSize_);
+            int cx1 = (int)floor((std::max(seg.x1,seg.x2) - minX_)/cellSize_);
+            int cy0 = (int)floor((std::min(seg.y1,seg.y2) - minY_)/cellSize_);
+            int cy1 = (int)floor((std::max(seg.y1,seg.y2) - minY_)/cellSize_);
+
+            for(int cy=cy0; cy<=cy1; cy++){
+                for(int cx=cx0; cx<=cx1; cx++){
+                    float bx = minX_ + cx*cellSize_;
+                    float by = minY_ + cy*cellSize_;
+                    if(!segmentIntersectsBox(seg, bx-1e-4, by-1e-4, bx+cellSize_+1e-4, by+cellSize_+1e-4))
+                        continue;
+
+                    int c = cy*width_ + cx;
+                    if(pass==0)
+                        cellStart_[c+1]++;
+                    else
+                        cellSegments_[fill[c]++] = s;
+                }
+            }
+        }
+
+        if(pass==0){
+            for(int c=0; c<width_*height_; c++)
+                cellStart_[c+1] += cellStart_[c];
+            cellSegments_.resize(cellStart_[width_*height_]);
+            fill.assign(cellStart_.begin(), cellStart_.end()-1);
+        }
+    }
+
+    stamp_.assign(lines.size(), 0);
+    currentStamp_ = 0;
+}
+
+void SegmentGrid::newQuery()
+{
+    currentStamp_++;
+    if(currentStamp_ == 0){
+        std::fill(stamp_.begin(), stamp_.end(), 0);
+        currentStamp_ = 1;
+    }
+}
+
+float SegmentGrid::castRay(float x, float y, float angle, float maxRange)
+{
+    if(lines_ == NULL)
+        return maxRange;
+
+    float dx = cos(angle);
+    float dy = sin(angle);
+
+    // clip the ray to the grid bounds
+    float t0 = 0.0, t1 = maxRange;
+    if(!clipSlab(x, dx, minX_, minX_ + width_*cellSize_, t0, t1) ||
+       !clipSlab(y, dy, minY_, minY_ + height_*cellSize_, t0, t1))
+        return maxRange;
+
+    newQuery();
+
+    float gx = (x + t0*dx - minX_)/cellSize_;
+    float gy = (y + t0*dy - minY_)/cellSize_;
+    int cx = std::min(std::max((int)floor(gx), 0), width_-1);
+    int cy = std::min(std::max((int)floor(gy), 0), height_-1);
+
+    int stepX = (dx >= 0.0) ? 1 : -1;
+    int stepY = (dy >= 0.0) ? 1 : -1;
+    float tDeltaX = (dx != 0.0) ? cellSize_/fabs(dx) : FLT_MAX;
+    float tDeltaY = (dy != 0.0) ? cellSize_/fabs(dy) : FLT_MAX;
+    float tMaxX = (dx != 0.0) ? t0 + ((dx > 0.0) ? (cx+1-gx) : (gx-cx))*tDeltaX : FLT_MAX;
+    float tMaxY = (dy != 0.0) ? t0 + ((dy > 0.0) ? (cy+1-gy) : (gy-cy))*tDeltaY : FLT_MAX;
+
+    float range = maxRange;
+    float t;
+    while(true){
+        int c = cy*width_ + cx;
+        for(int j=cellStart_[c]; j<cellStart_[c+1]; j++){
+            int s = cellSegments_[j];
+            if(stamp_[s] == currentStamp_)
+                continue;
+            stamp_[s] = currentStamp_;
+            if(intersectRay(x, y, dx, dy, (*lines_)[s], t) && t < range)
+                range = t;
+        }
+
+        // a hit inside the current cell cannot be beaten by the next cells
+        float tExit = std::min(tMaxX, tMaxY);
+        if(range <= tExit || tExit >= t1)
+            break;
+
+        if(tMaxX < tMaxY){
+            cx += stepX;
+            tMaxX += tDeltaX;
+        }else{
+            cy += stepY;
+            tMaxY += tDeltaY;
+        }
+        if(cx < 0 || cx >= width_ || cy < 0 || cy >= height_)
+            break;
+    }
+
+    return range;
+}
+
+void SegmentGrid::castScan(float x, float y, float heading, float firstAngle, float angleIncrement,
+                           int numBeams, float maxRange, std::vector<float>& ranges)
+{
+    ranges.assign(numBeams, maxRange);
+    if(lines_ == NULL || numBeams <= 0)
+        return;
+
+    if((int)cosTable_.size() != numBeams || tableFirstAngle_ != firstAngle || tableIncrement_ != angleIncrement){
+        cosTable_.resize(numBeams);
+        sinTable_.resize(numBeams);
+        for(int k=0; k<numBeams; k++){
+            cosTable_[k] = cos(firstAngle + k*angleIncrement);
+            sinTable_[k] = sin(firstAngle + k*angleIncrement);
+        }
+        tableFirstAngle_ = firstAngle;
+        tableIncrement_ = angleIncrement;
+        beamDirX_.resize(numBeams);
+        beamDirY_.resize(numBeams);
+    }
+
+    float ch = cos(heading);
+    float sh = sin(heading);
+    for(int k=0; k<numBeams; k++){
+        beamDirX_[k] = ch*cosTable_[k] - sh*sinTable_[k];
+        beamDirY_[k] = sh*cosTable_[k] + ch*sinTable_[k];
+    }
+
+    newQuery();
+
+    int ox = (int)floor((x - minX_)/cellSize_);
+    int oy = (int)floor((y - minY_)/cellSize_);
+
+    // rings beyond the range or beyond the grid are empty
+    int lastRing = (int)ceil(maxRange/cellSize_) + 1;
+    int farthest = std::max(std::max(abs(ox), abs(width_-1-ox)), std::max(abs(oy), abs(height_-1-oy)));
+    lastRing = std::min(lastRing, farthest);
+
+    for(int k=0; k<=lastRing; k++){
+        for(int cy=oy-k; cy<=oy+k; cy++){
+            if(cy < 0 || cy >= height_)
+                continue;
+
+            // full rows at the top and bottom of the ring, only both ends in between
+            int step = (k==0 || cy==oy-k || cy==oy+k) ? 1 : 2*k;
+            for(int cx=ox-k; cx<=ox+k; cx+=step){
+                if(cx < 0 || cx >= width_)
+                    continue;
+
+                int c = cy*width_ + cx;
+                for(int j=cellStart_[c]; j<cellStart_[c+1]; j++){
+                    int s = cellSegments_[j];
+                    if(stamp_[s] == currentStamp_)
+                        continue;
+                    stamp_[s] = currentStamp_;
+                    rasterizeSegment(s, x, y, heading+firstAngle, angleIncrement, numBeams, ranges);
+                }
+            }
+        }
+
+        // segments not seen yet are at least k cells away, beams shorter than that are final
+        float closed = k*cellSize_;
+        bool open = false;
+        for(int i=0; i<numBeams && !open; i++)
+            open = ranges[i] > closed;
+        if(!open)
+            break;
+    }
+}
+
+void SegmentGrid::rasterizeSegment(int s, float x, float y, float startAngle, float angleIncrement,
+                                   int numBeams, std::vector<float>& ranges)
+{
+    const Segment& seg = (*lines_)[s];
+    float sign = (angleIncrement > 0.0) ? 1.0 : -1.0;
+    float inc = fabs(angleIncrement);
+    const float eps = 1e-3; // beams next to the endpoints are tested, intersectRay decides
+
+    // angular interval covered by the segment, relative to the first beam
+    float r0 = relativeAngle(atan2(seg.y1-y, seg.x1-x) - startAngle, sign);
+    float r1 = relativeAngle(atan2(seg.y2-y, seg.x2-x) - startAngle, sign);
+    float lo = std::min(r0,r1);
+    float hi = std::max(r0,r1);
+
+    int first[3], last[3];
+    int numIntervals = 0;
+    if(hi - lo <= M_PI){
+        first[numIntervals] = (int)ceil((lo-eps)/inc);
+        last[numIntervals++] = (int)floor((hi+eps)/inc);
+        if(hi + eps >= 2*M_PI){
+            first[numIntervals] = 0;
+            last[numIntervals++] = 0;
+        }
+    }else{
+        // the segment crosses the direction of the first beam
+        first[numIntervals] = (int)ceil((hi-eps)/inc);
+        last[numIntervals++] = numBeams-1;
+        first[numIntervals] = 0;
+        last[numIntervals++] = (int)floor((lo+eps)/inc);
+    }
+
+    float t;
+    for(int n=0; n<numIntervals; n++){
+        int i0 = std::max(first[n], 0);
+        int i1 = std::min(last[n], numBeams-1);
+        for(int i=i0; i<=i1; i++)
+            if(intersectRay(x, y, beamDirX_[i], beamDirY_[i], seg, t) && t < ranges[i])
+                ranges[i] = t;
+    }
+}
+
+float SegmentGrid::getDistanceToNearestLine(float x, float y, float maxDist)
+{
+    float d = maxDist;
+    if(lines_ == NULL)
+        return d;
+
+    newQuery();
+
+    int cx0 = std::max((int)floor((x - maxDist - minX_)/cellSize_), 0);
+    int cx1 = std::min((int)floor((x + maxDist - minX_)/cellSize_), width_-1);
+    int cy0 = std::max((int)floor((y - maxDist - minY_)/cellSize_), 0);
+    int cy1 = std::min((int)floor((y + maxDist - minY_)/cellSize_), height_-1);
+
+    for(int cy=cy0; cy<=cy1; cy++){
+        for(int cx=cx0; cx<=cx1; cx++){
+            int c = cy*width_ + cx;
+            for(int j=cellStart_[c]; j<cellStart_[c+1]; j++){
+                int s = cellSegments_[j];
+                if(stamp_[s] == currentStamp_)
+                    continue;
+                stamp_[s] = currentStamp_;
+                d = std::min(d, distanceToSegment(x, y, (*lines_)[s]));
+            }
+        }
+    }
+
+    return d;
+}
@@ -0,0 +1,61 @@
+#ifndef SEGMENTGRID_H
+#define SEGMENTGRID_H
+
+#include <vector>
+
+class Segment
+{
+    public:
+        float x1, y1, x2, y2; // in meters
+};
+
+// Uniform grid over a set of segments, used to ray cast against the .map line sets.
+// Queries keep per-segment stamps, so a SegmentGrid must be queried by one thread at a time.
+class SegmentGrid
+{
+    public:
+        SegmentGrid();
+
+        void build(const std::vector<Segment>& lines, float cellSize=1.0);
+
+        // Single ray, cells are visited in order (DDA) and the traversal stops at the first hit
+        float castRay(float x, float y, float angle, float maxRange);
+
+        // Whole scan of coherent rays sharing the same origin: beam k has angle
+        // heading + firstAngle + k*angleIncrement (radians). Cells are visited in rings
+        // around the origin and every segment found is rasterized into the beams it spans,
+        // so each segment is intersected only with the beams that can hit it.
+        void castScan(float x, float y, float heading, float firstAngle, float angleIncrement,
+                      int numBeams, float maxRange, std::vector<float>& ranges);
+
+        float getDistanceToNearestLine(float x, float y, float maxDist);
+
+    private:
+        const std::vector<Segment>* lines_;
+
+        float cellSize_;
+        float minX_, minY_;
+        int width_, height_;
+
+        // segments of each cell, in compressed rows: cellSegments_[cellStart_[c]..cellStart_[c+1]-1]
+        std::vector<int> cellStart_;
+        std::vector<int> cellSegments_;
+
+        // avoids testing a segment twice in the same query
+        std::vector<unsigned int> stamp_;
+        unsigned int currentStamp_;
+        void newQuery();
+
+        // beam directions relative to the heading, cached between scans
+        float tableFirstAngle_, tableIncrement_;
+        std::vector<float> cosTable_, sinTable_;
+        std::vector<float> beamDirX_, beamDirY_;
+
+        void rasterizeSegment(int s, float x, float y, float startAngle, float angleIncrement,
+                              int numBeams, std::vector<float>& ranges);
+};
+
+bool intersectRay(float ox, float oy, float dx, float dy, const Segment& s, float& t);
+float distanceToSegment(float x, float y, const Segment& s);
+
+#endif // SEGMENTGRID_H
@@ -0,0 +1,364 @@
+#ifndef SENSORMODELS_H
+#define SENSORMODELS_H
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "Grid.h"
+#include "Robot.h"
+
+// Inverse sensor models as policy classes, plugged into the templated kernel mapScan().
+//
+// The kernel sweeps the window around the robot once and computes the geometry of each cell
+// (CellGeometry); every model then updates the cell with update(cell, geometry). A model also
+// tells the kernel how far it reaches (getWindow). Adding a model means writing one of these
+// classes, the traversal is not touched.
+//
+// The sonar lookups of PioneerBase are repeated here as inline functions over the raw readings,
+// and the laser ones are the inline table lookups of LaserDescription, so the whole per-cell
+// work of the kernel is visible to the compiler.
+
+inline float occupancyFromLogOdds(float logodds)
+{
+    return 1.0 - 1.0/(1.0+exp(logodds));
+}
+
+inline float logOddsFromOccupancy(float occupancy)
+{
+    return log(occupancy/(1.0-occupancy));
+}
+
+// Sonar layout of the Pioneer (same as PioneerBase::getNearestSonarBeam / getAngleOfSonarBeam),
+// the laser layout comes from its LaserDescription
+constexpr int NUM_SONAR_BEAMS = 8;
+constexpr float SONAR_BEAM_ANGLES[NUM_SONAR_BEAMS] = {90, 50, 30, 10, -10, -30, -50, -90};
+// angles for which each beam is the nearest one (see ScanView::nearestSonarBeam)
+constexpr float SONAR_SECTOR_MIN[NUM_SONAR_BEAMS] = {70, 40, 20, 0, -20, -40, -70, -180};
+constexpr float SONAR_SECTOR_MAX[NUM_SONAR_BEAMS] = {180, 70, 40, 20, 0, -20, -40, -70};
+
+// Occupancy of a cell at the hit and before it
+constexpr float CONE_P_OCCUPIED = 0.9, CONE_P_FREE = 0.1;
+constexpr float GAUSSIAN_P_PEAK = 0.9, GAUSSIAN_P_FREE = 0.3;
+
+// Bounds of the HIMM counts and of the sonar occupancy
+constexpr int HIMM_MAX = 15;
+constexpr float SONAR_P_MIN = 0.01, SONAR_P_MAX = 0.99;
+
+// The beam widths, the HIMM steps and the Gaussian sigma are RobotParameters, swept at run
+// time by the batch runner, so the models take them in their constructors
+
+class ScanView
+{
+    public:
+        ScanView(const std::vector<float>& l, const std::vector<float>& s, const LaserDescription& d, float maxSonar)
+            : lasers(&l[0]), sonars(&s[0]), laser(d), maxLaserRange(d.getMaxRange()), maxSonarRange(maxSonar) {}
+
+        int nearestLaserBeam(float angle) const { return laser.getNearestBeam(angle); }
+        float laserBeamAngle(int k) const { return laser.getAngleOfBeam(k); }
+
+        static int nearestSonarBeam(float angle)
+        {
+            if(angle > 70.0)  return 0;
+            if(angle > 40.0)  return 1;
+            if(angle > 20.0)  return 2;
+            if(angle > 0.0)   return 3;
+            if(angle > -20.0) return 4;
+            if(angle > -40.0) return 5;
+            if(angle > -70.0) return 6;
+            return 7;
+        }
+        static float sonarBeamAngle(int k) { return SONAR_BEAM_ANGLES[k]; }
+
+        const float* lasers;
+        const float* sonars;
+        const LaserDescription& laser;
+        float maxLaserRange, maxSonarRange; // m
+};
+
+class CellGeometry
+{
+    public:
+        int dx, dy;  // cells from the robot
+        int d2;      // squared distance, in cells
+        float r;     // m
+        float phi;   // deg, relative to the robot heading
+};
+
+// HIMM: the cell hit by a laser beam is incremented, cells crossed by the beam are decremented
+class LaserHIMMModel
+{
+    public:
+        LaserHIMMModel(const RobotParameters& p, const ScanView& s, int scale)
+            : enabled(p.useHIMM), scan(s), rangeInt(s.maxLaserRange*scale),
+              halfR(p.himmLambdaR/2), halfPhi(p.himmLambdaPhi/2),
+              increment(p.himmIncrement), decrement(p.himmDecrement) {}
+
+        int getWindow() const { return enabled ? rangeInt : 0; }
+
+        void update(Cell* cell, const CellGeometry& g) const
+        {
+            if(!enabled || abs(g.dx) > rangeInt || abs(g.dy) > rangeInt)
+                return;
+
+            int k = scan.nearestLaserBeam(g.phi);
+            float z = scan.lasers[k];
+            if(fabs(g.phi - scan.laserBeamAngle(k)) > halfPhi || g.r > std::min(scan.maxLaserRange, z))
+                return;
+
+            if(z < scan.maxLaserRange && fabs(g.r - z) < halfR)
+                cell->himm = std::min(cell->himm + increment, HIMM_MAX);
+            else
+                cell->himm = std::max(cell->himm - decrement, 0);
+        }
+
+        bool enabled;
+
+    private:
+        const ScanView& scan;
+        const int rangeInt;
+        const float halfR, halfPhi;
+        const int increment, decrement;
+};
+
+// Log-odds with a cone model: 0.9 at the hit, 0.1 before it
+class LaserLogOddsModel
+{
+    public:
+        LaserLogOddsModel(const RobotParameters& p, const ScanView& s, int scale)
+            : enabled(p.useLogOdds), scan(s), rangeInt(s.maxLaserRange*scale),
+              halfR(p.logOddsLambdaR/2), halfPhi(p.logOddsLambdaPhi/2),
+              logOddsOcc(logOddsFromOccupancy(CONE_P_OCCUPIED)), logOddsFree(logOddsFromOccupancy(CONE_P_FREE)) {}
+
+        int getWindow() const { return enabled ? rangeInt : 0; }
+
+        void update(Cell* cell, const CellGeometry& g) const
+        {
+            if(!enabled || g.d2 >= rangeInt*rangeInt)
+                return;
+
+            // outside the beam the update would be 0.5, which adds nothing
+            int k = scan.nearestLaserBeam(g.phi);
+            float z = scan.lasers[k];
+            if(fabs(g.phi - scan.laserBeamAngle(k)) > halfPhi || g.r > std::min(scan.maxLaserRange, z))
+                return;
+
+            if(z < scan.maxLaserRange && fabs(g.r - z) < halfR)
+                cell->logodds += logOddsOcc;
+            else
+                cell->logodds += logOddsFree;
+            cell->occupancy = occupancyFromLogOdds(cell->logodds);
+        }
+
+        bool enabled;
+
+    private:
+        const ScanView& scan;
+        const int rangeInt;
+        const float halfR, halfPhi;
+        const float logOddsOcc, logOddsFree;
+};
+
+// Log-odds with a Gaussian beam: around a hit the occupancy peaks at the measured range and
+// decays with the range error (sigma), instead of the hard band of LaserLogOddsModel
+class LaserGaussianModel
+{
+    public:
+        LaserGaussianModel(const RobotParameters& p, const ScanView& s, int scale)
+            : enabled(p.useLogOdds), scan(s), rangeInt(s.maxLaserRange*scale),
+              halfPhi(p.logOddsLambdaPhi/2), threeSigma(3*p.gaussianLaserSigma),
+              inv2Sigma2(1.0/(2*p.gaussianLaserSigma*p.gaussianLaserSigma)),
+              logOddsFree(logOddsFromOccupancy(GAUSSIAN_P_FREE)) {}
+
+        int getWindow() const { return enabled ? rangeInt : 0; }
+
+        void update(Cell* cell, const CellGeometry& g) const
+        {
+            if(!enabled || g.d2 >= rangeInt*rangeInt)
+                return;
+
+            int k = scan.nearestLaserBeam(g.phi);
+            float z = scan.lasers[k];
+            bool hit = z < scan.maxLaserRange;
+            if(fabs(g.phi - scan.laserBeamAngle(k)) > halfPhi ||
+               g.r > std::min(scan.maxLaserRange, hit ? z + threeSigma : z))
+                return;
+
+            float d = g.r - z;
+            if(!hit || d < -threeSigma){
+                cell->logodds += logOddsFree;
+            }else{
+                float base = (d < 0) ? GAUSSIAN_P_FREE : 0.5f;
+                float p = base + (GAUSSIAN_P_PEAK - base)*exp(-d*d*inv2Sigma2);
+                cell->logodds += logOddsFromOccupancy(p);
+            }
+            cell->occupancy = occupancyFromLogOdds(cell->logodds);
+        }
+
+        bool enabled;
+
+    private:
+        const ScanView& scan;
+        const int rangeInt;
+        const float halfPhi, threeSigma, inv2Sigma2;
+        const float logOddsFree;
+};
+
+// Bayesian sonar cone: the update decays with the distance and with the angle to the beam axis
+class SonarBayesModel
+{
+    public:
+        SonarBayesModel(const RobotParameters& p, const ScanView& s, int scale)
+            : enabled(p.useSonar), scan(s), rangeInt(s.maxSonarRange*scale),
+              halfR(p.sonarLambdaR/2), halfPhi(p.sonarLambdaPhi/2) {}
+
+        int getWindow() const { return enabled ? rangeInt : 0; }
+
+        void update(Cell* cell, const CellGeometry& g) const
+        {
+            if(!enabled || abs(g.dx) > rangeInt || abs(g.dy) > rangeInt)
+                return;
+
+            int k = ScanView::nearestSonarBeam(g.phi);
+            float z = scan.sonars[k];
+            float alpha = fabs(g.phi - ScanView::sonarBeamAngle(k));
+            if(alpha > halfPhi)
+                return;
+
+            float R = scan.maxSonarRange;
+            float mainTerm = (((R-g.r)/R) + ((halfPhi-alpha)/halfPhi))/2;
+            float occUpdate;
+            if(z < scan.maxSonarRange && fabs(g.r - z) < halfR)
+                occUpdate = 0.5 * mainTerm + 0.5;
+            else if(g.r <= z)
+                occUpdate = 0.5 * (1 - mainTerm);
+            else
+                return;
+
+            cell->occupancySonar = (occUpdate * cell->occupancySonar) /
+                                    ((occUpdate * cell->occupancySonar) + ((1.0 - occUpdate) * (1.0 - cell->occupancySonar)));
+
+            if(cell->occupancySonar > SONAR_P_MAX) cell->occupancySonar = SONAR_P_MAX;
+            if(cell->occupancySonar < SONAR_P_MIN) cell->occupancySonar = SONAR_P_MIN;
+
+            // both sonar layers stay in sync, as in mappingUsingSonar()
+            cell->logoddsSonar = log(cell->occupancySonar/(1.0-cell->occupancySonar));
+        }
+
+        bool enabled;
+
+    private:
+        const ScanView& scan;
+        const int rangeInt;
+        const float halfR, halfPhi;
+};
+
+// Cells of a square window sorted by their angle around the center, built once per window.
+// A sonar cone is then a run of the list (two when it wraps around 180 degrees) found by
+// binary search, and the distance and angle of each cell come from the table instead of
+// sqrt and atan2. The values are computed as in mappingUsingSonar, so the cells selected
+// and their updates are the same.
+class SonarConeStamps
+{
+    public:
+        class StampCell
+        {
+            public:
+                int dx, dy;
+                float r;      // m
+                double angle; // deg, in the grid frame (not normalized against the robot)
+                bool operator<(const StampCell& o) const { return angle < o.angle; }
+        };
+
+        SonarConeStamps() : rangeInt(-1), scale(0) {}
+
+        void build(int range, int s)
+        {
+            if(range == rangeInt && s == scale)
+                return;
+            rangeInt = range;
+            scale = s;
+
+            cells.clear();
+            cells.reserve((2*range+1)*(2*range+1));
+            for(int dx = -range; dx <= range; dx++)
+                for(int dy = -range; dy <= range; dy++){
+                    StampCell c;
+                    c.dx = dx;
+                    c.dy = dy;
+                    c.r = sqrt(pow(dx, 2) + pow(dy, 2)) / scale;
+                    c.angle = RAD2DEG(atan2(dy, dx));
+                    cells.push_back(c);
+                }
+            std::sort(cells.begin(), cells.end());
+        }
+
+        // Calls f(stampCell) for the cells whose angle is within [minAngle,maxAngle] (deg, less than 360 apart)
+        template<class F>
+        void forEachInArc(double minAngle, double maxAngle, F f) const
+        {
+            double width = maxAngle - minAngle;
+            minAngle = normalizeAngleDEG(minAngle);
+            maxAngle = minAngle + width;
+
+            forEachInRange(minAngle, std::min(maxAngle, 180.0), f);
+            if(maxAngle > 180.0)
+                forEachInRange(-180.0, maxAngle - 360.0, f);
+        }
+
+    private:
+        template<class F>
+        void forEachInRange(double minAngle, double maxAngle, F& f) const
+        {
+            StampCell key;
+            key.angle = minAngle;
+            std::vector<StampCell>::const_iterator it = std::lower_bound(cells.begin(), cells.end(), key);
+            for(; it != cells.end() && it->angle <= maxAngle; ++it)
+                f(*it);
+        }
+
+        std::vector<StampCell> cells;
+        int rangeInt, scale;
+};
+
+// Compile-time list of models
+inline int getWindow() { return 0; }
+
+template<class Model, class... Rest>
+inline int getWindow(const Model& m, const Rest&... rest)
+{
+    return std::max(m.getWindow(), getWindow(rest...));
+}
+
+inline void updateCell(Cell*, const CellGeometry&) {}
+
+template<class Model, class... Rest>
+inline void updateCell(Cell* cell, const CellGeometry& g, const Model& m, const Rest&... rest)
+{
+    m.update(cell, g);
+    updateCell(cell, g, rest...);
+}
+
+// Single sweep of the window reached by the models, around the robot at (robotX,robotY) cells,
+// row by row in the grid's memory order
+template<class... Models>
+void mapScan(Grid* grid, int robotX, int robotY, float robotAngle, const Models&... models)
+{
+    int scale = grid->getMapScale();
+    int rangeInt = getWindow(models...);
+
+    bbox window = {robotX - rangeInt, robotX + rangeInt, robotY - rangeInt, robotY + rangeInt};
+    CellGeometry g;
+    grid->forEachRow(window, [&](Cell* cell, int y, int minX, int maxX) {
+        g.dy = y - robotY;
+        for(g.dx = minX - robotX; g.dx <= maxX - robotX; g.dx++, cell++) {
+            g.d2 = g.dx*g.dx + g.dy*g.dy;
+            g.r = sqrt((double)g.d2) / scale;
+            g.phi = normalizeAngleDEG(RAD2DEG(atan2(g.dy, g.dx)) - robotAngle);
+
+            updateCell(cell, g, models...);
+        }
+    });
+}
+
+#endif // SENSORMODELS_H
@@ -0,0 +1,258 @@
+#include "Simulator.h"
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+////////////////////////////////////
+///// METHODS OF CLASS LINEMAP /////
+////////////////////////////////////
+
+LineMap::LineMap()
+{
+    minX = minY = maxX = maxY = 0.0;
+}
+
+bool LineMap::load(std::string filename)
+{
+    std::ifstream file(filename.c_str());
+    if(!file.is_open()){
+        std::cerr << "Error: could not open map " << filename << std::endl;
+        return false;
+    }
+
+    lines.clear();
+    home = Pose();
+
+    // coordinates are given in mm, we convert to m
+    std::string line;
+    bool readingLines = false;
+    while(getline(file,line)){
+        std::stringstream ss(line);
+        std::string key;
+        ss >> key;
+
+        if(key == "LINES"){
+            readingLines = true;
+        }else if(key == "DATA"){
+            readingLines = false;
+        }else if(readingLines){
+            float x1, y1, x2, y2;
+            std::stringstream sl(line);
+            if(sl >> x1 >> y1 >> x2 >> y2){
+                Segment s;
+                s.x1 = x1/1000.0; s.y1 = y1/1000.0;
+                s.x2 = x2/1000.0; s.y2 = y2/1000.0;
+                lines.push_back(s);
+            }
+        }else if(key == "LineMinPos:"){
+            ss >> minX >> minY;
+            minX /= 1000.0; minY /= 1000.0;
+        }else if(key == "LineMaxPos:"){
+            ss >> maxX >> maxY;
+            maxX /= 1000.0; maxY /= 1000.0;
+        }else if(key == "Cairn:"){
+            std::string type;
+            ss >> type;
+            if(type == "RobotHome"){
+                ss >> home.x >> home.y >> home.theta;
+                home.x /= 1000.0; home.y /= 1000.0;
+            }
+        }
+    }
+
+    index_.build(lines);
+
+    std::cout << "Loaded map " << filename << " with " << lines.size() << " lines" << std::endl;
+    return !lines.empty();
+}
+
+float LineMap::castRay(float x, float y, float angle, float maxRange)
+{
+    return index_.castRay(x, y, angle, maxRange);
+}
+
+void LineMap::castScan(float x, float y, float heading, float firstAngle, float angleIncrement,
+                       int numBeams, float maxRange, std::vector<float>& ranges)
+{
+    index_.castScan(x, y, heading, firstAngle, angleIncrement, numBeams, maxRange, ranges);
+}
+
+float LineMap::getDistanceToNearestLine(float x, float y, float maxDist)
+{
+    return index_.getDistanceToNearestLine(x, y, maxDist);
+}
+
+//////////////////////////////////////
+///// METHODS OF CLASS SIMULATOR /////
+//////////////////////////////////////
+
+Simulator::Simulator()
+{
+    timeStep = 0.25;
+    wheelBase = 0.38;
+    maxLinVel = 0.5;
+    maxRotVel = 10.0; // same limit that PioneerBase sets in ARIA
+    robotRadius = 0.25;
+
+    numLasers = 181;
+    firstLaserAngle = 90.0;
+    laserAngleIncrement = -1.0;
+    maxLaserRange = 32.0;
+    laserNoise = 0.01;
+
+    float angles[8] = {90, 50, 30, 10, -10, -30, -50, -90};
+    numSonars = 8;
+    sonarAngles.assign(angles, angles+8);
+    sonarConeWidth = 30.0;
+    numRaysPerSonar = 7;
+    maxSonarRange = 5.0;
+    sonarNoise = 0.05;
+
+    odometryNoise = 0.0;
+
+    x_ = y_ = theta_ = 0.0;
+    odomX_ = odomY_ = odomTh_ = 0.0;
+    time_ = 0.0;
+    vLeft_ = vRight_ = 0.0;
+
+    setSeed(0);
+}
+
+bool Simulator::loadMap(std::string filename)
+{
+    if(!map_.load(filename))
+        return false;
+
+    // the robot starts at the RobotHome cairn, with odometry (0,0,0)
+    x_ = map_.home.x;
+    y_ = map_.home.y;
+    theta_ = DEG2RAD(map_.home.theta);
+    odomX_ = odomY_ = odomTh_ = 0.0;
+    time_ = 0.0;
+
+    return true;
+}
+
+LineMap* Simulator::getMap()
+{
+    return &map_;
+}
+
+void Simulator::setSeed(unsigned int seed)
+{
+    rng_.seed(seed);
+}
+
+float Simulator::gaussian(float stdDev)
+{
+    if(stdDev <= 0.0)
+        return 0.0;
+    std::normal_distribution<float> dist(0.0, stdDev);
+    return dist(rng_);
+}
+
+void Simulator::setWheelsVelocity(float vl, float vr)
+{
+    vLeft_ = vl;
+    vRight_ = vr;
+}
+
+bool Simulator::isMoving()
+{
+    return vLeft_ != 0.0 || vRight_ != 0.0;
+}
+
+void Simulator::step()
+{
+    step(timeStep);
+}
+
+void Simulator::step(float dt)
+{
+    // wheels' velocities are given in mm/s
+    float v = (vLeft_ + vRight_)/2000.0;
+    float w = (vRight_ - vLeft_)/(1000.0*wheelBase);
+
+    v = std::max(-maxLinVel, std::min(maxLinVel, v));
+    float maxW = DEG2RAD(maxRotVel);
+    w = std::max(-maxW, std::min(maxW, w));
+
+    float ds = v*dt;
+    float dth = w*dt;
+
+    // true motion, the robot stalls instead of going through walls
+    double nx = x_ + ds*cos(theta_ + dth/2.0);
+    double ny = y_ + ds*sin(theta_ + dth/2.0);
+    if(ds != 0.0){
+        float newDist = map_.getDistanceToNearestLine(nx, ny, 2*robotRadius);
+        if(newDist < robotRadius && newDist < map_.getDistanceToNearestLine(x_, y_, 2*robotRadius))
+            ds = 0.0;
+        else{
+            x_ = nx;
+            y_ = ny;
+        }
+    }
+    theta_ = normalizeAngleRAD(theta_ + dth);
+
+    // odometry
+    float ods = ds*(1.0 + gaussian(odometryNoise));
+    float odth = dth*(1.0 + gaussian(odometryNoise));
+    odomX_ += ods*cos(odomTh_ + odth/2.0);
+    odomY_ += ods*sin(odomTh_ + odth/2.0);
+    odomTh_ = normalizeAngleRAD(odomTh_ + odth);
+
+    time_ += dt;
+}
+
+void Simulator::readLasers(std::vector<float>& lasers)
+{
+    map_.castScan(x_, y_, theta_, DEG2RAD(firstLaserAngle), DEG2RAD(laserAngleIncrement),
+                  numLasers, maxLaserRange, lasers);
+    for(int k=0; k<numLasers; k++){
+        float r = lasers[k];
+        if(r < maxLaserRange)
+            r += gaussian(laserNoise);
+        lasers[k] = std::max(0.0f, std::min(maxLaserRange, r));
+    }
+}
+
+void Simulator::readSonars(std::vector<float>& sonars)
+{
+    sonars.resize(numSonars);
+    for(int i=0; i<numSonars; i++){
+        // a sonar returns the first echo inside its cone
+        float r = maxSonarRange;
+        for(int j=0; j<numRaysPerSonar; j++){
+            float a = sonarAngles[i] - sonarConeWidth/2.0 + j*sonarConeWidth/std::max(numRaysPerSonar-1, 1);
+            r = std::min(r, map_.castRay(x_, y_, theta_ + DEG2RAD(a), maxSonarRange));
+        }
+        if(r < maxSonarRange)
+            r += gaussian(sonarNoise);
+        sonars[i] = std::max(0.0f, std::min(maxSonarRange, r));
+    }
+}
+
+const Pose& Simulator::getOdometry()
+{
+    odometry_ = Pose(odomX_, odomY_, RAD2DEG(odomTh_));
+    return odometry_;
+}
+
+const Pose& Simulator::getTruePose()
+{
+    truePose_ = Pose(x_, y_, RAD2DEG(theta_));
+    return truePose_;
+}
+
+void Simulator::setTruePose(const Pose& p)
+{
+    x_ = p.x;
+    y_ = p.y;
+    theta_ = DEG2RAD(p.theta);
+}
+
+float Simulator::getTime()
+{
+    return time_;
+}
@@ -0,0 +1,93 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <string>
+#include <vector>
+#include <random>
+
+#include "SegmentGrid.h"
+#include "Utils.h"
+
+// Line map in the MobileSim/ARIA .map format (only the LINES section and the RobotHome cairn are used)
+class LineMap
+{
+    public:
+        LineMap();
+
+        bool load(std::string filename);
+
+        // angles in radians
+        float castRay(float x, float y, float angle, float maxRange);
+        void castScan(float x, float y, float heading, float firstAngle, float angleIncrement,
+                      int numBeams, float maxRange, std::vector<float>& ranges);
+        float getDistanceToNearestLine(float x, float y, float maxDist);
+
+        std::vector<Segment> lines;
+        Pose home;
+        float minX, minY, maxX, maxY;
+
+    private:
+        SegmentGrid index_;
+};
+
+// In-process replacement for MobileSim: differential-drive kinematics,
+// 2D laser and sonar ray casting against a LineMap, no ARIA involved
+class Simulator
+{
+    public:
+        Simulator();
+
+        bool loadMap(std::string filename);
+        LineMap* getMap();
+
+        void setWheelsVelocity(float vl, float vr); // in mm/s, as in ArRobot::setVel2
+        bool isMoving();
+        void step();
+        void step(float dt);
+
+        void readLasers(std::vector<float>& lasers);
+        void readSonars(std::vector<float>& sonars);
+
+        const Pose& getOdometry();
+        const Pose& getTruePose();
+        void setTruePose(const Pose& p); // teleports the robot, odometry is not changed
+        float getTime();
+
+        void setSeed(unsigned int seed);
+
+        // Parameters
+        float timeStep;       // seconds simulated per step()
+        float wheelBase;      // m
+        float maxLinVel;      // m/s
+        float maxRotVel;      // deg/s
+        float robotRadius;    // m, used for collisions
+
+        int numLasers;
+        float firstLaserAngle, laserAngleIncrement; // deg
+        float maxLaserRange;  // m
+        float laserNoise;     // std. deviation, in m
+
+        int numSonars;
+        std::vector<float> sonarAngles; // deg
+        float sonarConeWidth; // deg
+        int numRaysPerSonar;
+        float maxSonarRange;  // m
+        float sonarNoise;     // std. deviation, in m
+
+        float odometryNoise;  // std. deviation, as a fraction of the displacement
+
+    private:
+        LineMap map_;
+
+        double x_, y_, theta_;          // true pose in the map frame (m, m, rad)
+        double odomX_, odomY_, odomTh_; // odometry, starting at (0,0,0)
+        Pose truePose_, odometry_;
+        double time_;
+
+        float vLeft_, vRight_;
+
+        std::mt19937 rng_;
+        float gaussian(float stdDev);
+};
+
+#endif // SIMULATOR_H
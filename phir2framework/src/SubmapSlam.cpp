@@ -0,0 +1,403 @@
+#include "SubmapSlam.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "SensorModels.h"
+#include "Trace.h"
+
+///////////////////
+///// SUBMAP /////
+///////////////////
+
+Submap::Submap(const Pose& a, int s)
+{
+    anchor = a;
+    numScans = 0;
+    scale = s;
+    minU = minV = 0;
+    width = height = 0;
+}
+
+float Submap::getLogOdds(int u, int v) const
+{
+    u -= minU;
+    v -= minV;
+    if(u < 0 || v < 0 || u >= width || v >= height)
+        return 0.0;
+    return logodds[v*width + u];
+}
+
+float Submap::getOccupancy(int u, int v) const
+{
+    float l = getLogOdds(u,v);
+    return (l == 0.0) ? 0.0 : occupancyFromLogOdds(l);
+}
+
+// Keeps the cells, with room for a few more meters on every side
+void Submap::grow(int u0, int v0, int u1, int v1)
+{
+    if(width > 0 && u0 >= minU && v0 >= minV && u1 < minU+width && v1 < minV+height)
+        return;
+
+    int margin = 3*scale;
+    int newMinU = std::min(u0, width > 0 ? minU : u0) - margin;
+    int newMinV = std::min(v0, height > 0 ? minV : v0) - margin;
+    int newMaxU = std::max(u1, width > 0 ? minU+width-1 : u1) + margin;
+    int newMaxV = std::max(v1, height > 0 ? minV+height-1 : v1) + margin;
+    int newWidth = newMaxU - newMinU + 1, newHeight = newMaxV - newMinV + 1;
+
+    std::vector<float> l(newWidth*newHeight, 0.0);
+    std::vector<int> stamps(newWidth*newHeight, 0);
+    for(int v=0; v<height; v++)
+        for(int u=0; u<width; u++){
+            int p = (v + minV - newMinV)*newWidth + u + minU - newMinU;
+            l[p] = logodds[v*width + u];
+            stamps[p] = lastScan_[v*width + u];
+        }
+
+    logodds.swap(l);
+    lastScan_.swap(stamps);
+    minU = newMinU; minV = newMinV;
+    width = newWidth; height = newHeight;
+}
+
+void Submap::insert(const LaserPointCloud& points, const Pose& local, float maxRange)
+{
+    numScans++;
+
+    // cells like the mapping methods: from the robot's cell, the offsets rounded
+    int robotU = local.x*scale, robotV = local.y*scale;
+    float c = cos(DEG2RAD(local.theta)), s = sin(DEG2RAD(local.theta));
+
+    int n = points.size();
+    std::vector<int> endU(n), endV(n);
+    std::vector<bool> isHit(n);
+    int u0 = robotU, v0 = robotV, u1 = robotU, v1 = robotV;
+    for(int k=0; k<n; k++){
+        float x = points.x[k], y = points.y[k];
+        float r = sqrt(x*x + y*y);
+        isHit[k] = points.hit[k] && r <= maxRange;
+        if(r > maxRange){
+            x *= maxRange/r;
+            y *= maxRange/r;
+        }
+        endU[k] = robotU + lround((c*x - s*y)*scale);
+        endV[k] = robotV + lround((s*x + c*y)*scale);
+        u0 = std::min(u0, endU[k]); u1 = std::max(u1, endU[k]);
+        v0 = std::min(v0, endV[k]); v1 = std::max(v1, endV[k]);
+    }
+    grow(u0, v0, u1, v1);
+
+    float logOddsOcc = logOddsFromOccupancy(CONE_P_OCCUPIED);
+    float logOddsFree = logOddsFromOccupancy(CONE_P_FREE);
+
+    // hits first, a cell hit by one beam and crossed by another counts as hit
+    for(int k=0; k<n; k++){
+        if(!isHit[k])
+            continue;
+        int p = (endV[k]-minV)*width + endU[k]-minU;
+        if(lastScan_[p] != numScans){
+            logodds[p] += logOddsOcc;
+            lastScan_[p] = numScans;
+        }
+    }
+
+    // Bresenham from the robot up to the cell before the end of the ray
+    for(int k=0; k<n; k++){
+        int du = abs(endU[k]-robotU), dv = -abs(endV[k]-robotV);
+        int su = (endU[k] > robotU) ? 1 : -1, sv = (endV[k] > robotV) ? 1 : -1;
+        int err = du + dv;
+        int u = robotU, v = robotV;
+        while(u != endU[k] || v != endV[k]){
+            int p = (v-minV)*width + u-minU;
+            if(lastScan_[p] != numScans){
+                logodds[p] += logOddsFree;
+                lastScan_[p] = numScans;
+            }
+            int e2 = 2*err;
+            if(e2 >= dv){ err += dv; u += su; }
+            if(e2 <= du){ err += du; v += sv; }
+        }
+    }
+}
+
+/////////////////////////
+///// SUBMAP SLAM /////
+/////////////////////////
+
+SubmapSlam::SubmapSlam(int scale)
+{
+    scansPerSubmap = 20;
+    maxRange = 10.0;
+    loopClosureEvery = 5;
+    loopClosureDistance = 5.0;
+    loopClosureMinScore = 0.6;
+    loopClosureLinearWindow = 1.0;
+    loopClosureAngularWindow = 10.0;
+    odometryInformationXY = 100.0;      // 10 cm
+    odometryInformationTheta = 400.0;   // ~3 deg
+    loopInformationXY = 100.0;          // 10 cm
+    loopInformationTheta = 1000.0;      // ~2 deg
+    loopHuberDelta = 2.0;
+
+    scale_ = scale;
+    numScans_ = 0;
+
+    graphChanged_ = stopping_ = false;
+    pthread_mutex_init(&mutex_, NULL);
+    pthread_cond_init(&wakeUp_, NULL);
+    pthread_create(&thread_, NULL, startOptimizerThread, this);
+}
+
+SubmapSlam::~SubmapSlam()
+{
+    pthread_mutex_lock(&mutex_);
+    stopping_ = true;
+    pthread_cond_signal(&wakeUp_);
+    pthread_mutex_unlock(&mutex_);
+    pthread_join(thread_, NULL);
+
+    pthread_cond_destroy(&wakeUp_);
+    pthread_mutex_destroy(&mutex_);
+    for(unsigned int k=0; k<submaps_.size(); k++)
+        delete submaps_[k];
+}
+
+int SubmapSlam::getNumSubmaps()
+{
+    return submaps_.size();
+}
+
+int SubmapSlam::getNumLoopClosures()
+{
+    return loopClosures_.size();
+}
+
+Pose SubmapSlam::addScan(const LaserPointCloud& points, const Pose& frontEnd)
+{
+    numScans_++;
+
+    if(submaps_.empty() || getActiveSubmap()->numScans >= scansPerSubmap){
+        pthread_mutex_lock(&mutex_);
+        if(submaps_.empty()){
+            graph_.addNode(frontEnd);
+            optimized_.push_back(frontEnd);
+        }else{
+            // the new anchor as the front end sees it from the previous one
+            PoseGraphEdge e;
+            e.from = submaps_.size()-1;
+            e.to = submaps_.size();
+            e.measurement = relativePose(getActiveSubmap()->anchor, frontEnd);
+            e.informationXY = odometryInformationXY;
+            e.informationTheta = odometryInformationTheta;
+            Pose p = composePoses(optimized_.back(), e.measurement);
+            graph_.addNode(p);
+            graph_.addEdge(e);
+            optimized_.push_back(p);
+        }
+        pthread_mutex_unlock(&mutex_);
+
+        submaps_.push_back(new Submap(frontEnd, scale_));
+        rendered_.resize(submaps_.size());
+        renderedPose_.resize(submaps_.size());
+        renderedScans_.resize(submaps_.size(), 0);
+    }
+
+    Submap* active = getActiveSubmap();
+    Pose local = relativePose(active->anchor, frontEnd);
+    active->insert(points, local, maxRange);
+
+    if(numScans_ % std::max(1, loopClosureEvery) == 0)
+        searchLoopClosures(points, frontEnd);
+
+    pthread_mutex_lock(&mutex_);
+    Pose anchor = optimized_.back();
+    pthread_mutex_unlock(&mutex_);
+    return composePoses(anchor, local);
+}
+
+// Matches the scan against the older submaps near the robot, every good match is a loop closure
+// (the best one kept per pair). The submap just before the active one already overlaps it and
+// is skipped.
+void SubmapSlam::searchLoopClosures(const LaserPointCloud& points, const Pose& frontEnd)
+{
+    int j = submaps_.size()-1;
+    Pose local = relativePose(submaps_[j]->anchor, frontEnd);
+
+    pthread_mutex_lock(&mutex_);
+    std::vector<Pose> poses = optimized_;
+    pthread_mutex_unlock(&mutex_);
+    Pose current = composePoses(poses[j], local);
+
+    matcher_.linearWindow = loopClosureLinearWindow;
+    matcher_.angularWindow = loopClosureAngularWindow;
+    matcher_.angularStep = 0.5;
+    matcher_.numLevels = 5;
+    matcher_.minScore = loopClosureMinScore;
+    matcher_.translationCost = 0.5;
+    matcher_.rotationCost = 0.02;
+
+    for(int i=0; i<j-1; i++){
+        if(hypot(poses[i].x - current.x, poses[i].y - current.y) > loopClosureDistance)
+            continue;
+
+        const Submap* submap = submaps_[i];
+        ScanMatcher::OccupancyLookup occupancy = [submap](int u, int v) { return submap->getOccupancy(u,v); };
+        Pose guess = relativePose(poses[i], current);
+        Pose match;
+        if(!matcher_.match(occupancy, scale_, points, guess, match))
+            match = guess;
+        if(matcher_.getLastScore() < loopClosureMinScore)
+            continue;
+
+        // one closure per pair of submaps, from the scan that matched best
+        std::pair<int,int> pair(i, j);
+        std::map<std::pair<int,int>, LoopClosure>::iterator found = loopClosures_.find(pair);
+        if(found != loopClosures_.end() && found->second.score >= matcher_.getLastScore())
+            continue;
+
+        // the scan is at 'match' in submap i and at 'local' in submap j
+        PoseGraphEdge e;
+        e.from = i;
+        e.to = j;
+        e.measurement = composePoses(match, invertPose(local));
+        e.informationXY = loopInformationXY;
+        e.informationTheta = loopInformationTheta;
+        e.huberDelta = loopHuberDelta;
+
+        pthread_mutex_lock(&mutex_);
+        if(found == loopClosures_.end()){
+            LoopClosure c;
+            c.edge = graph_.edges.size();
+            loopClosures_[pair] = c;
+            graph_.addEdge(e);
+        }else
+            graph_.edges[found->second.edge] = e;
+        loopClosures_[pair].score = matcher_.getLastScore();
+        graphChanged_ = true;
+        pthread_cond_signal(&wakeUp_);
+        pthread_mutex_unlock(&mutex_);
+    }
+}
+
+void* SubmapSlam::startOptimizerThread(void* ref)
+{
+    Trace::setThreadName("slam optimizer");
+    ((SubmapSlam*) ref)->runOptimizer();
+    return NULL;
+}
+
+// Optimizes a copy of the graph, so the robot thread can keep adding to it meanwhile; the
+// submaps added during the optimization follow their predecessor through the front-end edge
+void SubmapSlam::runOptimizer()
+{
+    pthread_mutex_lock(&mutex_);
+    while(!stopping_){
+        if(!graphChanged_){
+            pthread_cond_wait(&wakeUp_, &mutex_);
+            continue;
+        }
+        graphChanged_ = false;
+        PoseGraph graph = graph_;
+        pthread_mutex_unlock(&mutex_);
+
+        {
+            TRACE_ZONE("SubmapSlam::optimize");
+            graph.optimize(20);
+        }
+
+        pthread_mutex_lock(&mutex_);
+        unsigned int n = graph.nodes.size();
+        for(unsigned int k=0; k<n; k++)
+            optimized_[k] = graph_.nodes[k] = graph.nodes[k];
+        for(unsigned int e=0; e<graph_.edges.size(); e++){
+            const PoseGraphEdge& edge = graph_.edges[e];
+            if(edge.to >= (int)n && edge.from == edge.to-1)
+                optimized_[edge.to] = graph_.nodes[edge.to] = composePoses(optimized_[edge.from], edge.measurement);
+        }
+    }
+    pthread_mutex_unlock(&mutex_);
+}
+
+void SubmapSlam::render(Grid* grid)
+{
+    pthread_mutex_lock(&mutex_);
+    std::vector<Pose> poses = optimized_;
+    pthread_mutex_unlock(&mutex_);
+
+    for(unsigned int k=0; k<submaps_.size(); k++){
+        const Pose& p = poses[k];
+        const Pose& r = renderedPose_[k];
+        bool moved = fabs(p.x - r.x) > 1e-4 || fabs(p.y - r.y) > 1e-4 || fabs(p.theta - r.theta) > 1e-3;
+        if(moved || renderedScans_[k] != submaps_[k]->numScans)
+            renderSubmap(grid, k, p);
+    }
+}
+
+// Takes back what the submap drew, and draws it at 'pose': every grid cell under the submap
+// takes the submap cell it falls on
+void SubmapSlam::renderSubmap(Grid* grid, int k, const Pose& pose)
+{
+    TRACE_ZONE("SubmapSlam::renderSubmap");
+    int half = grid->getMapWidth()/2;
+
+    std::vector<RenderedCell>& cells = rendered_[k];
+
+    // the level-of-detail pyramid is refreshed over the bounding box of the drawn cells
+    auto markRendered = [&](){
+        if(cells.empty())
+            return;
+        int minX = cells[0].x, maxX = cells[0].x, minY = cells[0].y, maxY = cells[0].y;
+        for(unsigned int i=1; i<cells.size(); i++){
+            minX = std::min(minX, cells[i].x); maxX = std::max(maxX, cells[i].x);
+            minY = std::min(minY, cells[i].y); maxY = std::max(maxY, cells[i].y);
+        }
+        grid->markDirty(minX, minY, maxX, maxY);
+    };
+
+    for(unsigned int i=0; i<cells.size(); i++){
+        Cell* c = grid->getCell(cells[i].x, cells[i].y);
+        c->logodds -= cells[i].logodds;
+        c->occupancy = occupancyFromLogOdds(c->logodds);
+    }
+    markRendered();
+    cells.clear();
+
+    const Submap* s = submaps_[k];
+    renderedPose_[k] = pose;
+    renderedScans_[k] = s->numScans;
+    if(s->width == 0)
+        return;
+
+    // bounding box of the submap's corners on the grid
+    int minX = half, minY = half, maxX = -half, maxY = -half;
+    float c = cos(DEG2RAD(pose.theta)), sn = sin(DEG2RAD(pose.theta));
+    for(int i=0; i<4; i++){
+        float u = (i & 1) ? s->minU + s->width : s->minU - 1;
+        float v = (i & 2) ? s->minV + s->height : s->minV - 1;
+        float x = pose.x*scale_ + c*u - sn*v, y = pose.y*scale_ + sn*u + c*v;
+        minX = std::min(minX, (int)floor(x)); maxX = std::max(maxX, (int)ceil(x));
+        minY = std::min(minY, (int)floor(y)); maxY = std::max(maxY, (int)ceil(y));
+    }
+    minX = std::max(minX, -half+1); minY = std::max(minY, -half+1);
+    maxX = std::min(maxX, half); maxY = std::min(maxY, half);
+
+    // grid cell -> submap cell, with the inverse pose
+    float ox = pose.x*scale_, oy = pose.y*scale_;
+    for(int y=minY; y<=maxY; y++)
+        for(int x=minX; x<=maxX; x++){
+            float dx = x - ox, dy = y - oy;
+            float l = s->getLogOdds(lround(c*dx + sn*dy), lround(-sn*dx + c*dy));
+            if(l == 0.0)
+                continue;
+
+            Cell* cell = grid->getCell(x,y);
+            cell->logodds += l;
+            cell->occupancy = occupancyFromLogOdds(cell->logodds);
+            RenderedCell r;
+            r.x = x; r.y = y; r.logodds = l;
+            cells.push_back(r);
+        }
+    markRendered();
+}
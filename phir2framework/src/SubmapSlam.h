@@ -0,0 +1,112 @@
+#ifndef SUBMAPSLAM_H
+#define SUBMAPSLAM_H
+
+#include <map>
+#include <pthread.h>
+#include <vector>
+
+#include "Grid.h"
+#include "PoseGraph.h"
+#include "ScanMatcher.h"
+#include "Utils.h"
+
+// Local log-odds map of a few consecutive scans, in the frame of its anchor (the front-end pose
+// of its first scan). Cells are 1/scale m and the map grows with the scans.
+class Submap
+{
+    public:
+        Submap(const Pose& anchor, int scale);
+
+        // Rays of the scan seen from 'local' (pose in the anchor frame): the hit cells are occupied,
+        // the cells before them free, each cell updated once per scan
+        void insert(const LaserPointCloud& points, const Pose& local, float maxRange);
+
+        float getLogOdds(int u, int v) const;
+        float getOccupancy(int u, int v) const; // 0 where nothing was seen, like the grid's edges
+
+        Pose anchor;
+        int numScans;
+        int scale;
+        int minU, minV, width, height; // cells
+        std::vector<float> logodds;
+
+    private:
+        void grow(int u0, int v0, int u1, int v1);
+        std::vector<int> lastScan_; // scan that last updated each cell
+};
+
+// Pose-graph SLAM back end over submaps. Each node of the graph is the anchor of a submap:
+// consecutive submaps are tied by the front end (odometry), and every few scans the scan is
+// matched against the older submaps around the robot; a good match is a loop closure between
+// the current submap and the old one, with a Huber cost against the wrong ones.
+//
+// The graph is optimized on a background thread (Levenberg-Marquardt, sparse Cholesky, see
+// PoseGraph) whenever it gains a loop closure. The laser log-odds of the global grid are the
+// sum of the submaps at their optimized poses: render() re-draws only the submaps that moved
+// and the one being built, subtracting what each drew before.
+class SubmapSlam
+{
+    public:
+        SubmapSlam(int scale);
+        ~SubmapSlam();
+
+        // Scan taken at a front-end pose, returns the pose in the optimized frame
+        Pose addScan(const LaserPointCloud& points, const Pose& frontEnd);
+
+        // Caller holds the grid mutex
+        void render(Grid* grid);
+
+        int getNumSubmaps();
+        int getNumLoopClosures();
+
+        // Parameters
+        int scansPerSubmap;
+        float maxRange;               // m, longer readings only clear the cells up to it
+        int loopClosureEvery;         // scans between loop closure searches
+        float loopClosureDistance;    // m, submaps whose anchor is this close are searched
+        float loopClosureMinScore;
+        float loopClosureLinearWindow, loopClosureAngularWindow; // m, deg
+        float odometryInformationXY, odometryInformationTheta;   // per m^2, per rad^2
+        float loopInformationXY, loopInformationTheta;
+        float loopHuberDelta; // standard deviations, see PoseGraphEdge
+
+    private:
+        Submap* getActiveSubmap() { return submaps_.back(); }
+        void searchLoopClosures(const LaserPointCloud& points, const Pose& frontEnd);
+        void renderSubmap(Grid* grid, int k, const Pose& pose);
+
+        std::vector<Submap*> submaps_;
+        int scale_;
+        ScanMatcher matcher_;
+        int numScans_;
+
+        // graph_ (and optimized_) are shared with the optimizer thread
+        PoseGraph graph_;
+        std::vector<Pose> optimized_;
+        bool graphChanged_, stopping_;
+        pthread_t thread_;
+        pthread_mutex_t mutex_;
+        pthread_cond_t wakeUp_;
+        class LoopClosure
+        {
+            public:
+                int edge;    // in graph_.edges
+                float score; // of the scan that gave it
+        };
+        std::map<std::pair<int,int>, LoopClosure> loopClosures_; // by (old submap, new submap)
+        static void* startOptimizerThread(void* ref);
+        void runOptimizer();
+
+        // what each submap added to the grid's log-odds, to take it back when it moves
+        class RenderedCell
+        {
+            public:
+                int x, y;
+                float logodds;
+        };
+        std::vector< std::vector<RenderedCell> > rendered_;
+        std::vector<Pose> renderedPose_;
+        std::vector<int> renderedScans_;
+};
+
+#endif // SUBMAPSLAM_H
@@ -0,0 +1,200 @@
+#include "Trace.h"
+#include "Metrics.h"
+
+#include <time.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <atomic>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+
+#define TRACE_BUFFER_SIZE (1<<18) // events per thread, later events are dropped
+
+class TraceEvent
+{
+    public:
+        const char* name;
+        long long start, end;
+};
+
+class TraceBuffer
+{
+    public:
+        TraceBuffer() : count(0), dropped(0)
+        {
+            events = new TraceEvent[TRACE_BUFFER_SIZE];
+            tid = syscall(SYS_gettid);
+            name = "";
+        }
+
+        TraceEvent* events;
+        std::atomic<int> count; // only the owner thread writes, dump() reads
+        int dropped;
+        int tid;
+        std::string name;
+};
+
+bool Trace::enabled_ = false;
+std::string Trace::filename_ = "";
+
+static std::vector<TraceBuffer*> buffers;
+static pthread_mutex_t buffersMutex = PTHREAD_MUTEX_INITIALIZER;
+static thread_local TraceBuffer* threadBuffer = NULL;
+
+static TraceBuffer* getThreadBuffer()
+{
+    if(threadBuffer == NULL){
+        threadBuffer = new TraceBuffer();
+        pthread_mutex_lock(&buffersMutex);
+        buffers.push_back(threadBuffer);
+        pthread_mutex_unlock(&buffersMutex);
+    }
+    return threadBuffer;
+}
+
+static void dumpAtExit()
+{
+    Trace::dump();
+}
+
+void Trace::initialize()
+{
+    const char* filename = getenv("PHIR2_TRACE");
+    if(filename != NULL && filename[0] != '\0')
+        enable(filename);
+}
+
+void Trace::enable(std::string filename)
+{
+    if(enabled_)
+        return;
+    filename_ = filename;
+    enabled_ = true;
+    atexit(dumpAtExit);
+    std::cout << "Tracing to " << filename_ << std::endl;
+}
+
+void Trace::setThreadName(const char* name)
+{
+    if(enabled_)
+        getThreadBuffer()->name = name;
+}
+
+long long Trace::now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec*1000000000LL + t.tv_nsec;
+}
+
+void Trace::record(const char* name, long long start, long long end)
+{
+    TraceBuffer* b = getThreadBuffer();
+    int n = b->count.load(std::memory_order_relaxed);
+    if(n >= TRACE_BUFFER_SIZE){
+        b->dropped++;
+        return;
+    }
+    b->events[n].name = name;
+    b->events[n].start = start;
+    b->events[n].end = end;
+    b->count.store(n+1, std::memory_order_release);
+}
+
+// hold start of the mutex locked by this thread, also used by the metrics
+static thread_local long long holdStart = 0;
+static thread_local const char* holdName = NULL;
+
+void Trace::lockMutex(pthread_mutex_t* m, const char* waitName, const char* holdName)
+{
+    if(!enabled_ && !Metrics::isEnabled()){
+        pthread_mutex_lock(m);
+        return;
+    }
+
+    static MetricHistogram* waitTime = Metrics::histogram("phir2_grid_mutex_wait_seconds", "Time waiting to lock grid->mutex");
+    static MetricCounter* contended = Metrics::counter("phir2_grid_mutex_contended_total", "Locks of grid->mutex that had to wait");
+
+    long long start = now();
+    if(pthread_mutex_trylock(m) != 0){
+        contended->add();
+        pthread_mutex_lock(m);
+    }
+    long long locked = now();
+
+    waitTime->record((locked-start)/1e9);
+    if(enabled_)
+        record(waitName, start, locked);
+
+    ::holdStart = locked;
+    ::holdName = holdName;
+}
+
+void Trace::unlockMutex(pthread_mutex_t* m)
+{
+    if(::holdName != NULL){
+        static MetricHistogram* holdTime = Metrics::histogram("phir2_grid_mutex_hold_seconds", "Time holding grid->mutex");
+
+        long long end = now();
+        holdTime->record((end-::holdStart)/1e9);
+        if(enabled_)
+            record(::holdName, ::holdStart, end);
+        ::holdName = NULL;
+    }
+    pthread_mutex_unlock(m);
+}
+
+void Trace::dump()
+{
+    if(!enabled_)
+        return;
+
+    std::ofstream file(filename_.c_str());
+    if(!file.is_open()){
+        std::cerr << "Error: could not write trace " << filename_ << std::endl;
+        return;
+    }
+
+    // timestamps are given in microseconds, relative to the earliest start: events are appended
+    // when their zone ends, so an enclosing zone comes after the zones nested in it
+    pthread_mutex_lock(&buffersMutex);
+    long long origin = -1;
+    for(unsigned int i=0; i<buffers.size(); i++){
+        int n = buffers[i]->count.load(std::memory_order_acquire);
+        for(int e=0; e<n; e++)
+            if(origin < 0 || buffers[i]->events[e].start < origin)
+                origin = buffers[i]->events[e].start;
+    }
+
+    file << "{\"traceEvents\": [" << std::endl;
+    file << std::fixed << std::setprecision(3);
+    bool first = true;
+    int dropped = 0;
+    for(unsigned int i=0; i<buffers.size(); i++){
+        TraceBuffer* b = buffers[i];
+        int n = b->count.load(std::memory_order_acquire);
+        dropped += b->dropped;
+
+        if(!b->name.empty()){
+            file << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << b->tid
+                 << ", \"args\": {\"name\": \"" << b->name << "\"}}";
+            first = false;
+        }
+        for(int e=0; e<n; e++){
+            const TraceEvent& ev = b->events[e];
+            file << (first ? "" : ",\n") << "{\"name\": \"" << ev.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << b->tid
+                 << ", \"ts\": " << (ev.start-origin)/1000.0 << ", \"dur\": " << (ev.end-ev.start)/1000.0 << "}";
+            first = false;
+        }
+    }
+    file << "\n]}" << std::endl;
+    pthread_mutex_unlock(&buffersMutex);
+
+    std::cout << "Trace written to " << filename_;
+    if(dropped > 0)
+        std::cout << " (" << dropped << " events dropped, buffers full)";
+    std::cout << std::endl;
+}
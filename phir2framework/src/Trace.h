@@ -0,0 +1,66 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <pthread.h>
+#include <string>
+
+// Scoped trace zones for the robot, planning and GLUT threads, dumped as Chrome trace JSON
+// (open in chrome://tracing or ui.perfetto.dev). Tracing is off unless the PHIR2_TRACE
+// environment variable names the output file; when off, a zone costs one branch.
+//
+// Each thread writes its events into its own buffer, without locks; the buffers are
+// written to the file when the program exits.
+class Trace
+{
+    public:
+        static void initialize(); // reads PHIR2_TRACE, call once before starting the threads
+        static void enable(std::string filename);
+        static bool isEnabled() { return enabled_; }
+
+        static void setThreadName(const char* name);
+        static long long now(); // ns, monotonic
+        static void record(const char* name, long long start, long long end);
+        static void dump();
+
+        // pthread_mutex_lock/unlock that also record the wait and hold times
+        // (in the trace and in the grid mutex metrics)
+        static void lockMutex(pthread_mutex_t* m, const char* waitName, const char* holdName);
+        static void unlockMutex(pthread_mutex_t* m);
+
+    private:
+        static bool enabled_;
+        static std::string filename_;
+};
+
+// Records the time between its construction and its destruction (or end()/next())
+class TraceZone
+{
+    public:
+        TraceZone(const char* name) : name_(name), start_(Trace::isEnabled() ? Trace::now() : 0) {}
+        ~TraceZone() { end(); }
+
+        void end()
+        {
+            if(start_ != 0)
+                Trace::record(name_, start_, Trace::now());
+            start_ = 0;
+        }
+
+        // ends this zone and starts the next stage
+        void next(const char* name)
+        {
+            end();
+            name_ = name;
+            start_ = Trace::isEnabled() ? Trace::now() : 0;
+        }
+
+    private:
+        const char* name_; // must be a string literal
+        long long start_;
+};
+
+#define TRACE_CONCAT_(a,b) a##b
+#define TRACE_CONCAT(a,b) TRACE_CONCAT_(a,b)
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(traceZone_,__LINE__)(name)
+
+#endif // TRACE_H
@@ -1,10 +1,13 @@
 #include "Utils.h"
 
 #include <unistd.h>
+#include <stdlib.h>
 #include <sstream>
 #include <iomanip>
 #include <errno.h>
 #include <string.h>
+#include <pthread.h>
+#include <algorithm>
 
 float normalizeAngleDEG(float a)
 {
@@ -24,6 +27,58 @@ float normalizeAngleRAD(float a)
     return a;
 }
 
+int getNumberOfCores()
+{
+    int n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? n : 1;
+}
+
+struct ParallelForData
+{
+    std::function<void(int)>* job;
+    int numJobs;
+    int nextJob;
+    pthread_mutex_t mutex;
+};
+
+static void* parallelForWorker(void* ref)
+{
+    ParallelForData* data = (ParallelForData*) ref;
+    while(true){
+        pthread_mutex_lock(&data->mutex);
+        int j = data->nextJob++;
+        pthread_mutex_unlock(&data->mutex);
+
+        if(j >= data->numJobs)
+            break;
+        (*data->job)(j);
+    }
+    return NULL;
+}
+
+// Runs job(0) ... job(numJobs-1) on numThreads threads, each one taking the next pending job
+void parallelFor(int numJobs, int numThreads, std::function<void(int)> job)
+{
+    ParallelForData data;
+    data.job = &job;
+    data.numJobs = numJobs;
+    data.nextJob = 0;
+    pthread_mutex_init(&data.mutex, NULL);
+
+    numThreads = std::max(1, std::min(numThreads, numJobs));
+    std::vector<pthread_t> threads(numThreads-1);
+    for(unsigned int t=0; t<threads.size(); t++)
+        pthread_create(&threads[t], NULL, parallelForWorker, &data);
+
+    // the calling thread works too
+    parallelForWorker(&data);
+
+    for(unsigned int t=0; t<threads.size(); t++)
+        pthread_join(threads[t], NULL);
+
+    pthread_mutex_destroy(&data.mutex);
+}
+
 /////////////////////////////////
 ///// METHODS OF CLASS POSE /////
 /////////////////////////////////
@@ -42,12 +97,286 @@ std::ostream& operator<<(std::ostream& os, const Pose& p)
     return os;
 }
 
+/////////////////////////////////////////////
+///// METHODS OF CLASS LASERDESCRIPTION /////
+/////////////////////////////////////////////
+
+LaserDescription::LaserDescription()
+{
+    numBeams_ = 181;
+    firstAngle_ = 90.0;
+    angleIncrement_ = -1.0;
+    maxRange_ = 4.0; // 6.5;
+    buildTables();
+}
+
+LaserDescription::LaserDescription(int numBeams, float firstAngle, float angleIncrement, float maxRange)
+{
+    numBeams_ = numBeams;
+    firstAngle_ = firstAngle;
+    angleIncrement_ = angleIncrement;
+    maxRange_ = maxRange;
+    buildTables();
+}
+
+// File with one "key value" per line: numBeams, firstAngle, angleIncrement, maxRange ('#' starts a comment)
+bool LaserDescription::load(std::string filename)
+{
+    std::ifstream file(filename.c_str());
+    if(!file.is_open())
+        return false;
+
+    int n = numBeams_;
+    float first = firstAngle_, inc = angleIncrement_, range = maxRange_;
+    std::string line;
+    while(getline(file, line)){
+        std::stringstream ss(line.substr(0, line.find('#')));
+        std::string key;
+        if(!(ss >> key))
+            continue;
+        if(key == "numBeams")            ss >> n;
+        else if(key == "firstAngle")     ss >> first;
+        else if(key == "angleIncrement") ss >> inc;
+        else if(key == "maxRange")       ss >> range;
+        else{
+            std::cerr << "Error: unknown key '" << key << "' in " << filename << std::endl;
+            return false;
+        }
+    }
+
+    if(n < 1 || inc == 0.0 || range <= 0.0 || fabs(inc)*(n-1) > 360.0){
+        std::cerr << "Error: invalid laser description in " << filename << std::endl;
+        return false;
+    }
+
+    *this = LaserDescription(n, first, inc, range);
+    return true;
+}
+
+const LaserDescription& LaserDescription::getConfigured()
+{
+    static LaserDescription configured;
+    static bool loaded = false;
+    if(!loaded){
+        loaded = true;
+        const char* filename = getenv("PHIR2_LASER_CONFIG");
+        if(filename != NULL && !configured.load(filename))
+            std::cerr << "Warning: could not load laser description " << filename << ", using the default" << std::endl;
+    }
+    return configured;
+}
+
+int LaserDescription::computeNearestBeam(float angle) const
+{
+    // beams are counted from the center of the scan, so the default scanner rounds the
+    // angle itself, like the original 90-(int)(angle +- 0.5)
+    float offset = (angle - centerAngle_)/angleIncrement_;
+    int k = centerBeam_ + (int)((offset > 0.0)?(offset + 0.5):(offset - 0.5));
+    return std::max(0, std::min(numBeams_-1, k));
+}
+
+void LaserDescription::buildTables()
+{
+    centerBeam_ = numBeams_/2;
+    centerAngle_ = firstAngle_ + centerBeam_*angleIncrement_;
+
+    beamAngles_.resize(numBeams_);
+    beamCos_.resize(numBeams_);
+    beamSin_.resize(numBeams_);
+    for(int k=0; k<numBeams_; k++){
+        beamAngles_[k] = firstAngle_ + k*angleIncrement_;
+        beamCos_[k] = cos(DEG2RAD(beamAngles_[k]));
+        beamSin_[k] = sin(DEG2RAD(beamAngles_[k]));
+    }
+
+    // a bin whose edges (slightly widened) fall on the same beam holds no boundary, the
+    // nearest beam grows monotonically with the angle
+    binsPerDegree_ = 4.0/fabs(angleIncrement_);
+    int numBins = ceil(360.0*binsPerDegree_) + 1;
+    float margin = 0.01/binsPerDegree_;
+    bearingTable_.resize(numBins);
+    for(int b=0; b<numBins; b++){
+        float minAngle = -180.0 + b/binsPerDegree_;
+        float maxAngle = -180.0 + (b+1)/binsPerDegree_;
+        int k = computeNearestBeam(minAngle - margin);
+        bearingTable_[b] = (k == computeNearestBeam(maxAngle + margin)) ? k : -1;
+    }
+}
+
+std::ostream& operator<<(std::ostream& os, const LaserDescription& d)
+{
+    os << d.numBeams_ << ' ' << d.firstAngle_ << ' ' << d.angleIncrement_ << ' ' << d.maxRange_;
+    return os;
+}
+
+/////////////////////////////////////
+///// METHODS OF CLASS RANGEMIN /////
+/////////////////////////////////////
+
+void RangeMin::build(const std::vector<float>& values)
+{
+    int n = values.size();
+    log2_.assign(n+1, 0);
+    for(int i=2; i<=n; i++)
+        log2_[i] = log2_[i/2] + 1;
+
+    levels_.resize(n > 0 ? log2_[n]+1 : 0);
+    if(n == 0)
+        return;
+    levels_[0] = values;
+    for(unsigned int l=1; l<levels_.size(); l++){
+        int half = 1 << (l-1);
+        int size = n - (1 << l) + 1;
+        levels_[l].resize(size);
+        for(int i=0; i<size; i++)
+            levels_[l][i] = std::min(levels_[l-1][i], levels_[l-1][i+half]);
+    }
+}
+
+float RangeMin::getMin(int first, int last) const
+{
+    // two overlapping power-of-two windows cover [first, last]
+    int l = log2_[last-first+1];
+    return std::min(levels_[l][first], levels_[l][last - (1 << l) + 1]);
+}
+
+////////////////////////////////////////////
+///// METHODS OF CLASS LASERSCANFILTER /////
+////////////////////////////////////////////
+
+LaserScanFilter::LaserScanFilter()
+{
+    despeckle_ = false;
+    prepared_ = false;
+}
+
+void LaserScanFilter::setDespeckle(bool d)
+{
+    despeckle_ = d;
+    prepared_ = false;
+}
+
+void LaserScanFilter::update(const std::vector<float>& readings)
+{
+    scan_ = readings;
+    prepared_ = false;
+}
+
+void LaserScanFilter::prepare()
+{
+    if(prepared_)
+        return;
+    prepared_ = true;
+
+    int n = scan_.size();
+    readings_ = scan_;
+    if(despeckle_){
+        for(int i=1; i+1<n; i++){
+            float a = scan_[i-1], b = scan_[i], c = scan_[i+1];
+            readings_[i] = std::max(std::min(a,b), std::min(std::max(a,b), c));
+        }
+    }
+
+    prefixSums_.resize(n+1);
+    prefixSums_[0] = 0.0;
+    for(int i=0; i<n; i++)
+        prefixSums_[i+1] = prefixSums_[i] + readings_[i];
+
+    min_.build(readings_);
+    smoothedMin_.clear();
+}
+
+bool LaserScanFilter::clamp(int& first, int& last)
+{
+    prepare();
+    first = std::max(first, 0);
+    last = std::min(last, (int)readings_.size()-1);
+    return first <= last;
+}
+
+float LaserScanFilter::getMin(int first, int last)
+{
+    if(!clamp(first, last))
+        return 1000000;
+    return min_.getMin(first, last);
+}
+
+float LaserScanFilter::getMean(int first, int last)
+{
+    if(!clamp(first, last))
+        return 0.0;
+    return (prefixSums_[last+1] - prefixSums_[first])/(last-first+1);
+}
+
+float LaserScanFilter::getSmoothedMin(int first, int last, int kernelSize)
+{
+    if(kernelSize <= 0)
+        return getMin(first, last);
+    if(!clamp(first, last))
+        return 1000000;
+
+    std::map<int, RangeMin>::iterator it = smoothedMin_.find(kernelSize);
+    if(it == smoothedMin_.end()){
+        // mean of the beams within kernelSize of each beam, fewer at the ends of the scan
+        int n = readings_.size();
+        std::vector<float> smoothed(n);
+        for(int i=0; i<n; i++)
+            smoothed[i] = getMean(i-kernelSize, i+kernelSize);
+        it = smoothedMin_.insert(std::make_pair(kernelSize, RangeMin())).first;
+        it->second.build(smoothed);
+    }
+    return it->second.getMin(first, last);
+}
+
+////////////////////////////////////////////
+///// METHODS OF CLASS LASERPOINTCLOUD /////
+////////////////////////////////////////////
+
+LaserPointCloud::LaserPointCloud()
+{
+    worldValid_ = false;
+}
+
+void LaserPointCloud::update(const std::vector<float>& readings, const LaserDescription& laser)
+{
+    int n = std::min((int)readings.size(), laser.getNumBeams());
+    x.resize(n);
+    y.resize(n);
+    hit.resize(n);
+    float maxRange = laser.getMaxRange();
+    for(int k=0; k<n; k++){
+        x[k] = readings[k]*laser.getCosOfBeam(k);
+        y[k] = readings[k]*laser.getSinOfBeam(k);
+        hit[k] = readings[k] < maxRange;
+    }
+    worldValid_ = false;
+}
+
+void LaserPointCloud::setPose(const Pose& p)
+{
+    if(worldValid_ && p.x == pose_.x && p.y == pose_.y && p.theta == pose_.theta)
+        return;
+
+    int n = x.size();
+    worldX.resize(n);
+    worldY.resize(n);
+    float c = cos(DEG2RAD(p.theta)), s = sin(DEG2RAD(p.theta));
+    for(int k=0; k<n; k++){
+        worldX[k] = p.x + c*x[k] - s*y[k];
+        worldY[k] = p.y + s*x[k] + c*y[k];
+    }
+    pose_ = p;
+    worldValid_ = true;
+}
+
 ////////////////////////////////////
 ///// METHODS OF CLASS LOGFILE /////
 ////////////////////////////////////
 
 LogFile::LogFile(LogMode mode, std::string name)
 {
+    hasLaserDescription_ = false;
+
     time_t t = time(0);
     struct tm *now = localtime(&t);
     std::stringstream ss;
@@ -66,16 +395,49 @@ LogFile::LogFile(LogMode mode, std::string name)
     }
     else if(mode == PLAYBACK)
     {
-        filename = "../phir2framework/Sensors/"+name;
+        // plain names are looked up in the Sensors folder, paths are used as given
+        if(name.find('/') == std::string::npos)
+            filename = "../phir2framework/Sensors/"+name;
+        else
+            filename = name;
         std::cout << filename << std::endl;
         file.open(filename.c_str(), std::fstream::in);
         if(file.fail()){
             std::cerr << "Error: " << strerror(errno) << std::endl;
             exit(1);
         }
+
+        std::streampos start = file.tellg();
+        std::string tag;
+        file >> tag;
+        if(tag == "LaserDescription"){
+            int n;
+            float first, inc, range;
+            file >> n >> first >> inc >> range;
+            laserDescription_ = LaserDescription(n, first, inc, range);
+            hasLaserDescription_ = true;
+            getline(file, tag);
+        }else{
+            file.seekg(start);
+        }
     }
 }
 
+void LogFile::writeLaserDescription(const LaserDescription& d)
+{
+    file << "LaserDescription " << d << std::endl;
+}
+
+bool LogFile::hasLaserDescription()
+{
+    return hasLaserDescription_;
+}
+
+const LaserDescription& LogFile::getLaserDescription()
+{
+    return laserDescription_;
+}
+
 Pose LogFile::readPose(std::string info)
 {
     std::string tempStr;
@@ -89,7 +451,7 @@ Pose LogFile::readPose(std::string info)
 
 std::vector<float> LogFile::readSensors(std::string info)
 {
-    int max;
+    int max = 0;
     std::string tempStr;
     std::vector<float> sensors;
 
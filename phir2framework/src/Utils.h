@@ -7,10 +7,12 @@
 #include <iostream>
 #include <cmath>
 #include <vector>
+#include <functional>
+#include <map>
 
-enum ConnectionMode {SIMULATION, SERIAL, WIFI};
+enum ConnectionMode {SIMULATION, SERIAL, WIFI, LOCAL_SIMULATION};
 enum LogMode { NONE, RECORDING, PLAYBACK};
-enum MotionMode {MANUAL_SIMPLE, MANUAL_VEL, WANDER, WALLFOLLOW, POTFIELD_0, POTFIELD_1, POTFIELD_2, ENDING};
+enum MotionMode {MANUAL_SIMPLE, MANUAL_VEL, WANDER, WALLFOLLOW, POTFIELD_0, POTFIELD_1, POTFIELD_2, POTFIELD_3, FOLLOW_PATH, ENDING};
 enum MovingDirection {STOP, FRONT, BACK, LEFT, RIGHT, RESTART, DEC_ANG_VEL, INC_ANG_VEL, INC_LIN_VEL, DEC_LIN_VEL};
 
 #define DEG2RAD(x) x*M_PI/180.0
@@ -19,6 +21,9 @@ enum MovingDirection {STOP, FRONT, BACK, LEFT, RIGHT, RESTART, DEC_ANG_VEL, INC_
 float normalizeAngleDEG(float a);
 float normalizeAngleRAD(float a);
 
+int getNumberOfCores();
+void parallelFor(int numJobs, int numThreads, std::function<void(int)> job);
+
 class Pose{
     public:
         Pose();
@@ -29,11 +34,64 @@ class Pose{
         float x, y, theta;
 };
 
+// Geometry of the laser scanner: beam k points at firstAngle + k*angleIncrement (deg, relative
+// to the robot heading). The default is the Pioneer's SICK, 181 beams from 90 to -90 degrees.
+// Other scanners are described in a file (see Config/) named by PHIR2_LASER_CONFIG.
+class LaserDescription
+{
+    public:
+        LaserDescription();
+        LaserDescription(int numBeams, float firstAngle, float angleIncrement, float maxRange);
+
+        bool load(std::string filename);
+        static const LaserDescription& getConfigured();
+
+        int getNumBeams() const { return numBeams_; }
+        float getFirstAngle() const { return firstAngle_; }
+        float getAngleIncrement() const { return angleIncrement_; }
+        float getMaxRange() const { return maxRange_; }
+
+        float getAngleOfBeam(int k) const { return beamAngles_[k]; }
+        float getCosOfBeam(int k) const { return beamCos_[k]; }
+        float getSinOfBeam(int k) const { return beamSin_[k]; }
+
+        // O(1): a table over the bearings, with bins of a quarter of the beam spacing, gives
+        // the beam of the bins that do not hold a boundary between beams
+        int getNearestBeam(float angle) const
+        {
+            int b = (angle + 180.0)*binsPerDegree_;
+            if(b >= 0 && b < (int)bearingTable_.size() && bearingTable_[b] >= 0)
+                return bearingTable_[b];
+            return computeNearestBeam(angle);
+        }
+
+        friend std::ostream& operator<<(std::ostream& os, const LaserDescription& d);
+
+    private:
+        int computeNearestBeam(float angle) const;
+        void buildTables();
+
+        int numBeams_;
+        float firstAngle_, angleIncrement_; // deg
+        float maxRange_;                    // m
+
+        int centerBeam_;
+        float centerAngle_;
+        std::vector<float> beamAngles_, beamCos_, beamSin_;
+        float binsPerDegree_;
+        std::vector<int> bearingTable_;
+};
+
 class LogFile
 {
     public:
         LogFile(LogMode mode, std::string name);
 
+        // Recorded logs start with the description of the laser, older logs have none
+        void writeLaserDescription(const LaserDescription& d);
+        bool hasLaserDescription();
+        const LaserDescription& getLaserDescription();
+
         Pose readPose(std::string info);
         std::vector<float> readSensors(std::string info);
 
@@ -45,6 +103,72 @@ class LogFile
     private:
         std::fstream file;
         std::string filename;
+
+        bool hasLaserDescription_;
+        LaserDescription laserDescription_;
+};
+
+// Range-minimum queries in O(1) over a fixed sequence (sparse table, built in O(n log n))
+class RangeMin
+{
+    public:
+        void build(const std::vector<float>& values);
+        float getMin(int first, int last) const;
+
+    private:
+        std::vector< std::vector<float> > levels_; // levels_[l][i]: min of values[i .. i+2^l-1]
+        std::vector<int> log2_;
+};
+
+// Per-scan preprocessing of the laser readings, shared by every query on the same scan:
+// prefix sums for the means over any sector, range-minimum tables for the raw readings and,
+// for each kernel size, for the readings smoothed by a (2k+1)-beam mean. Optionally the
+// readings are despeckled first by a 3-beam median. A new scan is only copied: the tables
+// are built by the first query on it, so scans nobody queries cost nothing.
+class LaserScanFilter
+{
+    public:
+        LaserScanFilter();
+
+        void update(const std::vector<float>& readings);
+        void setDespeckle(bool d);
+
+        float getMin(int first, int last);
+        float getMean(int first, int last);
+        float getSmoothedMin(int first, int last, int kernelSize);
+
+    private:
+        void prepare();
+        bool clamp(int& first, int& last);
+
+        bool despeckle_;
+        bool prepared_;              // tables up to date with scan_
+        std::vector<float> scan_;
+        std::vector<float> readings_; // scan_, despeckled if enabled
+        std::vector<double> prefixSums_; // prefixSums_[i]: sum of readings_[0 .. i-1]
+        RangeMin min_;
+        std::map<int, RangeMin> smoothedMin_;
+};
+
+// Points of the current laser scan, in struct-of-arrays layout. The robot frame (x forward,
+// y to the left, in m) is computed once per scan from the beams' sin/cos tables, the world
+// frame once per pose.
+class LaserPointCloud
+{
+    public:
+        LaserPointCloud();
+
+        void update(const std::vector<float>& readings, const LaserDescription& laser);
+        void setPose(const Pose& p);
+        int size() const { return x.size(); }
+
+        std::vector<float> x, y;
+        std::vector<float> worldX, worldY;
+        std::vector<unsigned char> hit; // 0 for readings at the max range, which hit nothing
+
+    private:
+        bool worldValid_;
+        Pose pose_;
 };
 
 class Timer{
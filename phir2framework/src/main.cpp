@@ -1,20 +1,104 @@
 #include <pthread.h>
 #include <iostream>
 #include <string.h>
+#include <stdlib.h>
 
 #include "Robot.h"
 #include "Planning.h"
+#include "Trace.h"
+#include "Metrics.h"
+#ifndef HEADLESS
 #include "GlutClass.h"
+#endif
 
 ConnectionMode connectionMode;
 LogMode logMode;
 
 std::string filename;
+std::string mapname;
 pthread_mutex_t* mutex;
 
+#ifdef HEADLESS
+
+// Headless build: no GLUT window, the robot and the planner run in lockstep
+// with the in-process simulator, as fast as the CPU allows
+int main(int argc, char* argv[])
+{
+    if(argc < 2){
+        std::cout << "Usage: " << argv[0] << " <map file> [motion mode] [simulated seconds] [-r] [-l saved map]" << std::endl;
+        std::cout << "  motion mode: same numbers as the keyboard (3 - WANDER, 4 - WALLFOLLOW, 5..7 - POTFIELD_0..2, 8 - FAST MARCHING, 9 - FOLLOW_PATH)" << std::endl;
+        std::cout << "  -l: localize with the particle filter against a map saved by the map builder (.raw)" << std::endl;
+        return 1;
+    }
+
+    mapname = argv[1];
+    MotionMode motionMode = POTFIELD_0;
+    float duration = 300.0;
+    logMode = NONE;
+    filename = "";
+
+    if(argc > 2){
+        int key = atoi(argv[2]);
+        MotionMode modes[10] = {MANUAL_SIMPLE, MANUAL_SIMPLE, MANUAL_VEL, WANDER, WALLFOLLOW, POTFIELD_0, POTFIELD_1, POTFIELD_2, POTFIELD_3, FOLLOW_PATH};
+        if(key >= 1 && key <= 9)
+            motionMode = modes[key];
+    }
+    if(argc > 3)
+        duration = atof(argv[3]);
+    std::string localizationMap = "";
+    for(int i=4; i<argc; i++){
+        if(!strncmp(argv[i], "-r", 2))
+            logMode = RECORDING;
+        else if(!strncmp(argv[i], "-l", 2) && i+1<argc)
+            localizationMap = argv[++i];
+    }
+
+    Trace::initialize();
+    Metrics::initialize();
+    Trace::setThreadName("robot+planning");
+
+    Robot* r;
+    r = new Robot();
+
+    r->grid->mutex = new pthread_mutex_t;
+    if (pthread_mutex_init(r->grid->mutex,NULL) != 0){
+        printf("\n mutex init failed\n");
+        return 1;
+    }
+
+    if(!localizationMap.empty() && !r->setLocalizationMap(localizationMap)){
+        std::cerr << "Error: could not load " << localizationMap << std::endl;
+        return 1;
+    }
+
+    r->setSimulationMap(mapname);
+    r->initialize(LOCAL_SIMULATION, logMode, filename);
+    r->motionMode_ = motionMode;
+
+    Simulator* sim = r->getSimulator();
+    Timer timer;
+    while(r->isRunning() && sim->getTime() < duration){
+        r->run();
+        r->plan->run();
+    }
+
+    float wallTime = timer.getTotalTime();
+    std::cout << "Simulated " << sim->getTime() << " s in " << wallTime << " s ("
+              << sim->getTime()/wallTime << "x real time)" << std::endl;
+    std::cout << "Final pose: " << r->getCurrentPose() << " true pose: " << sim->getTruePose() << std::endl;
+
+    pthread_mutex_destroy(r->grid->mutex);
+    delete r;
+
+    return 0;
+}
+
+#else
+
 void* startRobotThread (void* ref)
 {
     Robot* robot=(Robot*) ref;
+    Trace::setThreadName("robot");
 
     robot->initialize(connectionMode, logMode, filename);
 
@@ -27,6 +111,7 @@ void* startRobotThread (void* ref)
 
 void* startGlutThread (void* ref)
 {
+    Trace::setThreadName("glut");
     GlutClass* glut=GlutClass::getInstance();
     glut->setRobot((Robot*) ref);
 
@@ -40,6 +125,8 @@ void* startGlutThread (void* ref)
 void* startPlanningThread (void* ref)
 {
     Robot* robot=(Robot*) ref;
+    Trace::setThreadName("planning");
+
     while(!robot->isReady()){
         std::cout << "Planning is waiting..." << std::endl;
         usleep(100000);
@@ -58,6 +145,10 @@ int main(int argc, char* argv[])
     connectionMode = SIMULATION;
     logMode = NONE;
     filename = "";
+    mapname = "";
+
+    // index of the log mode argument, the in-process simulator takes a map file before it
+    int argi = 2;
 
     if(argc > 1){
         if(!strncmp(argv[1], "sim", 3))
@@ -66,26 +157,35 @@ int main(int argc, char* argv[])
             connectionMode=WIFI;
         else if(!strncmp(argv[1], "serial", 6))
             connectionMode=SERIAL;
+        else if(!strncmp(argv[1], "localsim", 8)){
+            connectionMode=LOCAL_SIMULATION;
+            if(argc > 2)
+                mapname = argv[2];
+            argi = 3;
+        }
     }
 
-    if(argc > 2){
-        if (!strncmp(argv[2], "-R", 2)){
+    if(argc > argi){
+        if (!strncmp(argv[argi], "-R", 2)){
             logMode = RECORDING;
-        }else if (!strncmp(argv[2], "-r", 2)) {
+        }else if (!strncmp(argv[argi], "-r", 2)) {
             logMode = RECORDING;
         }
-        else if (!strncmp(argv[2], "-p", 2)) {
+        else if (!strncmp(argv[argi], "-p", 2)) {
             logMode = PLAYBACK;
-            filename = argv[3];
+            filename = argv[argi+1];
         }
-        else if (!strncmp(argv[2], "-P", 2)){
+        else if (!strncmp(argv[argi], "-P", 2)){
             logMode = PLAYBACK;
-            filename = argv[3];
-        }else if(!strncmp(argv[4], "-n", 2)){
+            filename = argv[argi+1];
+        }else if(!strncmp(argv[argi], "-n", 2)){
             logMode = NONE;
         }
     }
 
+    Trace::initialize();
+    Metrics::initialize();
+
     pthread_t robotThread, glutThread, potentialThread;
 
     Robot* r;
@@ -97,6 +197,9 @@ int main(int argc, char* argv[])
         return 1;
     }
 
+    if(connectionMode==LOCAL_SIMULATION)
+        r->setSimulationMap(mapname);
+
     pthread_create(&(robotThread),NULL,startRobotThread,(void*)r);
     pthread_create(&(glutThread),NULL,startGlutThread,(void*)r);
     pthread_create(&(potentialThread),NULL,startPlanningThread,(void*)r);
@@ -110,3 +213,4 @@ int main(int argc, char* argv[])
     return 0;
 }
 
+#endif